@@ -0,0 +1,284 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Runs mkatr and lsatr over the corpus generated by gencorpus, measuring the
+ * wall time, the peak memory and the throughput. Results are written as JSON
+ * to the standard output.
+ */
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *prog_name;
+
+static void error(const char *format, ...)
+{
+    va_list ap;
+    fprintf(stderr, "%s: Error, ", prog_name);
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+// Measures of one benchmark
+struct result
+{
+    double wall;     // Median of wall time, in seconds
+    double wall_min; // Minimum wall time
+    long max_rss;    // Peak resident memory, in KB
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Runs the program once, with output discarded, returns the wall time
+static double run_once(char **args, long *max_rss)
+{
+    double start = now();
+    pid_t pid    = fork();
+    if( pid < 0 )
+        error("fork: %s", strerror(errno));
+    if( !pid )
+    {
+        int fd = open("/dev/null", O_WRONLY);
+        if( fd >= 0 )
+        {
+            dup2(fd, 1);
+            dup2(fd, 2);
+        }
+        execv(args[0], args);
+        _exit(127);
+    }
+    int status;
+    struct rusage ru;
+    if( wait4(pid, &status, 0, &ru) < 0 )
+        error("wait: %s", strerror(errno));
+    double wall = now() - start;
+    if( !WIFEXITED(status) || WEXITSTATUS(status) )
+        error("command '%s' failed", args[0]);
+    if( ru.ru_maxrss > *max_rss )
+        *max_rss = ru.ru_maxrss;
+    return wall;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int remove_cb(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    return remove(path);
+}
+
+// Runs the program the given times, the directory "clean" is removed before
+// each run, outside the measured time.
+static struct result run(char **args, int runs, const char *clean)
+{
+    struct result r = {0, 0, 0};
+    double *t       = malloc(sizeof(double) * runs);
+    if( !t )
+        error("memory error");
+    for( int i = 0; i < runs; i++ )
+    {
+        if( clean && nftw(clean, remove_cb, 16, FTW_DEPTH | FTW_PHYS) && errno != ENOENT )
+            error("can't remove '%s': %s", clean, strerror(errno));
+        t[i] = run_once(args, &r.max_rss);
+    }
+    qsort(t, runs, sizeof(double), cmp_double);
+    r.wall     = t[runs / 2];
+    r.wall_min = t[0];
+    free(t);
+    return r;
+}
+
+static int first_result = 1;
+
+static void print_result(const char *tool, const char *mode, const char *input,
+                         long bytes, struct result r)
+{
+    printf("%s\n    {\"tool\": \"%s\", \"mode\": \"%s\", \"input\": \"%s\", "
+           "\"bytes\": %ld, \"wall_s\": %.6f, \"wall_min_s\": %.6f, "
+           "\"max_rss_kb\": %ld, \"mb_per_s\": %.3f}",
+           first_result ? "" : ",", tool, mode, input, bytes, r.wall, r.wall_min,
+           r.max_rss, r.wall > 0 ? bytes / r.wall / 1e6 : 0.0);
+    first_result = 0;
+    fprintf(stderr, "%-6s %-9s %-10s %9.3f ms %7ld KB %9.2f MB/s\n", tool, mode, input,
+            r.wall * 1e3, r.max_rss, r.wall > 0 ? bytes / r.wall / 1e6 : 0.0);
+}
+
+static long file_size(const char *name)
+{
+    struct stat st;
+    if( stat(name, &st) )
+        error("%s: %s", name, strerror(errno));
+    return st.st_size;
+}
+
+// Reads the list of files of one tree and returns an argument list for mkatr,
+// with space for the program, options and output before the files.
+static char **read_list(const char *tree, int skip, long *bytes)
+{
+    char path[256], line[1024];
+    snprintf(path, sizeof(path), "trees/%s.lst", tree);
+    FILE *f = fopen(path, "r");
+    if( !f )
+        error("can't open '%s': %s, run gencorpus first", path, strerror(errno));
+    size_t num = skip, alloc = 64;
+    char **args = malloc(sizeof(char *) * alloc);
+    *bytes      = 0;
+    while( args && fgets(line, sizeof(line), f) )
+    {
+        line[strcspn(line, "\n")] = 0;
+        if( num + 2 > alloc )
+        {
+            alloc *= 2;
+            args = realloc(args, sizeof(char *) * alloc);
+            if( !args )
+                break;
+        }
+        args[num++] = strdup(line);
+        struct stat st;
+        if( !stat(line, &st) && S_ISREG(st.st_mode) )
+            *bytes += st.st_size;
+    }
+    if( !args )
+        error("memory error");
+    args[num] = 0;
+    fclose(f);
+    return args;
+}
+
+int main(int argc, char **argv)
+{
+    const char *corpus = 0;
+    char *mkatr        = 0;
+    char *lsatr        = 0;
+    int runs           = 5;
+
+    prog_name = argv[0];
+    for( int i = 1; i < argc; i++ )
+    {
+        if( !strcmp(argv[i], "-n") && i + 1 < argc )
+            runs = atoi(argv[++i]);
+        else if( !mkatr )
+            mkatr = argv[i];
+        else if( !lsatr )
+            lsatr = argv[i];
+        else if( !corpus )
+            corpus = argv[i];
+        else
+            error("too many arguments");
+    }
+    if( !corpus || runs < 1 )
+    {
+        fprintf(stderr, "Usage: %s [-n runs] <mkatr> <lsatr> <corpus_dir>\n", prog_name);
+        return EXIT_FAILURE;
+    }
+    // Programs are executed from the corpus dir, use absolute paths
+    mkatr = realpath(mkatr, 0);
+    lsatr = realpath(lsatr, 0);
+    if( !mkatr || !lsatr )
+        error("can't find programs: %s", strerror(errno));
+    if( chdir(corpus) )
+        error("can't change to '%s': %s", corpus, strerror(errno));
+    if( mkdir("out", 0777) && errno != EEXIST )
+        error("can't create output dir: %s", strerror(errno));
+
+    printf("{\n  \"runs\": %d,\n  \"results\": [", runs);
+
+    // Build images from each tree, standard and exact sizes, and reading the
+    // files with io_uring
+    static const char *trees[] = {"large", "tiny", "deep", "full", 0};
+    static const char *modes[] = {"standard", "exact", "uring"};
+    for( int i = 0; trees[i]; i++ )
+    {
+        char out[256];
+        long bytes;
+        char **args = read_list(trees[i], 4, &bytes);
+        for( int x = 0; x < 3; x++ )
+        {
+            // Arguments are "mkatr [-x | --io uring] output files..."
+            char **a = args + 2 - x;
+            snprintf(out, sizeof(out), "out/%s%s.atr", trees[i],
+                     x == 1 ? "-x" : x == 2 ? "-u" : "");
+            a[0] = mkatr;
+            if( x == 1 )
+                a[1] = "-x";
+            else if( x == 2 )
+            {
+                a[1] = "--io";
+                a[2] = "uring";
+            }
+            a[x + 1] = out;
+            print_result("mkatr", modes[x], trees[i], bytes, run(a, runs, 0));
+        }
+        for( char **p = args + 4; *p; p++ )
+            free(*p);
+        free(args);
+    }
+
+    // List and extract the generated images and the samples of other formats
+    static const char *images[] = {"out/large.atr",       "out/tiny.atr",
+                                   "out/deep.atr",        "out/full.atr",
+                                   "out/tiny-x.atr",      "images/dos2.atr",
+                                   "images/mydos.atr",    "images/kboot.atr",
+                                   "images/bas2boot.atr", "images/howfen.atr",
+                                   0};
+    for( int i = 0; images[i]; i++ )
+    {
+        char name[64];
+        const char *base = strchr(images[i], '/') + 1;
+        snprintf(name, sizeof(name), "%.*s", (int)strcspn(base, "."), base);
+        long bytes = file_size(images[i]);
+
+        char *list[] = {lsatr, (char *)images[i], 0};
+        print_result("lsatr", "list", name, bytes, run(list, runs, 0));
+
+        char *alist[] = {lsatr, "-a", (char *)images[i], 0};
+        print_result("lsatr", "atari", name, bytes, run(alist, runs, 0));
+
+        char dir[128];
+        snprintf(dir, sizeof(dir), "out/x-%s", name);
+        char *extract[] = {lsatr, "-X", dir, (char *)images[i], 0};
+        print_result("lsatr", "extract", name, bytes, run(extract, runs, dir));
+
+        char *uextract[] = {lsatr, "--io", "uring", "-X", dir, (char *)images[i], 0};
+        print_result("lsatr", "ext-uring", name, bytes, run(uextract, runs, dir));
+    }
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Measures the image builder of libmkatr, without any file I/O: builds images
+ * with many files in memory, with standard and exact sizes. Results are written
+ * as JSON to the standard output.
+ */
+#define _XOPEN_SOURCE 700
+#include "../src/mkimage.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Deterministic pseudo-random numbers
+static uint32_t rnd_state = 12345;
+static uint32_t rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void check(int e, const char *what)
+{
+    if( e )
+    {
+        fprintf(stderr, "buildbench: %s: %s\n", what, mkimage_strerror(e));
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Creates an image with "ndirs" directories of "nfiles" files each, with sizes
+// up to "max_size".
+static struct mkimage *make_tree(int ndirs, int nfiles, int max_size, long *bytes)
+{
+    static uint8_t data[65536];
+    for( size_t i = 0; i < sizeof(data); i++ )
+        data[i] = rnd();
+
+    struct mkimage *m = mkimage_new();
+    if( !m )
+        check(mkimage_err_memory, "new");
+    *bytes = 0;
+    for( int d = 0; d < ndirs; d++ )
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "DIR%d", d);
+        check(mkimage_add_dir(m, path, 0, 1577836800), path);
+        for( int f = 0; f < nfiles; f++ )
+        {
+            int size = rnd() % (max_size + 1);
+            snprintf(path, sizeof(path), "DIR%d/F%d.DAT", d, f);
+            check(mkimage_add_file(m, path, data, size, 0, 1577836800), path);
+            *bytes += size;
+        }
+    }
+    return m;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int first_result = 1;
+
+static void run(const char *name, struct mkimage *m, int exact, int runs, long bytes)
+{
+    double *t = malloc(sizeof(double) * runs);
+    size_t size;
+    mkimage_set_exact_size(m, exact);
+    for( int i = 0; i < runs; i++ )
+    {
+        uint8_t *atr;
+        double start = now();
+        check(mkimage_build_alloc(m, &atr, &size), name);
+        t[i] = now() - start;
+        free(atr);
+    }
+    qsort(t, runs, sizeof(double), cmp_double);
+    printf("%s\n    {\"tree\": \"%s\", \"mode\": \"%s\", \"bytes\": %ld, "
+           "\"atr_size\": %zu, \"build_s\": %.6f, \"build_min_s\": %.6f}",
+           first_result ? "" : ",", name, exact ? "exact" : "standard", bytes, size,
+           t[runs / 2], t[0]);
+    first_result = 0;
+    fprintf(stderr, "build  %-8s %-10s %9.3f ms %9.2f MB/s\n", exact ? "exact" : "standard",
+            name, t[runs / 2] * 1e3, bytes / t[runs / 2] / 1e6);
+    free(t);
+}
+
+int main(int argc, char **argv)
+{
+    int runs = argc > 1 ? atoi(argv[1]) : 5;
+    if( runs < 1 )
+    {
+        fprintf(stderr, "Usage: %s [runs]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Trees: many small files, and fewer big files
+    static const struct
+    {
+        const char *name;
+        int ndirs, nfiles, max_size;
+    } trees[] = {{"many", 16, 500, 2048}, {"big", 4, 60, 65536}, {0, 0, 0, 0}};
+
+    printf("{\n  \"runs\": %d,\n  \"results\": [", runs);
+    for( int i = 0; trees[i].name; i++ )
+    {
+        long bytes;
+        struct mkimage *m =
+            make_tree(trees[i].ndirs, trees[i].nfiles, trees[i].max_size, &bytes);
+        run(trees[i].name, m, 0, runs, bytes);
+        run(trees[i].name, m, 1, runs, bytes);
+        mkimage_free(m);
+    }
+    printf("\n  ]\n}\n");
+    return 0;
+}
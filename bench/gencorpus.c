@@ -0,0 +1,439 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Generates the benchmark corpus: trees of files to pass to mkatr, and sample
+ * images of the other supported formats to pass to lsatr.
+ *
+ * All the data is generated from a fixed seed, so the corpus is always the
+ * same. Each tree "NAME" is written to "trees/NAME", with the list of mkatr
+ * arguments (directories before its contents) in "trees/NAME.lst".
+ */
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+// Fixed modification time for all files: 2020-01-01
+#define FILE_TIME 1577836800
+
+static const char *prog_name;
+static uint32_t rnd_state;
+
+static void error(const char *format, ...)
+{
+    va_list ap;
+    fprintf(stderr, "%s: Error, ", prog_name);
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+// Deterministic pseudo-random numbers, xorshift32
+static uint32_t rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static unsigned rnd_range(unsigned min, unsigned max)
+{
+    return min + rnd() % (max - min + 1);
+}
+
+static uint8_t *rnd_data(size_t len)
+{
+    uint8_t *data = malloc(len ? len : 1);
+    if( !data )
+        error("memory error");
+    for( size_t i = 0; i < len; i++ )
+        data[i] = rnd() >> 24;
+    return data;
+}
+
+//---------------------------------------------------------------------
+// Trees of files
+struct tree
+{
+    FILE *lst;
+    size_t bytes;
+};
+
+static void make_dir(struct tree *t, const char *path)
+{
+    if( mkdir(path, 0777) && errno != EEXIST )
+        error("can't create '%s': %s", path, strerror(errno));
+    fprintf(t->lst, "%s\n", path);
+}
+
+static void write_data(const char *path, const uint8_t *data, size_t len)
+{
+    FILE *f = fopen(path, "wb");
+    if( !f )
+        error("can't create '%s': %s", path, strerror(errno));
+    if( len && 1 != fwrite(data, len, 1, f) )
+        error("can't write '%s': %s", path, strerror(errno));
+    if( fclose(f) )
+        error("can't write '%s': %s", path, strerror(errno));
+    struct utimbuf tb;
+    tb.actime = tb.modtime = FILE_TIME;
+    utime(path, &tb);
+}
+
+static void make_file(struct tree *t, const char *path, size_t len)
+{
+    uint8_t *data = rnd_data(len);
+    write_data(path, data, len);
+    free(data);
+    fprintf(t->lst, "%s\n", path);
+    t->bytes += len;
+}
+
+static void tree_begin(struct tree *t, const char *name)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "trees/%s.lst", name);
+    t->lst = fopen(buf, "w");
+    if( !t->lst )
+        error("can't create '%s': %s", buf, strerror(errno));
+    t->bytes = 0;
+    snprintf(buf, sizeof(buf), "trees/%s", name);
+    if( mkdir(buf, 0777) && errno != EEXIST )
+        error("can't create '%s': %s", buf, strerror(errno));
+}
+
+static void tree_end(struct tree *t, const char *name)
+{
+    fclose(t->lst);
+    printf("tree %-8s %9zu bytes\n", name, t->bytes);
+}
+
+// Few large files
+static void gen_large(void)
+{
+    struct tree t;
+    tree_begin(&t, "large");
+    make_file(&t, "trees/large/big1.bin", 2 * 1024 * 1024);
+    make_file(&t, "trees/large/big2.bin", 1024 * 1024);
+    make_file(&t, "trees/large/big3.bin", 512 * 1024 + 123);
+    make_file(&t, "trees/large/big4.bin", 100000);
+    tree_end(&t, "large");
+}
+
+// Many tiny files, in four directories
+static void gen_tiny(void)
+{
+    struct tree t;
+    char path[256];
+    tree_begin(&t, "tiny");
+    for( int d = 0; d < 4; d++ )
+    {
+        snprintf(path, sizeof(path), "trees/tiny/dir%d", d);
+        make_dir(&t, path);
+        for( int i = 0; i < 400; i++ )
+        {
+            snprintf(path, sizeof(path), "trees/tiny/dir%d/f%d.dat", d, i);
+            make_file(&t, path, rnd_range(1, 256));
+        }
+    }
+    tree_end(&t, "tiny");
+}
+
+// Deep directory structure
+static void gen_deep(void)
+{
+    struct tree t;
+    char path[512];
+    tree_begin(&t, "deep");
+    strcpy(path, "trees/deep");
+    for( int d = 0; d < 24; d++ )
+    {
+        size_t l = strlen(path);
+        snprintf(path + l, sizeof(path) - l, "/d%d", d);
+        make_dir(&t, path);
+        for( int i = 0; i < 4; i++ )
+        {
+            char fname[600];
+            snprintf(fname, sizeof(fname), "%s/file%d.txt", path, i);
+            make_file(&t, fname, rnd_range(1, 4096));
+        }
+    }
+    tree_end(&t, "deep");
+}
+
+// Near capacity of the biggest image, 16MB
+static void gen_full(void)
+{
+    struct tree t;
+    char path[256];
+    tree_begin(&t, "full");
+    for( int d = 0; d < 3; d++ )
+    {
+        snprintf(path, sizeof(path), "trees/full/part%d", d);
+        make_dir(&t, path);
+        for( int i = 0; i < 10; i++ )
+        {
+            snprintf(path, sizeof(path), "trees/full/part%d/data%d.bin", d, i);
+            make_file(&t, path, 500 * 1024 + rnd_range(0, 4096));
+        }
+    }
+    tree_end(&t, "full");
+}
+
+//---------------------------------------------------------------------
+// Sample images
+struct image
+{
+    uint8_t *data;
+    unsigned ssz;
+    unsigned nsec;
+};
+
+static void img_new(struct image *img, unsigned ssz, unsigned nsec)
+{
+    img->ssz  = ssz;
+    img->nsec = nsec;
+    img->data = calloc(ssz, nsec);
+    if( !img->data )
+        error("memory error");
+}
+
+static uint8_t *img_sec(struct image *img, unsigned sec)
+{
+    return img->data + (sec - 1) * img->ssz;
+}
+
+static void img_write(struct image *img, const char *name)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "images/%s.atr", name);
+    unsigned size = img->ssz == 256 ? 256 * (img->nsec - 3) + 384 : 128 * img->nsec;
+    FILE *f       = fopen(path, "wb");
+    if( !f )
+        error("can't create '%s': %s", path, strerror(errno));
+    uint8_t hdr[16] = {0x96, 0x02, size >> 4, size >> 12, img->ssz, img->ssz >> 8,
+                       size >> 20};
+    fwrite(hdr, 16, 1, f);
+    for( unsigned i = 0; i < img->nsec; i++ )
+        fwrite(img->data + i * img->ssz, (i < 3) ? 128 : img->ssz, 1, f);
+    if( fclose(f) )
+        error("can't write '%s': %s", path, strerror(errno));
+    free(img->data);
+    printf("image %-10s %9u bytes\n", name, size + 16);
+}
+
+// Atari DOS 2 and MyDOS images, sectors are allocated sequentially
+struct dos
+{
+    struct image img;
+    int mydos;
+    unsigned next;
+};
+
+static unsigned dos_alloc(struct dos *d)
+{
+    if( d->next == 360 )
+        d->next = 369;
+    if( d->next > d->img.nsec )
+        error("DOS image full");
+    return d->next++;
+}
+
+static void dos_entry(struct dos *d, unsigned dir, int idx, int flags, unsigned count,
+                      unsigned start, const char *name)
+{
+    uint8_t *e = img_sec(&d->img, dir + idx / 8) + (idx % 8) * 16;
+    e[0]       = flags;
+    e[1]       = count;
+    e[2]       = count >> 8;
+    e[3]       = start;
+    e[4]       = start >> 8;
+    memset(e + 5, ' ', 11);
+    for( int i = 0, p = 5; name[i] && p < 16; i++ )
+    {
+        if( name[i] == '.' )
+            p = 13;
+        else
+            e[p++] = name[i];
+    }
+}
+
+static void dos_file(struct dos *d, unsigned dir, int idx, const char *name, size_t len)
+{
+    uint8_t *data  = rnd_data(len);
+    unsigned dlen  = d->img.ssz - 3;
+    unsigned count = len ? (len + dlen - 1) / dlen : 1;
+    unsigned start = d->next == 360 ? 369 : d->next;
+    unsigned sec   = dos_alloc(d);
+    for( unsigned i = 0; i < count; i++ )
+    {
+        unsigned n  = len - i * dlen > dlen ? dlen : len - i * dlen;
+        unsigned nx = i + 1 < count ? dos_alloc(d) : 0;
+        uint8_t *s  = img_sec(&d->img, sec);
+        memcpy(s, data + i * dlen, n);
+        s[dlen]     = d->mydos ? nx >> 8 : (idx << 2) | (nx >> 8);
+        s[dlen + 1] = nx;
+        s[dlen + 2] = n;
+        sec         = nx;
+    }
+    free(data);
+    dos_entry(d, dir, idx, d->mydos ? 0x46 : 0x42, count, start, name);
+}
+
+static void dos_files(struct dos *d, unsigned dir, int first, int num, unsigned min,
+                      unsigned max)
+{
+    char name[16];
+    for( int i = first; i < first + num; i++ )
+    {
+        snprintf(name, sizeof(name), "FILE%d.DAT", i);
+        dos_file(d, dir, i, name, rnd_range(min, max));
+    }
+}
+
+static void dos_finish(struct dos *d, const char *name)
+{
+    uint8_t *v     = img_sec(&d->img, 360);
+    unsigned total = d->img.nsec - (d->mydos ? 12 : 13);
+    unsigned nfree = d->img.nsec + 1 - d->next;
+    v[0]           = d->mydos ? 3 : 2;
+    v[1]           = total;
+    v[2]           = total >> 8;
+    v[3]           = nfree;
+    v[4]           = nfree >> 8;
+    v[10]          = 0x0F;
+    img_write(&d->img, name);
+}
+
+static void gen_dos(void)
+{
+    struct dos d;
+
+    // DOS 2.0, single density
+    img_new(&d.img, 128, 720);
+    d.mydos = 0;
+    d.next  = 4;
+    dos_files(&d, 361, 0, 48, 100, 1800);
+    dos_finish(&d, "dos2");
+
+    // MyDOS, double density with a sub-directory
+    img_new(&d.img, 256, 1440);
+    d.mydos = 1;
+    d.next  = 4;
+    dos_files(&d, 361, 0, 60, 100, 4000);
+    unsigned sub = d.next;
+    for( int i = 0; i < 8; i++ )
+        dos_alloc(&d);
+    dos_entry(&d, 361, 60, 0x10, 8, sub, "SUBDIR");
+    dos_files(&d, sub, 0, 60, 100, 1500);
+    dos_finish(&d, "mydos");
+}
+
+static void gen_boot(void)
+{
+    struct image img;
+
+    // K-file boot image
+    size_t len    = 30000;
+    uint8_t *data = rnd_data(len);
+    img_new(&img, 128, 3 + (len + 127) / 128);
+    memcpy(img.data, "\x00\x03\x00\x07\x14\x07\x4c\x14\x07", 9);
+    img.data[9]  = len;
+    img.data[10] = len >> 8;
+    img.data[11] = len >> 16;
+    memcpy(img.data + 3 * 128, data, len);
+    free(data);
+    img_write(&img, "kboot");
+
+    // BAS2BOOT image
+    len  = 8000;
+    data = rnd_data(len);
+    img_new(&img, 128, 2 + (len + 127) / 128);
+    memcpy(img.data, "\x00\x02\x00\x07", 4);
+    img.data[8] = len;
+    img.data[9] = len >> 8;
+    memcpy(img.data + 128 + 0x3C, "BAS2BOOT", 8);
+    memcpy(img.data + 128 + 0x60, "BENCH       ", 12);
+    memcpy(img.data + 128 + 0x72, data, 14);
+    memcpy(img.data + 256, data + 14, len - 14);
+    free(data);
+    img_write(&img, "bas2boot");
+
+    // Howfen DOS image, with all the 20 boot files
+    img_new(&img, 128, 720);
+    memcpy(img.data + 0x58, "\x80\x28\x2f\x37\x26\x25\x2e\x00\x24\x2f\x33\x00", 12);
+    memcpy(img.data + 0x64, "\x36\x0e\x11\x00\x00", 5);
+    for( int i = 0; i < 20; i++ )
+    {
+        unsigned p   = 0x8A + i * 0x20;
+        unsigned sec = 10 + i * 35;
+        unsigned num = 20 + i;
+        img.data[p]  = 0x21 + i;
+        // Name and size use screen codes
+        for( int j = 0; j < 4; j++ )
+            img.data[p + 2 + j] = "GAME"[j] - 0x20;
+        img.data[p + 6]     = 0x21 + i;
+        img.data[p + 0x1B]  = 0x10;
+        img.data[p + 0x1C]  = 0x10 + num / 100;
+        img.data[p + 0x1D]  = 0x10 + num / 10 % 10;
+        img.data[p + 0x1E]  = 0x10 + num % 10;
+        img.data[0x32A + i] = sec;
+        img.data[0x33E + i] = sec >> 8;
+        // Data is contiguous, first bytes hold the length in sectors
+        data = rnd_data(num * 128);
+        memcpy(img.data + (sec - 1) * 128, data, num * 128);
+        free(data);
+        img.data[(sec - 1) * 128]     = 0;
+        img.data[(sec - 1) * 128 + 1] = num;
+    }
+    img_write(&img, "howfen");
+}
+
+//---------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    prog_name = argv[0];
+    if( argc != 2 )
+    {
+        fprintf(stderr, "Usage: %s <output_dir>\n", prog_name);
+        return EXIT_FAILURE;
+    }
+    if( mkdir(argv[1], 0777) && errno != EEXIST )
+        error("can't create '%s': %s", argv[1], strerror(errno));
+    if( chdir(argv[1]) )
+        error("can't change to '%s': %s", argv[1], strerror(errno));
+    if( (mkdir("trees", 0777) && errno != EEXIST) ||
+        (mkdir("images", 0777) && errno != EEXIST) )
+        error("can't create output dirs: %s", strerror(errno));
+
+    rnd_state = 12345;
+    gen_large();
+    gen_tiny();
+    gen_deep();
+    gen_full();
+    gen_dos();
+    gen_boot();
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Kernels of the list of files to add.
+ */
+#include "../src/flist.c"
+#include "microbench.h"
+#include <stdio.h>
+
+#define NUM_NAMES 1000
+
+// flist_atari_name() of host file names of many shapes
+static void names_kernel(void *arg)
+{
+    char **names = arg;
+    for( int i = 0; i < NUM_NAMES; i++ )
+    {
+        char *aname = flist_atari_name(names[i]);
+        if( aname )
+            micro_sink += aname[0];
+        free(aname);
+    }
+}
+
+// path_name() of the Atari names, in a sub-directory
+static void path_kernel(void *arg)
+{
+    char **anames = arg;
+    for( int i = 0; i < NUM_NAMES; i++ )
+    {
+        char *pname = anames[i] ? path_name(">GAMES>ACTION", anames[i]) : 0;
+        if( pname )
+            micro_sink += pname[14];
+        free(pname);
+    }
+}
+
+void micro_flist(void)
+{
+    static const char *formats[] = {"games/action/file%u.com", "README%u.txt",
+                                    "some dir/Long File Name %u.data", "%u",
+                                    "a/b/c/d/e/f/x%u.y.z"};
+    char **names  = calloc(NUM_NAMES, sizeof(char *));
+    char **anames = calloc(NUM_NAMES, sizeof(char *));
+    for( int i = 0; names && anames && i < NUM_NAMES; i++ )
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), formats[i % 5], micro_rnd() % 100000);
+        if( !(names[i] = strdup(buf)) )
+            names = 0;
+        else
+            anames[i] = flist_atari_name(names[i]);
+    }
+    if( !names || !anames )
+    {
+        fprintf(stderr, "microbench: memory error\n");
+        exit(EXIT_FAILURE);
+    }
+    micro_run("atari_name", names_kernel, names, NUM_NAMES, 0);
+    micro_run("path_name", path_kernel, anames, NUM_NAMES, 0);
+    for( int i = 0; i < NUM_NAMES; i++ )
+    {
+        free(names[i]);
+        free(anames[i]);
+    }
+    free(names);
+    free(anames);
+}
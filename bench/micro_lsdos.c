@@ -0,0 +1,93 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Kernels of the Atari DOS and MyDOS reader.
+ */
+#include "../src/lsdos.c"
+#include "microbench.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// read_file() of a file using all the sectors of the image, linked in order
+struct read_arg
+{
+    struct atr_image *atr;
+    unsigned size;
+    uint8_t *buf;
+    int dos2;
+    int mdos;
+};
+
+static void read_kernel(void *arg)
+{
+    struct read_arg *a = arg;
+    micro_sink += read_file(a->atr, 4, a->size, a->buf, a->dos2, a->mdos);
+}
+
+// Builds an image with a file from sector 4 to the last, skipping the
+// directory sectors of DOS 2 in small images. MyDOS stores the full number of
+// the next sector in images of more than 1023 sectors.
+static void make_file(struct read_arg *a, unsigned ssz, unsigned nsec)
+{
+    unsigned lst  = ssz - 3;
+    uint8_t *data = calloc(ssz, nsec);
+    if( !data )
+    {
+        fprintf(stderr, "microbench: memory error\n");
+        exit(EXIT_FAILURE);
+    }
+    a->size = 0;
+    for( unsigned sec = 4; sec <= nsec; sec++ )
+    {
+        if( nsec < 1024 && sec >= 360 && sec < 369 )
+            continue;
+        uint8_t *p   = data + (size_t)(sec - 1) * ssz;
+        unsigned nxt = sec == nsec ? 0 : sec + 1 == 360 && nsec < 1024 ? 369 : sec + 1;
+        for( unsigned i = 0; i < lst; i++ )
+            p[i] = micro_rnd();
+        p[lst]     = nxt >> 8;
+        p[lst + 1] = nxt;
+        p[lst + 2] = lst;
+        a->size += lst;
+    }
+    a->atr = micro_image(ssz, nsec, data);
+    a->buf = malloc(a->size);
+    free(data);
+    if( !a->buf )
+    {
+        fprintf(stderr, "microbench: memory error\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void micro_lsdos(void)
+{
+    struct read_arg a;
+    make_file(&a, 128, 720);
+    a.dos2 = 1;
+    a.mdos = 0;
+    micro_run("dos2 read_file", read_kernel, &a, 1, a.size);
+    atr_free(a.atr);
+    free(a.buf);
+
+    make_file(&a, 256, 65535);
+    a.dos2 = 0;
+    a.mdos = 1;
+    micro_run("mydos read_file", read_kernel, &a, 1, a.size);
+    atr_free(a.atr);
+    free(a.buf);
+}
@@ -0,0 +1,74 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Kernels of the SpartaDOS reader.
+ */
+#include "../src/lssfs.c"
+#include "../src/mkimage.h"
+#include "microbench.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static void error(const char *msg)
+{
+    fprintf(stderr, "microbench: %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+// read_file() of a file of 4MB
+struct read_arg
+{
+    struct atr_image *atr;
+    unsigned map;
+    unsigned size;
+    uint8_t *buf;
+};
+
+static void read_kernel(void *arg)
+{
+    struct read_arg *a = arg;
+    micro_sink += read_file(a->atr, a->map, a->size, a->buf);
+}
+
+void micro_lssfs(void)
+{
+    struct read_arg a;
+    a.size = 4 << 20;
+    a.buf  = malloc(a.size);
+    struct mkimage *m = mkimage_new();
+    if( !a.buf || !m )
+        error("memory error");
+    for( unsigned i = 0; i < a.size; i++ )
+        a.buf[i] = micro_rnd();
+    uint8_t *atr;
+    size_t len;
+    if( mkimage_add_file(m, "DATA.BIN", a.buf, a.size, 0, 0) ||
+        mkimage_build_alloc(m, &atr, &len) || atr_load_mem(&a.atr, atr, len, "image") )
+        error("can't build SpartaDOS image");
+    free(atr);
+    mkimage_free(m);
+
+    // The file is the first entry in the root directory
+    uint8_t dir[46];
+    const uint8_t *boot = atr_data(a.atr, 1);
+    if( read_file(a.atr, read16(boot + 9), 46, dir) != 46 )
+        error("invalid SpartaDOS image");
+    a.map = read16(dir + 24);
+    micro_run("sfs read_file", read_kernel, &a, 1, a.size);
+    atr_free(a.atr);
+    free(a.buf);
+}
@@ -0,0 +1,109 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Kernels of the SpartaDOS image builder.
+ */
+#include "../src/spartafs.c"
+#include "microbench.h"
+#include <stdio.h>
+
+static void *alloc_or_exit(size_t size)
+{
+    void *p = calloc(1, size);
+    if( !p )
+    {
+        fprintf(stderr, "microbench: memory error\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+// sfs_alloc() of all the free sectors in a bitmap of 65535 sectors, with one
+// of each 64 sectors free.
+struct alloc_arg
+{
+    struct sfs sfs;
+    uint8_t *bitmap;
+    size_t len;
+    long items;
+};
+
+static void alloc_kernel(void *arg)
+{
+    struct alloc_arg *a = arg;
+    memcpy(sfs_ptr_256(&a->sfs, a->sfs.bmap), a->bitmap, a->len);
+    a->sfs.csec = 1;
+    while( sfs_alloc_256(&a->sfs) > 0 )
+        micro_sink++;
+}
+
+// Sorting of 10000 entries with compare_level().
+struct sort_arg
+{
+    struct afile **list;
+    struct afile **sorted;
+    int num;
+};
+
+static void sort_kernel(void *arg)
+{
+    struct sort_arg *a = arg;
+    memcpy(a->sorted, a->list, sizeof(struct afile *) * a->num);
+    qsort(a->sorted, a->num, sizeof(struct afile *), compare_level);
+    micro_sink += a->sorted[0]->level;
+}
+
+void micro_spartafs(void)
+{
+    struct alloc_arg a;
+    memset(&a, 0, sizeof(a));
+    a.sfs.nsec     = 65535;
+    a.sfs.sec_size = 256;
+    a.sfs.bmap     = 2;
+    a.sfs.data     = alloc_or_exit(256 * 65535);
+    a.len          = 65536 / 8;
+    a.bitmap       = alloc_or_exit(a.len);
+    for( int sec = 64; sec < 65536; sec += 64 )
+    {
+        a.bitmap[sec >> 3] |= 128 >> (sec & 7);
+        a.items++;
+    }
+    micro_run("sfs_alloc", alloc_kernel, &a, a.items, 0);
+    free(a.sfs.data);
+    free(a.bitmap);
+
+    struct sort_arg s;
+    s.num               = 10000;
+    s.list              = alloc_or_exit(sizeof(struct afile *) * s.num);
+    s.sorted            = alloc_or_exit(sizeof(struct afile *) * s.num);
+    struct afile *files = alloc_or_exit(sizeof(struct afile) * s.num);
+    char *names         = alloc_or_exit(12 * s.num);
+    for( int i = 0; i < s.num; i++ )
+    {
+        files[i].aname  = names + 12 * i;
+        files[i].level  = micro_rnd() % 8;
+        files[i].is_dir = !(micro_rnd() % 8);
+        for( int j = 0; j < 11; j++ )
+            files[i].aname[j] = j < 8 || micro_rnd() & 1 ? 'A' + micro_rnd() % 26 : ' ';
+        s.list[i] = &files[i];
+    }
+    micro_run("compare_level sort", sort_kernel, &s, s.num, 0);
+    free(s.list);
+    free(s.sorted);
+    free(files);
+    free(names);
+}
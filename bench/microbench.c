@@ -0,0 +1,292 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Measures the internal functions that dominate the run time on big inputs.
+ * Each kernel is called first to warm up the caches and to find the number of
+ * calls that take at least MIN_SAMPLE seconds, then the time of the given
+ * number of samples is measured. The median and percentiles of the time of one
+ * call are written as JSON to the standard output.
+ */
+#define _XOPEN_SOURCE 700
+#include "microbench.h"
+#include "../src/crc32.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MIN_SAMPLE 0.002 // Minimum time of each sample, in seconds
+#define MIN_WARMUP 0.05  // Minimum time of the warm-up
+
+volatile unsigned micro_sink;
+
+static int samples = 31;
+static char **filters;
+static int num_filters;
+static int first_result = 1;
+
+static void error(const char *msg)
+{
+    fprintf(stderr, "microbench: %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Percentile of sorted times, using the nearest rank
+static double percentile(const double *t, int p)
+{
+    return t[(p * (samples - 1) + 50) / 100];
+}
+
+// Kernels are selected by a part of the name
+static int selected(const char *name)
+{
+    for( int i = 0; i < num_filters; i++ )
+        if( strstr(name, filters[i]) )
+            return 1;
+    return !num_filters;
+}
+
+void micro_run(const char *name, void (*fn)(void *arg), void *arg, long items,
+               long bytes)
+{
+    if( !selected(name) )
+        return;
+    long calls   = 1;
+    double start = now();
+    for( ;; )
+    {
+        double t = now();
+        for( long i = 0; i < calls; i++ )
+            fn(arg);
+        t = now() - t;
+        if( t < MIN_SAMPLE )
+            calls *= 2;
+        else if( now() - start >= MIN_WARMUP )
+            break;
+    }
+    double *t = malloc(sizeof(double) * samples);
+    if( !t )
+        error("memory error");
+    for( int s = 0; s < samples; s++ )
+    {
+        double st = now();
+        for( long i = 0; i < calls; i++ )
+            fn(arg);
+        t[s] = (now() - st) / calls;
+    }
+    qsort(t, samples, sizeof(double), cmp_double);
+
+    double med = percentile(t, 50);
+    printf("%s\n    {\"kernel\": \"%s\", \"calls\": %ld, \"items\": %ld, \"bytes\": %ld, "
+           "\"min_us\": %.4f, \"p10_us\": %.4f, \"median_us\": %.4f, \"p90_us\": %.4f, "
+           "\"p99_us\": %.4f, \"max_us\": %.4f, \"mb_per_s\": %.3f}",
+           first_result ? "" : ",", name, calls, items, bytes, t[0] * 1e6,
+           percentile(t, 10) * 1e6, med * 1e6, percentile(t, 90) * 1e6,
+           percentile(t, 99) * 1e6, t[samples - 1] * 1e6, bytes / med / 1e6);
+    first_result = 0;
+    fprintf(stderr, "%-20s %11.3f us  p10 %11.3f  p90 %11.3f  p99 %11.3f", name,
+            med * 1e6, percentile(t, 10) * 1e6, percentile(t, 90) * 1e6,
+            percentile(t, 99) * 1e6);
+    if( bytes )
+        fprintf(stderr, " %9.2f MB/s\n", bytes / med / 1e6);
+    else
+        fprintf(stderr, " %9.2f ns/item\n", med * 1e9 / items);
+    free(t);
+}
+
+uint32_t micro_rnd(void)
+{
+    static uint32_t state = 12345;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Writes an ATR header for the given size of the sectors in the file
+static void atr_header(uint8_t *hdr, unsigned ssz, size_t size)
+{
+    memset(hdr, 0, 16);
+    hdr[0] = 0x96;
+    hdr[1] = 0x02;
+    hdr[2] = size >> 4;
+    hdr[3] = size >> 12;
+    hdr[4] = ssz;
+    hdr[5] = ssz >> 8;
+    hdr[6] = size >> 20;
+}
+
+struct atr_image *micro_image(unsigned ssz, unsigned nsec, const uint8_t *data)
+{
+    size_t size  = (size_t)ssz * nsec;
+    uint8_t *buf = malloc(size + 16);
+    if( !buf )
+        error("memory error");
+    atr_header(buf, ssz, size);
+    memcpy(buf + 16, data, size);
+    struct atr_image *atr;
+    if( atr_load_mem(&atr, buf, size + 16, "image") )
+        error("can't load image");
+    free(buf);
+    return atr;
+}
+
+// crc32() of 16MB
+struct crc_arg
+{
+    uint8_t *data;
+    unsigned len;
+};
+
+static void crc_kernel(void *arg)
+{
+    struct crc_arg *a = arg;
+    micro_sink += crc32(0, a->data, a->len);
+}
+
+static void micro_crc32(void)
+{
+    struct crc_arg a;
+    a.len  = 16 << 20;
+    a.data = malloc(a.len);
+    if( !a.data )
+        error("memory error");
+    for( unsigned i = 0; i < a.len; i++ )
+        a.data[i] = micro_rnd();
+    micro_run("crc32", crc_kernel, &a, 1, a.len);
+    free(a.data);
+}
+
+// Loading each variant of image file from memory
+struct load_arg
+{
+    uint8_t *buf;
+    size_t len;
+    int all; // Decompress all the sectors
+};
+
+static void load_kernel(void *arg)
+{
+    struct load_arg *a = arg;
+    struct atr_image *atr;
+    if( atr_load_mem(&atr, a->buf, a->len, "image") ||
+        (a->all && atr_load_all(atr)) )
+        error("can't load image");
+    micro_sink += atr->sec_count;
+    atr_free(atr);
+}
+
+// Builds an ATR file, "first" is the size of the first three sectors in the file
+// and "hdr" is 0 for raw images. Sectors are half zeros, and half with text
+// like data.
+static void make_atr(struct load_arg *a, unsigned ssz, unsigned nsec, unsigned first,
+                     int hdr)
+{
+    size_t size = 3 * first + (size_t)(nsec - 3) * ssz;
+    a->len      = size + (hdr ? 16 : 0);
+    a->buf      = calloc(1, a->len);
+    a->all      = 0;
+    if( !a->buf )
+        error("memory error");
+    if( hdr )
+        atr_header(a->buf, ssz, size);
+    for( size_t i = a->len - size; i < a->len; i++ )
+        if( (i / ssz) & 1 )
+            a->buf[i] = 'A' + micro_rnd() % 16;
+}
+
+static void micro_atr(void)
+{
+    static const struct
+    {
+        const char *name;
+        unsigned ssz, nsec, first;
+        int hdr;
+    } variants[] = {{"atr_load sd", 128, 720, 128, 1},
+                    {"atr_load dd", 256, 720, 128, 1},
+                    {"atr_load dd-full", 256, 720, 256, 1},
+                    {"atr_load 512", 512, 2048, 512, 1},
+                    {"atr_load raw", 128, 1040, 128, 0},
+                    {0, 0, 0, 0, 0}};
+    struct load_arg a;
+    for( int i = 0; variants[i].name; i++ )
+    {
+        make_atr(&a, variants[i].ssz, variants[i].nsec, variants[i].first,
+                 variants[i].hdr);
+        micro_run(variants[i].name, load_kernel, &a, 1, a.len);
+        free(a.buf);
+    }
+
+    // Compressed image, decompressing all the sectors
+    struct atr_image *atr;
+    make_atr(&a, 256, 720, 128, 1);
+    if( atr_load_mem(&atr, a.buf, a.len, "image") )
+        error("can't load image");
+    size_t len = a.len;
+    free(a.buf);
+    if( atr_compress(atr, &a.buf, &a.len) )
+        error("can't compress image");
+    atr_free(atr);
+    a.all = 1;
+    micro_run("atr_load atz", load_kernel, &a, 1, len);
+    free(a.buf);
+}
+
+int main(int argc, char **argv)
+{
+    filters = calloc(argc, sizeof(char *));
+    if( !filters )
+        error("memory error");
+    for( int i = 1; i < argc; i++ )
+    {
+        if( !strcmp(argv[i], "-n") && i + 1 < argc )
+            samples = atoi(argv[++i]);
+        else if( argv[i][0] == '-' )
+            samples = 0;
+        else
+            filters[num_filters++] = argv[i];
+    }
+    if( samples < 1 )
+    {
+        fprintf(stderr, "Usage: %s [-n samples] [kernel...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("{\n  \"samples\": %d,\n  \"results\": [", samples);
+    micro_spartafs();
+    micro_flist();
+    micro_lssfs();
+    micro_lsdos();
+    micro_crc32();
+    micro_atr();
+    printf("\n  ]\n}\n");
+    free(filters);
+    return 0;
+}
@@ -0,0 +1,46 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Harness of the microbenchmarks of the internal functions. The kernels of
+ * each source file are in a separate file that includes the source, so the
+ * static functions can be called.
+ */
+#pragma once
+#include "../src/atr.h"
+#include <stdint.h>
+
+// Results of the kernels are added here, so the calls are not optimized out
+extern volatile unsigned micro_sink;
+
+// Measures "fn", called with "arg", that processes "items" items or entries
+// and "bytes" bytes of data in each call. Kernels not selected in the command
+// line are skipped.
+void micro_run(const char *name, void (*fn)(void *arg), void *arg, long items,
+               long bytes);
+
+// Deterministic pseudo-random numbers
+uint32_t micro_rnd(void);
+
+// Returns an image loaded from an ATR file with "nsec" sectors of "ssz" bytes,
+// all of full size, copied from "data".
+struct atr_image *micro_image(unsigned ssz, unsigned nsec, const uint8_t *data);
+
+// Kernels of each source file
+void micro_flist(void);
+void micro_lsdos(void);
+void micro_lssfs(void);
+void micro_spartafs(void);
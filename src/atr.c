@@ -19,66 +19,541 @@
  */
 
 #include "atr.h"
-#include "msg.h"
 #include <errno.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <zlib.h>
 
-// Load disk image from file
-struct atr_image *load_atr_image(const char *file_name)
+// Handler for warning messages
+static void (*msg_handler)(const char *msg);
+
+void atr_set_msg_handler(void (*handler)(const char *msg))
 {
-    FILE *f = fopen(file_name, "rb");
-    if( !f )
+    msg_handler = handler;
+}
+
+void atr_msg(const char *format, ...)
+{
+    char buf[256];
+    va_list ap;
+    if( !msg_handler )
+        return;
+    va_start(ap, format);
+    vsnprintf(buf, sizeof(buf), format, ap);
+    va_end(ap);
+    msg_handler(buf);
+}
+
+const char *atr_strerror(int err)
+{
+    switch( err )
     {
-        show_error("can´t open disk image '%s': %s", file_name, strerror(errno));
-        return 0;
+        case atr_ok: return "no error";
+        case atr_err_open: return "can´t open disk image";
+        case atr_err_read: return "can´t read ATR header";
+        case atr_err_format: return "not an ATR image";
+        case atr_err_sector_size: return "unsupported ATR sector size";
+        case atr_err_too_small: return "invalid ATR image size, too small";
+        case atr_err_memory: return "memory error";
+        case atr_err_no_fs: return "ATR image format not supported";
+        case atr_err_invalid: return "invalid file system data";
+        case atr_err_read_only: return "image can´t be modified";
+        case atr_err_write: return "can´t write disk image";
+        case atr_err_not_found: return "file not found";
+        case atr_err_exists: return "file already exists";
+        case atr_err_not_empty: return "directory not empty";
+        case atr_err_no_space: return "no free space in image";
+        case atr_err_name: return "invalid file name";
+        case atr_err_unsupported: return "operation not supported in this file system";
+        default: return "unknown error";
     }
+}
 
-    // Get header
-    uint8_t hdr[16];
-    if( 1 != fread(hdr, 16, 1, f) )
+// Source of image data, a file or a memory buffer
+struct atr_src
+{
+    FILE *f;
+    const uint8_t *mem;
+    size_t len;
+    size_t pos;
+};
+
+static size_t src_read(struct atr_src *src, void *buf, size_t len)
+{
+    if( src->f )
+        return fread(buf, 1, len, src->f);
+    if( len > src->len - src->pos )
+        len = src->len - src->pos;
+    memcpy(buf, src->mem + src->pos, len);
+    src->pos += len;
+    return len;
+}
+
+// Creates the image, "hdr" and "first" give the layout of the sectors in the file
+static int new_image(struct atr_image **atr, uint8_t *data, unsigned ssz, unsigned nsec,
+                     unsigned hdr, unsigned first, const char *name)
+{
+    struct atr_image *img = malloc(sizeof(struct atr_image));
+    char *nm              = strdup(name);
+    if( !img || !nm )
     {
-        show_error("%s: can´t read ATR header", file_name);
-        fclose(f);
+        free(img);
+        free(nm);
+        free(data);
+        return atr_err_memory;
+    }
+    img->data       = data;
+    img->sec_size   = ssz;
+    img->sec_count  = nsec;
+    img->name       = nm;
+    img->hdr_size   = hdr;
+    img->first_size = first;
+    img->fd         = -1;
+    img->dirty      = 0;
+    img->zip        = 0;
+    img->stored     = 0;
+    memset(img->header, 0, 16);
+    *atr            = img;
+    return atr_ok;
+}
+
+// Compressed images are a header, the index of the groups of sectors and the
+// data of each group:
+//  0: "ATRZ"
+//  4: format version, 1
+//  5: log2 of the number of sectors in each group
+//  6: sector size, 16 bit
+//  8: number of sectors, 32 bit
+// 12: bytes before the first sector in the ATR file, 16 bit
+// 14: size of the first three sectors in the ATR file, 16 bit
+// 16: ATR header
+// 32: Adler-32 of the data of all the sectors
+// 36: number of groups, 32 bit
+// 40: offset of the data of each group from the start of the file, and of the
+//     end of the last, 32 bit. Groups without data are all zeros, groups with
+//     the full size are not compressed.
+#define ZIP_HDR 40
+#define ZIP_GROUP 4096 // Bytes in each group
+
+struct atr_zip
+{
+    uint8_t *buf;     // All the file
+    unsigned shift;   // log2 of sectors per group
+    unsigned ngroups; //
+    uint32_t sum;     // Adler-32 of all the data
+    uint32_t *loaded; // Bitset of the groups already decompressed
+};
+
+static unsigned get16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put16(uint8_t *p, unsigned x)
+{
+    p[0] = x;
+    p[1] = x >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t x)
+{
+    put16(p, x);
+    put16(p + 2, x >> 16);
+}
+
+// Number of bytes of the data of a group
+static size_t group_bytes(const struct atr_image *atr, unsigned shift, unsigned g)
+{
+    unsigned first = g << shift, num = 1U << shift;
+    if( num > atr->sec_count - first )
+        num = atr->sec_count - first;
+    return (size_t)num * atr->sec_size;
+}
+
+static void zip_free(struct atr_zip *zip)
+{
+    if( zip )
+    {
+        free(zip->buf);
+        free(zip->loaded);
+        free(zip);
+    }
+}
+
+// Decompresses the data of one group, if not already done
+static int load_group(const struct atr_image *atr, unsigned g)
+{
+    struct atr_zip *zip = atr->zip;
+    if( zip->loaded[g / 32] & (1U << (g & 31)) )
+        return atr_ok;
+    size_t start = get32(zip->buf + ZIP_HDR + 4 * g);
+    size_t len   = get32(zip->buf + ZIP_HDR + 4 * g + 4) - start;
+    size_t bytes = group_bytes(atr, zip->shift, g);
+    uint8_t *dst = (uint8_t *)atr->data + ((size_t)g << zip->shift) * atr->sec_size;
+    if( len == bytes )
+        memcpy(dst, zip->buf + start, len);
+    else if( len )
+    {
+        uLongf dlen = bytes;
+        if( Z_OK != uncompress(dst, &dlen, zip->buf + start, len) || dlen != bytes )
+        {
+            atr_msg("%s: invalid compressed data at sector %u", atr->name,
+                    (g << zip->shift) + 1);
+            return atr_err_invalid;
+        }
+    }
+    zip->loaded[g / 32] |= 1U << (g & 31);
+    return atr_ok;
+}
+
+// Load a compressed image, only the index is read, the sectors are
+// decompressed on first use.
+static int load_compressed(struct atr_image **atr, struct atr_src *src,
+                           const uint8_t *hdr, const char *file_name)
+{
+    // Read all the file
+    size_t len = 16, alloc = 65536;
+    uint8_t *buf = malloc(alloc);
+    if( !buf )
+        return atr_err_memory;
+    memcpy(buf, hdr, 16);
+    for( ;; )
+    {
+        len += src_read(src, buf + len, alloc - len);
+        if( len < alloc )
+            break;
+        uint8_t *nbuf = realloc(buf, alloc * 2);
+        if( !nbuf )
+        {
+            free(buf);
+            return atr_err_memory;
+        }
+        buf = nbuf;
+        alloc *= 2;
+    }
+    // Check the header and the index
+    if( len < ZIP_HDR || buf[4] != 1 || buf[5] > 12 )
+    {
+        free(buf);
+        return atr_err_format;
+    }
+    unsigned ssz = get16(buf + 6), nsec = get32(buf + 8), shift = buf[5];
+    unsigned ngroups = get32(buf + 36);
+    if( ssz != 128 && ssz != 256 && ssz != 512 )
+    {
+        free(buf);
+        return atr_err_sector_size;
+    }
+    if( nsec < 3 || nsec > 65535 )
+    {
+        free(buf);
+        return atr_err_too_small;
+    }
+    struct atr_image tmp = {0};
+    tmp.sec_size         = ssz;
+    tmp.sec_count        = nsec;
+    size_t pos           = ZIP_HDR + 4 * ((size_t)ngroups + 1);
+    int e = ngroups != ((nsec - 1) >> shift) + 1 || len < pos ? atr_err_format : atr_ok;
+    for( unsigned g = 0; !e && g < ngroups; g++ )
+    {
+        size_t start = get32(buf + ZIP_HDR + 4 * g);
+        size_t end   = get32(buf + ZIP_HDR + 4 * g + 4);
+        if( start < pos || end < start || end > len ||
+            end - start > group_bytes(&tmp, shift, g) )
+            e = atr_err_format;
+        pos = end;
+    }
+    if( e )
+    {
+        free(buf);
+        return e;
+    }
+
+    struct atr_zip *zip = calloc(1, sizeof(struct atr_zip));
+    uint8_t *data       = calloc(ssz, nsec);
+    if( zip )
+    {
+        zip->buf     = buf;
+        zip->shift   = shift;
+        zip->ngroups = ngroups;
+        zip->sum     = get32(buf + 32);
+        zip->loaded  = calloc((ngroups + 31) / 32, sizeof(uint32_t));
+    }
+    if( !zip || !zip->loaded || !data )
+    {
+        if( !zip )
+            free(buf);
+        zip_free(zip);
+        free(data);
+        return atr_err_memory;
+    }
+    e = new_image(atr, data, ssz, nsec, get16(buf + 12), get16(buf + 14), file_name);
+    if( e )
+    {
+        zip_free(zip);
+        return e;
+    }
+    memcpy((*atr)->header, buf + 16, 16);
+    (*atr)->zip = zip;
+    // The boot sectors are always read to detect the file system
+    if( load_group(*atr, 0) )
+    {
+        atr_free(*atr);
+        return atr_err_invalid;
+    }
+    return atr_ok;
+}
+
+int atr_load_all(struct atr_image *atr)
+{
+    if( !atr->zip )
+        return atr_ok;
+    for( unsigned g = 0; g < atr->zip->ngroups; g++ )
+    {
+        int e = load_group(atr, g);
+        if( e )
+            return e;
+    }
+    if( adler32(1, atr->data, atr->sec_size * atr->sec_count) != atr->zip->sum )
+    {
+        atr_msg("%s: invalid checksum in compressed image", atr->name);
+        return atr_err_invalid;
+    }
+    zip_free(atr->zip);
+    atr->zip = 0;
+    return atr_ok;
+}
+
+static int is_zero(const uint8_t *p, size_t len)
+{
+    for( size_t i = 0; i < len; i++ )
+        if( p[i] )
+            return 0;
+    return 1;
+}
+
+int atr_compress(struct atr_image *atr, uint8_t **out, size_t *out_len)
+{
+    int e = atr_load_all(atr);
+    if( e )
+        return e;
+    unsigned ssz = atr->sec_size, nsec = atr->sec_count, shift = 0;
+    while( (ssz << shift) < ZIP_GROUP )
+        shift++;
+    unsigned ngroups = ((nsec - 1) >> shift) + 1;
+    size_t pos       = ZIP_HDR + 4 * ((size_t)ngroups + 1);
+    uLongf bound     = compressBound(ZIP_GROUP);
+    // Groups are never bigger than the uncompressed data
+    uint8_t *buf = malloc(pos + (size_t)ssz * nsec);
+    uint8_t *tmp = malloc(bound);
+    if( !buf || !tmp )
+    {
+        free(buf);
+        free(tmp);
+        return atr_err_memory;
+    }
+    memcpy(buf, "ATRZ", 4);
+    buf[4] = 1;
+    buf[5] = shift;
+    put16(buf + 6, ssz);
+    put32(buf + 8, nsec);
+    put16(buf + 12, atr->hdr_size);
+    put16(buf + 14, atr->first_size);
+    memcpy(buf + 16, atr->header, 16);
+    put32(buf + 32, adler32(1, atr->data, ssz * nsec));
+    put32(buf + 36, ngroups);
+    for( unsigned g = 0; g < ngroups; g++ )
+    {
+        const uint8_t *src = atr->data + ((size_t)g << shift) * ssz;
+        size_t bytes       = group_bytes(atr, shift, g);
+        uLongf clen        = bound;
+        put32(buf + ZIP_HDR + 4 * g, pos);
+        if( is_zero(src, bytes) )
+            continue;
+        int z = compress2(tmp, &clen, src, bytes, Z_BEST_COMPRESSION);
+        if( z == Z_OK && clen < bytes )
+        {
+            memcpy(buf + pos, tmp, clen);
+            pos += clen;
+        }
+        else
+        {
+            memcpy(buf + pos, src, bytes);
+            pos += bytes;
+        }
+    }
+    put32(buf + ZIP_HDR + 4 * ngroups, pos);
+    free(tmp);
+    *out     = buf;
+    *out_len = pos;
+    return atr_ok;
+}
+
+// Images in a sector store are a recipe, with the header and the list of the
+// sectors, and a pool file with the data of the distinct sectors of all the
+// images of the same sector size, both written by atrstore. The recipe is:
+//  0: "ATRS"
+//  4: format version, 1
+//  5: reserved, 0
+//  6: sector size, 16 bit
+//  8: number of sectors, 32 bit
+// 12: bytes before the first sector in the ATR file, 16 bit
+// 14: size of the first three sectors in the ATR file, 16 bit
+// 16: ATR header
+// 32: Adler-32 of the data of all the sectors
+// 36: length of the name of the pool file, 16 bit
+// 38: name of the pool file, relative to the directory of the recipe
+//  +: number of each sector in the pool, 32 bit, 0 for sectors with only zeros
+// The pool file is a header of 16 bytes, "ATRP", the version, 1, and the sector
+// size at byte 6, followed by the data of the sectors, numbered from 1.
+#define STORE_HDR 38
+#define POOL_HDR 16
+
+// Opens the pool file of a recipe
+static FILE *open_pool(const char *file_name, const char *pool)
+{
+    const char *sep = strrchr(file_name, '/');
+    size_t dlen     = sep && pool[0] != '/' ? sep - file_name + 1 : 0;
+    char *path      = malloc(dlen + strlen(pool) + 1);
+    if( !path )
         return 0;
+    memcpy(path, file_name, dlen);
+    strcpy(path + dlen, pool);
+    FILE *f = fopen(path, "rb");
+    free(path);
+    return f;
+}
+
+// Load an image from a recipe, reading the sectors from the pool file
+static int load_stored(struct atr_image **atr, struct atr_src *src, const uint8_t *hdr,
+                       const char *file_name)
+{
+    uint8_t buf[STORE_HDR + 256];
+    memcpy(buf, hdr, 16);
+    if( STORE_HDR - 16 != src_read(src, buf + 16, STORE_HDR - 16) )
+        return atr_err_read;
+    unsigned ssz = get16(buf + 6), nsec = get32(buf + 8), nlen = get16(buf + 36);
+    if( buf[4] != 1 || !nlen || nlen >= 256 )
+        return atr_err_format;
+    if( ssz != 128 && ssz != 256 && ssz != 512 )
+        return atr_err_sector_size;
+    if( nsec < 3 || nsec > 65535 )
+        return atr_err_too_small;
+    if( nlen != src_read(src, buf + STORE_HDR, nlen) )
+        return atr_err_read;
+    buf[STORE_HDR + nlen] = 0;
+
+    uint8_t *refs = malloc(4 * nsec);
+    uint8_t *data = calloc(ssz, nsec);
+    if( !refs || !data )
+    {
+        free(refs);
+        free(data);
+        return atr_err_memory;
     }
+    int e = atr_ok;
+    if( 4 * nsec != src_read(src, refs, 4 * nsec) )
+        e = atr_err_read;
+    FILE *pool = e ? 0 : open_pool(file_name, (const char *)buf + STORE_HDR);
+    if( !e && !pool )
+    {
+        int err = errno;
+        atr_msg("%s: can´t open sector pool '%s'", file_name, buf + STORE_HDR);
+        errno = err;
+        e     = atr_err_open;
+    }
+    uint8_t phdr[POOL_HDR];
+    if( !e && (POOL_HDR != fread(phdr, 1, POOL_HDR, pool) || memcmp(phdr, "ATRP", 4) ||
+               phdr[4] != 1 || get16(phdr + 6) != ssz) )
+    {
+        atr_msg("%s: invalid sector pool '%s'", file_name, buf + STORE_HDR);
+        e = atr_err_invalid;
+    }
+    // Sectors stored together in the pool are read at once
+    for( unsigned i = 0; !e && i < nsec; )
+    {
+        uint32_t first = get32(refs + 4 * i);
+        unsigned n     = 1;
+        while( i + n < nsec && first && get32(refs + 4 * (i + n)) == first + n )
+            n++;
+        size_t len   = (size_t)n * ssz;
+        off_t pos    = POOL_HDR + (off_t)(first - 1) * ssz;
+        uint8_t *dst = data + (size_t)i * ssz;
+        if( first && pread(fileno(pool), dst, len, pos) != (ssize_t)len )
+        {
+            atr_msg("%s: sector %u missing from the pool", file_name, i + 1);
+            e = atr_err_invalid;
+        }
+        i += n;
+    }
+    if( pool )
+        fclose(pool);
+    free(refs);
+    if( !e && adler32(1, data, ssz * nsec) != get32(buf + 32) )
+    {
+        atr_msg("%s: invalid checksum in stored image", file_name);
+        e = atr_err_invalid;
+    }
+    if( e )
+    {
+        free(data);
+        return e;
+    }
+    e = new_image(atr, data, ssz, nsec, get16(buf + 12), get16(buf + 14), file_name);
+    if( !e )
+    {
+        memcpy((*atr)->header, buf + 16, 16);
+        (*atr)->stored = 1;
+    }
+    return e;
+}
+
+// Load disk image from a data source
+static int load_image(struct atr_image **atr, struct atr_src *src, const char *file_name)
+{
+    // Get header
+    uint8_t hdr[16];
+    if( 16 != src_read(src, hdr, 16) )
+        return atr_err_read;
+    if( !memcmp(hdr, "ATRZ", 4) )
+        return load_compressed(atr, src, hdr, file_name);
+    if( !memcmp(hdr, "ATRS", 4) )
+        return load_stored(atr, src, hdr, file_name);
     if( hdr[0] != 0x96 || hdr[1] != 0x02 )
     {
         // Check if we can open as a raw SS/SD or SD/ED image
-        uint8_t *data = check_calloc(1, 128 * 1040 + 16);
+        uint8_t *data = calloc(1, 128 * 1040 + 16);
+        if( !data )
+            return atr_err_memory;
         // Move header
         memcpy(data, hdr, 16);
         // Read the rest of the file
-        size_t num = 16 + fread(data + 16, 1, 1040 * 128, f);
+        size_t num = 16 + src_read(src, data + 16, 1040 * 128);
         // Accept only exact sizes
         if( num != 720 * 128 && num != 1040 * 128 )
         {
-            show_error("%s: not an ATR image", file_name);
-            fclose(f);
             free(data);
-            return 0;
+            return atr_err_format;
         }
-        fclose(f);
-        struct atr_image *atr = check_malloc(sizeof(struct atr_image));
-        atr->data             = data;
-        atr->sec_size         = 128;
-        atr->sec_count        = num / 128;
-        return atr;
+        return new_image(atr, data, 128, num / 128, 0, 128, file_name);
     }
     unsigned ssz = hdr[4] | (hdr[5] << 8);
-    if( ssz != 128 && ssz != 256 )
-    {
-        show_error("%s: unsupported ATR sector size (%d)", file_name, ssz);
-        fclose(f);
-        return 0;
-    }
+    if( ssz != 128 && ssz != 256 && ssz != 512 )
+        return atr_err_sector_size;
     unsigned isz = (hdr[2] << 4) | (hdr[3] << 12) | (hdr[6] << 20);
     // Some images store full size fo the first 3 sectors, others store
-    // 128 bytes for those:
+    // 128 bytes for those. Images of 512 byte sectors can be up to 32MB:
     unsigned pad_size    = isz % ssz == 0 ? 0 : (ssz - 128) * 3;
     unsigned num_sectors = (isz + pad_size) / ssz;
-    if( isz >= 0x1000000 || num_sectors * ssz - pad_size != isz )
+    if( (isz >= 0x1000000 && isz > 65535 * ssz) || num_sectors * ssz - pad_size != isz )
     {
         // If image size is invalid, assume sector padding:
         pad_size    = 3 * (ssz - 128);
@@ -86,22 +561,34 @@ struct atr_image *load_atr_image(const char *file_name)
         if( num_sectors > 65535 )
             num_sectors = 65535;
         if( num_sectors < 3 )
-            show_error("%s: invalid ATR image size (%d), too small.", file_name, isz);
-        show_msg("%s: invalid ATR image size (%d), rounding down to (%d)", file_name, isz,
-                 num_sectors * ssz - pad_size);
+            return atr_err_too_small;
+        atr_msg("%s: invalid ATR image size (%d), rounding down to (%d)", file_name, isz,
+                num_sectors * ssz - pad_size);
     }
     // Allocate new storage
-    uint8_t *data = check_calloc(ssz, num_sectors);
-    // Read 3 first sectors
-    for( unsigned i = 0; i < num_sectors; i++ )
+    uint8_t *data = calloc(ssz, num_sectors);
+    if( !data )
+        return atr_err_memory;
+    // Read 3 first sectors if those are only 128 bytes, the rest of the image is
+    // read at once.
+    unsigned first = 0;
+    if( pad_size )
     {
-        if( 1 != fread(data + ssz * i, (i < 3 && pad_size) ? 128 : ssz, 1, f) )
+        for( ; first < 3 && first < num_sectors; first++ )
         {
-            show_msg("%s: ATR file too short at sector %d", file_name, i + 1);
-            break;
+            if( 128 != src_read(src, data + ssz * first, 128) )
+                break;
         }
     }
+    if( first == 3 || !pad_size )
+    {
+        size_t len = (size_t)ssz * (num_sectors - first);
+        first += src_read(src, data + ssz * first, len) / ssz;
+    }
+    if( first < num_sectors )
+        atr_msg("%s: ATR file too short at sector %d", file_name, first + 1);
     // Check that sector paddings are 0
+    unsigned first_size = pad_size ? 128 : ssz;
     if( ssz == 256 && num_sectors > 3 )
     {
         int chk = 0;
@@ -112,8 +599,8 @@ struct atr_image *load_atr_image(const char *file_name)
                 chk += data[i * 256 + j + 128];
             if( chk != 0 )
             {
-                show_msg("%s: ATR suspect - sector %d has data over 128 bytes, fixing.",
-                         file_name, i + 1);
+                atr_msg("%s: ATR suspect - sector %d has data over 128 bytes, fixing.",
+                        file_name, i + 1);
                 break;
             }
         }
@@ -145,28 +632,147 @@ struct atr_image *load_atr_image(const char *file_name)
             memset(data + 2 * 256 + 128, 0, 128);
             memset(data + 1 * 256 + 128, 0, 128);
             memset(data + 0 * 256 + 128, 0, 128);
+            // The layout is not known, so the image can't be written back
+            first_size = 0;
         }
     }
+    int e = new_image(atr, data, ssz, num_sectors, 16, first_size, file_name);
+    if( !e )
+        memcpy((*atr)->header, hdr, 16);
+    return e;
+}
+
+int atr_load_file(struct atr_image **atr, const char *file_name)
+{
+    FILE *f = fopen(file_name, "rb");
+    if( !f )
+        return atr_err_open;
+    int e = atr_load_stream(atr, f, file_name);
+    fclose(f);
+    return e;
+}
+
+int atr_load_stream(struct atr_image **atr, FILE *f, const char *name)
+{
+    struct atr_src src = {0};
+    src.f              = f;
+    return load_image(atr, &src, name ? name : "<stream>");
+}
+
+int atr_load_mem(struct atr_image **atr, const uint8_t *data, size_t len,
+                 const char *name)
+{
+    struct atr_src src = {0};
+    src.mem            = data;
+    src.len            = len;
+    return load_image(atr, &src, name ? name : "<memory>");
+}
+
+int atr_open_rw(struct atr_image **atr, const char *file_name)
+{
+    FILE *f = fopen(file_name, "r+b");
+    if( !f )
+        return atr_err_open;
+    struct atr_image *img;
+    int e = atr_load_stream(&img, f, file_name);
+    if( e )
+    {
+        fclose(f);
+        return e;
+    }
+    if( !img->first_size || img->zip || img->stored )
+        e = atr_err_read_only;
+    else if( !(img->dirty = calloc((img->sec_count + 31) / 32, sizeof(uint32_t))) )
+        e = atr_err_memory;
+    else if( (img->fd = dup(fileno(f))) < 0 )
+        e = atr_err_open;
     fclose(f);
-    // Ok, copy to image
-    struct atr_image *atr = check_malloc(sizeof(struct atr_image));
-    atr->data             = data;
-    atr->sec_size         = ssz;
-    atr->sec_count        = num_sectors;
-    return atr;
+    if( e )
+        atr_free(img);
+    else
+        *atr = img;
+    return e;
 }
 
 void atr_free(struct atr_image *atr)
 {
+    if( !atr )
+        return;
     if( atr->data )
         free((uint8_t *)(atr->data));
+    if( atr->fd >= 0 )
+        close(atr->fd);
+    free(atr->dirty);
+    zip_free(atr->zip);
+    free(atr->name);
     free(atr);
 }
 
 const uint8_t *atr_data(const struct atr_image *atr, unsigned sector)
 {
-    if( sector < 1 || sector > atr->sec_count )
+    return atr_data_run(atr, sector, atr->sec_size);
+}
+
+const uint8_t *atr_data_run(const struct atr_image *atr, unsigned sector, size_t len)
+{
+    if( sector < 1 || sector > atr->sec_count ||
+        len > (size_t)(atr->sec_count - sector + 1) * atr->sec_size )
         return 0;
-    else
-        return atr->data + (sector - 1) * atr->sec_size;
+    if( atr->zip )
+    {
+        unsigned shift = atr->zip->shift;
+        unsigned last  = sector - 1 + (len ? (len - 1) / atr->sec_size : 0);
+        for( unsigned g = (sector - 1) >> shift; g <= last >> shift; g++ )
+            if( load_group(atr, g) )
+                return 0;
+    }
+    return atr->data + (sector - 1) * atr->sec_size;
+}
+
+uint8_t *atr_data_rw(struct atr_image *atr, unsigned sector)
+{
+    if( sector < 1 || sector > atr->sec_count || atr->fd < 0 )
+        return 0;
+    atr->dirty[(sector - 1) / 32] |= 1U << ((sector - 1) & 31);
+    return (uint8_t *)atr->data + (sector - 1) * atr->sec_size;
+}
+
+// Writes "num" sectors starting at "sector", contiguous in the file
+static int write_sectors(struct atr_image *atr, unsigned sector, unsigned num)
+{
+    unsigned ssz = atr->sec_size, first = atr->first_size;
+    size_t len   = sector <= 3 ? first : (size_t)ssz * num;
+    off_t pos    = atr->hdr_size + (sector <= 3 ? (sector - 1) * first
+                                                 : 3 * first + (off_t)(sector - 4) * ssz);
+    if( pwrite(atr->fd, atr->data + (sector - 1) * ssz, len, pos) != (ssize_t)len )
+        return atr_err_write;
+    return atr_ok;
+}
+
+int atr_sync(struct atr_image *atr)
+{
+    if( atr->fd < 0 )
+        return atr_err_read_only;
+    // Join runs of modified sectors in one write, the first three are written
+    // alone as the size in the file can be smaller.
+    for( unsigned i = 0; i < atr->sec_count; i++ )
+    {
+        if( !atr->dirty[i / 32] )
+        {
+            i |= 31;
+            continue;
+        }
+        if( !(atr->dirty[i / 32] & (1U << (i & 31))) )
+            continue;
+        unsigned n = 1;
+        while( i >= 3 && i + n < atr->sec_count &&
+               (atr->dirty[(i + n) / 32] & (1U << ((i + n) & 31))) )
+            n++;
+        if( write_sectors(atr, i + 1, n) )
+            return atr_err_write;
+        for( unsigned j = i; j < i + n; j++ )
+            atr->dirty[j / 32] &= ~(1U << (j & 31));
+        i += n - 1;
+    }
+    return atr_ok;
 }
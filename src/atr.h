@@ -18,15 +18,96 @@
  * Load ATR files.
  */
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+
+struct atr_zip;
 
 struct atr_image
 {
     const uint8_t *data;
     unsigned sec_size;
     unsigned sec_count;
+    char *name; // Name used in messages
+    // Layout of the file, used to write back images opened with atr_open_rw()
+    unsigned hdr_size;   // Bytes before the first sector, 16 or 0
+    unsigned first_size; // Size of the first three sectors, 0 if unknown
+    int fd;              // File descriptor, -1 if not writable
+    uint32_t *dirty;     // Bitset of modified sectors
+    uint8_t header[16];  // ATR header of the file, zeros if there is no header
+    // Compressed images are decompressed by groups of sectors when read,
+    // NULL if all the data is loaded
+    struct atr_zip *zip;
+    int stored; // Image rebuilt from a sector store, the file is only the recipe
+};
+
+// Error codes returned by the library functions, always negative.
+enum atr_error
+{
+    atr_ok              = 0,
+    atr_err_open        = -1,  // Can't open file, errno is set.
+    atr_err_read        = -2,  // Can't read ATR header, errno is set.
+    atr_err_format      = -3,  // Not an ATR image.
+    atr_err_sector_size = -4,  // Unsupported sector size.
+    atr_err_too_small   = -5,  // Invalid image size, too small.
+    atr_err_memory      = -6,  // Out of memory.
+    atr_err_no_fs       = -7,  // File system not supported.
+    atr_err_invalid     = -8,  // Invalid file system data.
+    atr_err_read_only   = -9,  // Image not opened for writing.
+    atr_err_write       = -10, // Can't write to file, errno is set.
+    atr_err_not_found   = -11, // File not found.
+    atr_err_exists      = -12, // File already exists.
+    atr_err_not_empty   = -13, // Directory not empty.
+    atr_err_no_space    = -14, // No free sectors in the image.
+    atr_err_name        = -15, // Invalid file name.
+    atr_err_unsupported = -16, // Operation not supported for the file system.
 };
 
-struct atr_image *load_atr_image(const char *file_name);
+// Returns a description of the error code.
+const char *atr_strerror(int err);
+
+// Images can be ATR files, raw SD/ED images, compressed images written by
+// atr_compress() or recipes of images in a sector store written by atrstore;
+// all the functions that load images accept the four formats. The sectors of a
+// recipe are read from the pool file named in it, relative to the directory
+// of the recipe, or to the current directory when loaded from a stream.
+
+// Loads an image from a file, returns 0 if ok or an error code.
+int atr_load_file(struct atr_image **atr, const char *file_name);
+// Loads an image from an open stream, reading it sequentially, so pipes can
+// be used. The stream is not closed. The name is used only in messages.
+int atr_load_stream(struct atr_image **atr, FILE *f, const char *name);
+// Loads an image from a memory buffer, the data is copied. The name is
+// used only in messages.
+int atr_load_mem(struct atr_image **atr, const uint8_t *data, size_t len,
+                 const char *name);
+// Loads an image from a file that can be modified, only the sectors changed
+// are written back to the file by atr_sync().
+int atr_open_rw(struct atr_image **atr, const char *file_name);
+// Releases the image, changes not written by atr_sync() are lost.
 void atr_free(struct atr_image *atr);
+// Returns the data of the sector, or NULL if the sector is not valid or can't
+// be decompressed.
 const uint8_t *atr_data(const struct atr_image *atr, unsigned sector);
+// Returns the data of "len" bytes starting at the sector and continuing in the
+// next sectors, or NULL if those are not valid or can't be decompressed.
+const uint8_t *atr_data_run(const struct atr_image *atr, unsigned sector, size_t len);
+// Decompresses all the sectors of a compressed image, so that "data" can be
+// used directly and from many threads. Returns 0 or an error code.
+int atr_load_all(struct atr_image *atr);
+// Writes the image in the compressed format, to a new buffer released with
+// free(). Groups of sectors are compressed independently, groups with only
+// zeros are not stored.
+int atr_compress(struct atr_image *atr, uint8_t **out, size_t *out_len);
+// Returns the data of the sector to be modified, marking it to be written, or
+// NULL if the image is not writable.
+uint8_t *atr_data_rw(struct atr_image *atr, unsigned sector);
+// Writes the modified sectors to the file.
+int atr_sync(struct atr_image *atr);
+
+// Sets a function to receive warnings about recoverable problems found while
+// reading images, by default those are ignored.
+void atr_set_msg_handler(void (*handler)(const char *msg));
+// Sends a message to the current handler.
+void atr_msg(const char *format, ...) __attribute__((format(printf, 1, 2)));
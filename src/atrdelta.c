@@ -0,0 +1,395 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Creates and applies sector level deltas between two ATR images.
+ */
+#define _XOPEN_SOURCE 700
+#include "atr.h"
+#include "compat.h"
+#include "crc32.h"
+#include "msg.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Delta file format, all values are 32 bit little endian:
+//  0: "ATRDELTA"
+//  8: version
+// 12: old image sector size, sector count and CRC32 of the sector data
+// 24: new image sector size, sector count and CRC32 of the sector data
+// 36: bytes 7 to 15 of the new ATR header, padded to 12 bytes
+// 48: runs of changed sectors, as first sector, count and the sector data,
+//     terminated by a run with count 0
+// The file ends with the CRC32 of all the preceding bytes.
+#define DELTA_MAGIC   "ATRDELTA"
+#define DELTA_VERSION 1
+#define DELTA_HDR     48
+
+static void show_usage(void)
+{
+    printf("Usage: %s [options] <old_atr> <new_atr> <delta_file>\n"
+           "       %s -a <atr_file> <delta_file>\n"
+           "Options:\n"
+           "\t-a\tApply the delta to the ATR file, modifying it in place.\n"
+           "\t-h\tShow this help.\n"
+           "\t-v\tShow version information.\n"
+           "\n"
+           "Without '-a', writes to the delta file the sectors that changed from\n"
+           "the old to the new image. Use '-' as delta file name to write to\n"
+           "standard output or read from standard input.\n",
+           prog_name, prog_name);
+    exit(EXIT_SUCCESS);
+}
+
+static void msg_handler(const char *msg)
+{
+    show_msg("%s", msg);
+}
+
+static void put32(uint8_t *p, unsigned x)
+{
+    p[0] = x;
+    p[1] = x >> 8;
+    p[2] = x >> 16;
+    p[3] = x >> 24;
+}
+
+static unsigned get32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+// Loads the image, "apply" is set if the file will be modified
+static struct atr_image *load_atr(const char *name, int apply)
+{
+    struct atr_image *atr;
+    int e = atr_load_file(&atr, name);
+    if( !e && apply && (atr->zip || atr->stored) )
+        show_error("%s: can't apply a delta to a compressed or stored image.", name);
+    // The data is used directly, decompress all the sectors
+    if( !e && (e = atr_load_all(atr)) )
+        atr_free(atr);
+    if( e )
+        show_error("%s: %s", name, atr_strerror(e));
+    return atr;
+}
+
+// CRC32 of all the sector data of the image
+static unsigned image_crc(const uint8_t *data, unsigned ssz, unsigned nsec)
+{
+    return crc32(0, data, ssz * nsec);
+}
+
+// Reads a full file to memory, "-" is the standard input
+static uint8_t *read_file(const char *name, size_t *len)
+{
+    FILE *f = stdin;
+    if( strcmp(name, "-") )
+        f = fopen(name, "rb");
+    else
+        compat_set_binary(stdin);
+    if( !f )
+        show_error("can't open file '%s': %s", name, strerror(errno));
+    size_t alloc  = 65536;
+    uint8_t *data = check_malloc(alloc);
+    *len          = 0;
+    for( ;; )
+    {
+        *len += fread(data + *len, 1, alloc - *len, f);
+        if( *len < alloc )
+            break;
+        alloc *= 2;
+        data = check_realloc(data, alloc);
+    }
+    if( ferror(f) )
+        show_error("can't read file '%s': %s", name, strerror(errno));
+    if( f != stdin )
+        fclose(f);
+    return data;
+}
+
+// Layout of the sectors in the file, the size of the header and of the first
+// three sectors
+struct layout
+{
+    unsigned hdr;
+    unsigned first;
+};
+
+// Layout of the updated file, keeps the one of the current file so that only
+// the changed sectors are written
+static struct layout file_layout(const struct atr_image *atr, unsigned ssz, unsigned nsec)
+{
+    struct layout l = { 16, ssz == 512 ? 512 : 128 };
+    // Raw images stay without header while the geometry is still valid
+    if( !atr->hdr_size && ssz == 128 && (nsec == 720 || nsec == 1040) )
+        l.hdr = 0;
+    // Keep full or short first sectors, if known
+    else if( atr->sec_size != 128 && atr->first_size )
+        l.first = atr->first_size == atr->sec_size ? ssz : 128;
+    return l;
+}
+
+// Size of the ATR file
+static size_t atr_file_size(struct layout l, unsigned ssz, unsigned nsec)
+{
+    return l.hdr + (nsec > 3 ? 3 * l.first + (size_t)(nsec - 3) * ssz : l.first * nsec);
+}
+
+// Reads bytes 7 to 15 of the ATR header, those hold flags of some emulators
+static void read_header_extra(const char *name, uint8_t *extra)
+{
+    uint8_t hdr[16];
+    FILE *f = fopen(name, "rb");
+    memset(extra, 0, 12);
+    if( f && 16 == fread(hdr, 1, 16, f) && hdr[0] == 0x96 && hdr[1] == 0x02 )
+        memcpy(extra, hdr + 7, 9);
+    if( f )
+        fclose(f);
+}
+
+// Returns true if sector "i" must be included in the delta. When the sector
+// sizes are different, the delta is applied over an empty image.
+static int sector_changed(const struct atr_image *old, const struct atr_image *new,
+                          unsigned i)
+{
+    unsigned ssz        = new->sec_size;
+    const uint8_t *data = new->data + i * ssz;
+    if( old->sec_size == ssz && i < old->sec_count )
+        return 0 != memcmp(old->data + i * ssz, data, ssz);
+    for( unsigned j = 0; j < ssz; j++ )
+        if( data[j] )
+            return 1;
+    return 0;
+}
+
+static void make_delta(const char *old_name, const char *new_name, const char *out)
+{
+    struct atr_image *old = load_atr(old_name, 0);
+    struct atr_image *new = load_atr(new_name, 0);
+    unsigned ssz          = new->sec_size;
+    unsigned nsec         = new->sec_count;
+
+    // The delta can't be bigger than all the sectors plus one run
+    size_t alloc = DELTA_HDR + (size_t)nsec * ssz + 8 * ((nsec + 1) / 2) + 12;
+    uint8_t *buf = check_malloc(alloc);
+    memcpy(buf, DELTA_MAGIC, 8);
+    put32(buf + 8, DELTA_VERSION);
+    put32(buf + 12, old->sec_size);
+    put32(buf + 16, old->sec_count);
+    put32(buf + 20, image_crc(old->data, old->sec_size, old->sec_count));
+    put32(buf + 24, ssz);
+    put32(buf + 28, nsec);
+    put32(buf + 32, image_crc(new->data, ssz, nsec));
+    read_header_extra(new_name, buf + 36);
+
+    size_t len       = DELTA_HDR;
+    unsigned changed = 0, runs = 0;
+    for( unsigned i = 0; i < nsec; i++ )
+    {
+        if( !sector_changed(old, new, i) )
+            continue;
+        unsigned n = 1;
+        while( i + n < nsec && sector_changed(old, new, i + n) )
+            n++;
+        put32(buf + len, i + 1);
+        put32(buf + len + 4, n);
+        memcpy(buf + len + 8, new->data + i * ssz, n * ssz);
+        len += 8 + n * ssz;
+        changed += n;
+        runs++;
+        // Sector after the run is not changed, skip it too
+        i += n;
+    }
+    put32(buf + len, 0);
+    put32(buf + len + 4, 0);
+    len += 8;
+    put32(buf + len, crc32(0, buf, len));
+    len += 4;
+
+    FILE *f = stdout;
+    if( strcmp(out, "-") )
+        f = fopen(out, "wb");
+    else
+        compat_set_binary(stdout);
+    if( !f )
+        show_error("can't open output file '%s': %s", out, strerror(errno));
+    if( 1 != fwrite(buf, len, 1, f) || (f == stdout ? fflush(f) : fclose(f)) )
+        show_error("can't write output file '%s': %s", out, strerror(errno));
+    show_msg("%u of %u sectors changed in %u run%s, delta of %zu bytes.", changed, nsec,
+             runs, runs == 1 ? "" : "s", len);
+    free(buf);
+    atr_free(old);
+    atr_free(new);
+}
+
+// Writes the parts of the ATR file that differ from the current contents and
+// truncates it to the new size, returns the number of sectors written.
+static unsigned write_changes(const char *name, const uint8_t *atr, struct layout l,
+                              unsigned ssz, unsigned nsec)
+{
+    size_t old_len;
+    uint8_t *old = read_file(name, &old_len);
+    size_t size  = atr_file_size(l, ssz, nsec);
+    int fd       = open(name, O_WRONLY);
+    if( fd < 0 )
+        show_error("can't open file '%s': %s", name, strerror(errno));
+
+    // Write the header and each sector that changed
+    unsigned num = 0;
+    size_t pos   = 0;
+    for( unsigned i = 0; i <= nsec; i++ )
+    {
+        size_t len = !i ? l.hdr : i <= 3 ? l.first : ssz;
+        if( pos + len > old_len || memcmp(old + pos, atr + pos, len) )
+        {
+            if( pwrite(fd, atr + pos, len, pos) != (ssize_t)len )
+                show_error("can't write file '%s': %s", name, strerror(errno));
+            num += i != 0;
+        }
+        pos += len;
+    }
+    if( (old_len > size && ftruncate(fd, size)) || close(fd) )
+        show_error("can't write file '%s': %s", name, strerror(errno));
+    free(old);
+    return num;
+}
+
+static void apply_delta(const char *name, const char *delta_name)
+{
+    size_t len;
+    uint8_t *d = read_file(delta_name, &len);
+    if( len < DELTA_HDR + 12 || memcmp(d, DELTA_MAGIC, 8) )
+        show_error("%s: not an ATR delta file.", delta_name);
+    if( get32(d + len - 4) != crc32(0, d, len - 4) )
+        show_error("%s: invalid checksum, delta file is corrupted.", delta_name);
+    if( get32(d + 8) != DELTA_VERSION )
+        show_error("%s: unsupported delta version %u.", delta_name, get32(d + 8));
+
+    unsigned ssz  = get32(d + 24);
+    unsigned nsec = get32(d + 28);
+    if( (ssz != 128 && ssz != 256 && ssz != 512) || !nsec || nsec > 0x20000 )
+        show_error("%s: invalid image geometry in delta file.", delta_name);
+
+    // Check that the image is the source of the delta
+    struct atr_image *atr = load_atr(name, 1);
+    struct layout l       = file_layout(atr, ssz, nsec);
+    if( atr_file_size(l, ssz, nsec) > 16 + 65535 * 512 )
+        show_error("%s: invalid image geometry in delta file.", delta_name);
+    unsigned crc          = image_crc(atr->data, atr->sec_size, atr->sec_count);
+    if( atr->sec_size == ssz && atr->sec_count == nsec && crc == get32(d + 32) )
+    {
+        show_msg("%s: image already updated.", name);
+        atr_free(atr);
+        free(d);
+        return;
+    }
+    if( atr->sec_size != get32(d + 12) || atr->sec_count != get32(d + 16) ||
+        crc != get32(d + 20) )
+        show_error("%s: image does not match the source of the delta.", name);
+
+    // Apply all the runs to a copy of the sector data
+    uint8_t *data = check_calloc(nsec, ssz);
+    if( atr->sec_size == ssz )
+        memcpy(data, atr->data, ssz * (nsec < atr->sec_count ? nsec : atr->sec_count));
+    size_t pos = DELTA_HDR;
+    for( ;; )
+    {
+        if( pos + 8 > len - 4 )
+            show_error("%s: delta file too short.", delta_name);
+        unsigned first = get32(d + pos);
+        unsigned n     = get32(d + pos + 4);
+        pos += 8;
+        if( !n )
+            break;
+        if( !first || first > nsec || n > nsec - first + 1 ||
+            (size_t)n * ssz > len - 4 - pos )
+            show_error("%s: invalid sector run in delta file.", delta_name);
+        memcpy(data + (first - 1) * ssz, d + pos, n * ssz);
+        pos += n * ssz;
+    }
+    if( image_crc(data, ssz, nsec) != get32(d + 32) )
+        show_error("%s: checksum of the result does not match, image not modified.", name);
+
+    // Build the new ATR file and write the differences
+    size_t size  = atr_file_size(l, ssz, nsec);
+    uint8_t *buf = check_malloc(size);
+    if( l.hdr )
+    {
+        buf[0] = 0x96;
+        buf[1] = 0x02;
+        buf[2] = (size - 16) >> 4;
+        buf[3] = (size - 16) >> 12;
+        buf[4] = ssz;
+        buf[5] = ssz >> 8;
+        buf[6] = (size - 16) >> 20;
+        memcpy(buf + 7, d + 36, 9);
+    }
+    for( unsigned i = 0; i < nsec; i++ )
+        memcpy(buf + l.hdr + (i < 3 ? l.first * i : 3 * l.first + (i - 3) * ssz),
+               data + i * ssz, i < 3 ? l.first : ssz);
+    unsigned num = write_changes(name, buf, l, ssz, nsec);
+    show_msg("%s: updated %u sectors, image with %u sectors of %u bytes.", name, num, nsec,
+             ssz);
+    free(buf);
+    free(data);
+    atr_free(atr);
+    free(d);
+}
+
+int main(int argc, char **argv)
+{
+    const char *args[3];
+    int num   = 0;
+    int apply = 0;
+
+    prog_name = argv[0];
+    atr_set_msg_handler(msg_handler);
+    for( int i = 1; i < argc; i++ )
+    {
+        char *arg = argv[i];
+        if( arg[0] == '-' && arg[1] )
+        {
+            char op;
+            while( 0 != (op = *++arg) )
+            {
+                if( op == 'h' || op == '?' )
+                    show_usage();
+                else if( op == 'a' )
+                    apply = 1;
+                else if( op == 'v' )
+                    show_version();
+                else
+                    show_opt_error("invalid command line option '-%c'", op);
+            }
+        }
+        else if( num < 3 )
+            args[num++] = arg;
+        else
+            show_opt_error("too many arguments");
+    }
+    if( num != 3 - apply )
+        show_opt_error("missing file name");
+    if( apply )
+        apply_delta(args[0], args[1]);
+    else
+        make_delta(args[0], args[1], args[2]);
+    return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Modifies the files inside an ATR image.
+ */
+#include "atrfs.h"
+#include "defrag.h"
+#include "msg.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void show_usage(void)
+{
+    printf("Usage: %s [options] <atr_file> <command> [<arguments>]\n"
+           "Options:\n"
+           "\t-t\tWith 'defrag', reduce the image to the minimum size.\n"
+           "\t-h\tShow this help.\n"
+           "\t-v\tShow version information.\n"
+           "\n"
+           "Commands:\n"
+           "\trm <path> [... <path>]\n"
+           "\t       \tRemove the files or empty directories.\n"
+           "\tmv <from> <to>\n"
+           "\t       \tRename a file or directory, or move it to the directory <to>.\n"
+           "\tdefrag\tRewrite the image with the contents of each file contiguous.\n"
+           "\n"
+           "Paths are inside the image, as '/DIR/FILE.COM'. Only SpartaDOS images\n"
+           "can be modified, and the image is not modified if there are errors.\n",
+           prog_name);
+    exit(EXIT_SUCCESS);
+}
+
+static void msg_handler(const char *msg)
+{
+    show_msg("%s", msg);
+}
+
+int main(int argc, char **argv)
+{
+    char **args = check_calloc(argc, sizeof(char *));
+    int num     = 0;
+    int trim    = 0;
+
+    prog_name = argv[0];
+    atr_set_msg_handler(msg_handler);
+    for( int i = 1; i < argc; i++ )
+    {
+        char *arg = argv[i];
+        if( arg[0] == '-' && arg[1] && num < 2 )
+        {
+            char op;
+            while( 0 != (op = *++arg) )
+            {
+                if( op == 'h' || op == '?' )
+                    show_usage();
+                else if( op == 't' )
+                    trim = 1;
+                else if( op == 'v' )
+                    show_version();
+                else
+                    show_opt_error("invalid command line option '-%c'", op);
+            }
+        }
+        else
+            args[num++] = arg;
+    }
+    if( num < 2 )
+        show_opt_error("missing ATR file name or command");
+
+    const char *cmd = args[1];
+    if( !strcmp(cmd, "rm") )
+    {
+        if( num < 3 )
+            show_opt_error("missing file name to remove");
+    }
+    else if( !strcmp(cmd, "mv") )
+    {
+        if( num != 4 )
+            show_opt_error("command 'mv' needs two file names");
+    }
+    else if( !strcmp(cmd, "defrag") )
+    {
+        if( num != 2 )
+            show_opt_error("command 'defrag' has no arguments");
+        defrag_image(args[0], trim);
+        free(args);
+        return 0;
+    }
+    else
+        show_opt_error("invalid command '%s'", cmd);
+
+    struct atr_image *atr;
+    int e = atr_open_rw(&atr, args[0]);
+    if( e == atr_err_open )
+        show_error("%s: %s: %s", args[0], atr_strerror(e), strerror(errno));
+    else if( e )
+        show_error("%s: %s", args[0], atr_strerror(e));
+    struct atrfs *fs;
+    e = atrfs_open(&fs, atr, 0);
+    if( e )
+        show_error("%s: %s", args[0], atr_strerror(e));
+
+    if( !strcmp(cmd, "rm") )
+    {
+        for( int i = 2; i < num; i++ )
+            if( (e = atrfs_remove(fs, args[i])) )
+                show_error("%s: %s", args[i], atr_strerror(e));
+    }
+    else if( (e = atrfs_rename(fs, args[2], args[3])) )
+        show_error("can't move '%s' to '%s': %s", args[2], args[3], atr_strerror(e));
+
+    if( (e = atr_sync(atr)) )
+        show_error("%s: %s: %s", args[0], atr_strerror(e), strerror(errno));
+    atrfs_close(fs);
+    atr_free(atr);
+    free(args);
+    return 0;
+}
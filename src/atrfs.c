@@ -0,0 +1,164 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Reads the file-system inside an ATR image.
+ */
+#include "atrfs.h"
+#include "lsdos.h"
+#include "lsextra.h"
+#include "lshowfen.h"
+#include "lssfs.h"
+#include "sfsedit.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Maximum directory depth traversed by atrfs_walk()
+#define MAX_DEPTH 32
+
+int atrfs_open(struct atrfs **fs, struct atr_image *atr, int flags)
+{
+    struct atrfs *f = calloc(1, sizeof(struct atrfs));
+    if( !f )
+        return atr_err_memory;
+    f->atr         = atr;
+    f->lower_case  = 0 != (flags & atrfs_lower_case);
+    f->root.is_dir = 1;
+
+    if( sfs_open(f) && howfen_open(f) && dos_open(f) && extra_open(f) )
+    {
+        free(f);
+        return atr_err_no_fs;
+    }
+    *fs = f;
+    return atr_ok;
+}
+
+void atrfs_close(struct atrfs *fs)
+{
+    free(fs);
+}
+
+int atrfs_read_dir(struct atrfs *fs, const struct atrfs_entry *dir, atrfs_dir_cb cb,
+                   void *ctx)
+{
+    if( !dir )
+        dir = &fs->root;
+    if( !dir->is_dir )
+        return atr_err_invalid;
+    switch( fs->info.type )
+    {
+        case atrfs_sparta: return sfs_read_dir(fs, dir, cb, ctx);
+        case atrfs_dos: return dos_read_dir(fs, dir, cb, ctx);
+        case atrfs_howfen: return howfen_read_dir(fs, dir, cb, ctx);
+        case atrfs_bas2boot:
+        case atrfs_kboot: return extra_read_dir(fs, dir, cb, ctx);
+    }
+    return atr_err_invalid;
+}
+
+int atrfs_read_file(struct atrfs *fs, const struct atrfs_entry *file, uint8_t *buf,
+                    unsigned size)
+{
+    if( file->is_dir )
+        return atr_err_invalid;
+    if( size > file->size )
+        size = file->size;
+    switch( fs->info.type )
+    {
+        case atrfs_sparta: return sfs_read_file(fs, file, buf, size);
+        case atrfs_dos: return dos_read_file(fs, file, buf, size);
+        case atrfs_howfen: return howfen_read_file(fs, file, buf, size);
+        case atrfs_bas2boot:
+        case atrfs_kboot: return extra_read_file(fs, file, buf, size);
+    }
+    return atr_err_invalid;
+}
+
+int atrfs_remove(struct atrfs *fs, const char *path)
+{
+    if( fs->info.type != atrfs_sparta )
+        return atr_err_unsupported;
+    return sfs_remove(fs, path);
+}
+
+int atrfs_rename(struct atrfs *fs, const char *from, const char *to)
+{
+    if( fs->info.type != atrfs_sparta )
+        return atr_err_unsupported;
+    return sfs_rename(fs, from, to);
+}
+
+// State of the tree traversal
+struct walk
+{
+    struct atrfs *fs;
+    atrfs_walk_cb cb;
+    void *ctx;
+    int depth;
+    int stop; // Value returned by the callback to stop the walk
+    size_t len;
+    char path[MAX_DEPTH * 33 + 1];
+};
+
+static int walk_entry(void *ctx, const struct atrfs_entry *entry)
+{
+    struct walk *w = ctx;
+    size_t len     = w->len;
+    size_t nlen    = strlen(entry->name);
+
+    w->path[len] = '/';
+    memcpy(w->path + len + 1, entry->name, nlen + 1);
+    int e = w->stop = w->cb(w->ctx, w->path, entry);
+    if( !e && entry->is_dir )
+    {
+        if( w->depth >= MAX_DEPTH )
+            atr_msg("%s: directory too deep, skip", w->path);
+        else
+        {
+            w->depth++;
+            w->len = len + 1 + nlen;
+            e      = atrfs_read_dir(w->fs, entry, walk_entry, w);
+            w->len = len;
+            w->depth--;
+            // Skip invalid directories, continuing with the next entry
+            if( e && !w->stop && e != atr_err_memory )
+            {
+                atr_msg("%s: can´t get directory data", w->path);
+                e = 0;
+            }
+        }
+    }
+    w->path[len] = 0;
+    return e;
+}
+
+int atrfs_walk(struct atrfs *fs, atrfs_walk_cb cb, void *ctx)
+{
+    struct walk *w = malloc(sizeof(struct walk));
+    if( !w )
+        return atr_err_memory;
+    w->fs      = fs;
+    w->cb      = cb;
+    w->ctx     = ctx;
+    w->depth   = 0;
+    w->stop    = 0;
+    w->len     = 0;
+    w->path[0] = 0;
+    int e      = atrfs_read_dir(fs, 0, walk_entry, w);
+    free(w);
+    return e;
+}
@@ -0,0 +1,118 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Reads the file-system inside an ATR image.
+ *
+ * This is the interface of the "libatr" library: no function here writes to
+ * the standard output or exits the program, all errors are returned as the
+ * negative codes from "enum atr_error".
+ */
+#pragma once
+#include "atr.h"
+
+// Supported file-systems
+enum atrfs_type
+{
+    atrfs_sparta,   // SpartaDOS and BW-DOS
+    atrfs_dos,      // DOS 1, DOS 2.x, MyDOS and LiteDOS
+    atrfs_howfen,   // HOWFEN DOS menu disk
+    atrfs_bas2boot, // BAS2BOOT image
+    atrfs_kboot     // K-file boot image
+};
+
+// Options for atrfs_open()
+enum atrfs_flags
+{
+    atrfs_lower_case = 1 // Convert file names to lower-case
+};
+
+// File attributes, same as SpartaDOS
+enum atrfs_attr
+{
+    atrfs_protected = 1,
+    atrfs_hidden    = 2,
+    atrfs_archived  = 4
+};
+
+// One directory entry
+struct atrfs_entry
+{
+    char name[32];   // Host file name, "FILE.COM"
+    char aname[32];  // Atari listing name, "FILE     COM"
+    unsigned size;   // File size, for directories the allocated size
+    int is_dir;      // Entry is a sub-directory
+    int has_date;    // Date and time are valid
+    uint8_t date[3]; // Day, month, year
+    uint8_t time[3]; // Hour, minute, second
+    unsigned attribs;
+    unsigned sector; // First (or map) sector, file-system specific
+    unsigned flags;  // Entry flags, file-system specific
+};
+
+// File-system information
+struct atrfs_info
+{
+    enum atrfs_type type;
+    char format[48];       // Description of the format, "DOS 2.0s"
+    char volume[32];       // Volume name, if available
+    unsigned free_sectors; // Free and total sectors, if available
+    unsigned total_sectors;
+};
+
+struct atrfs
+{
+    struct atr_image *atr;
+    struct atrfs_info info;
+    struct atrfs_entry root;
+    int lower_case;
+    // Used by the DOS reader
+    int dir_size;
+    int ldos_csize;
+    int fix_bibo;
+};
+
+// Called for each entry in a directory, return non zero to stop iterating.
+typedef int (*atrfs_dir_cb)(void *ctx, const struct atrfs_entry *entry);
+// Called for each entry in the tree, with the full path ("/DIR/FILE.COM").
+typedef int (*atrfs_walk_cb)(void *ctx, const char *path, const struct atrfs_entry *entry);
+
+// Detects the file-system in the image. The image must be valid until the
+// file-system is closed.
+int atrfs_open(struct atrfs **fs, struct atr_image *atr, int flags);
+void atrfs_close(struct atrfs *fs);
+
+// Calls "cb" for each entry in the directory, pass NULL for the root directory.
+// Returns 0, an error code or the value returned from the callback.
+int atrfs_read_dir(struct atrfs *fs, const struct atrfs_entry *dir, atrfs_dir_cb cb,
+                   void *ctx);
+
+// Calls "cb" for all entries in the file-system, parents before children.
+int atrfs_walk(struct atrfs *fs, atrfs_walk_cb cb, void *ctx);
+
+// Reads up to "size" bytes of the file to "buf", returns the number of bytes read
+// or an error code.
+int atrfs_read_file(struct atrfs *fs, const struct atrfs_entry *file, uint8_t *buf,
+                    unsigned size);
+
+// Removes a file or an empty directory, given the full path ("/DIR/FILE.COM").
+// The image must be opened with atr_open_rw(), changes are written to the file
+// with atr_sync(). Only supported in SpartaDOS images.
+int atrfs_remove(struct atrfs *fs, const char *path);
+
+// Renames a file or directory, or moves it to other directory if "to" is an
+// existing directory. Same restrictions as atrfs_remove().
+int atrfs_rename(struct atrfs *fs, const char *from, const char *to);
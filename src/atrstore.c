@@ -0,0 +1,511 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Adds ATR images to a sector store: each distinct sector is kept once in a
+ * pool file shared by all the images, and each image is written as a recipe
+ * with the list of its sectors. Recipes are loaded directly by all the tools.
+ */
+#include "atr.h"
+#include "compat.h"
+#include "msg.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// Layout of recipes and pools, see the description in atr.c
+#define STORE_HDR 38
+#define POOL_HDR 16
+
+// Images are loaded in parallel in batches, and added to the store in order.
+// A batch ends after BATCH images or after loading BATCH_BYTES of sectors.
+#define BATCH 256
+#define BATCH_BYTES (256 << 20)
+
+static void show_usage(void)
+{
+    printf("Usage: %s [options] <store_dir> <input_atr> [...]\n"
+           "Options:\n"
+           "\t-f\tOverwrite existing recipes in the store.\n"
+           "\t-h\tShow this help.\n"
+           "\t-v\tShow version information.\n"
+           "\n"
+           "Each image is written to the store directory as a recipe, with the\n"
+           "name of the image and extension '.atrs', that can be read by all the\n"
+           "tools as an image. The sectors are kept in the files 'sectors-*.pool'.\n",
+           prog_name);
+    exit(EXIT_SUCCESS);
+}
+
+static void msg_handler(const char *msg)
+{
+    show_msg("%s", msg);
+}
+
+static void put16(uint8_t *p, unsigned x)
+{
+    p[0] = x;
+    p[1] = x >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t x)
+{
+    put16(p, x);
+    put16(p + 2, x >> 16);
+}
+
+// Hash of the sector data, 0 only for sectors with all zeros
+static uint64_t sector_hash(const uint8_t *data, unsigned len)
+{
+    uint64_t h = len, all = 0;
+    for( unsigned i = 0; i < len; i += 8 )
+    {
+        uint64_t x;
+        memcpy(&x, data + i, 8);
+        all |= x;
+        h = (h ^ x) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    return !all ? 0 : h ? h : 1;
+}
+
+// Distinct sectors of one size, all kept in memory
+struct pool
+{
+    unsigned ssz;
+    char *file;      // Path of the pool file
+    uint8_t *data;   // Data of all the sectors
+    uint64_t *hash;  // Hash of each sector
+    uint32_t num;    // Number of sectors
+    uint32_t saved;  // Sectors already written to the file
+    uint32_t alloc;  //
+    uint32_t *table; // Hash table with the sector numbers, 0 if empty
+    uint32_t mask;   //
+};
+
+// Returns the position of the sector in the hash table, or of the empty slot
+// to insert it
+static uint32_t pool_slot(const struct pool *p, const uint8_t *data, uint64_t h)
+{
+    for( uint32_t i = h & p->mask;; i = (i + 1) & p->mask )
+    {
+        uint32_t n = p->table[i];
+        if( !n || (p->hash[n - 1] == h &&
+                   !memcmp(p->data + (size_t)(n - 1) * p->ssz, data, p->ssz)) )
+            return i;
+    }
+}
+
+// Adds a sector to the pool, returns the sector number
+static uint32_t pool_add(struct pool *p, const uint8_t *data, uint64_t h)
+{
+    uint32_t i = pool_slot(p, data, h);
+    if( p->table[i] )
+        return p->table[i];
+    if( p->num == UINT32_MAX - 1 )
+        show_error("%s: too many sectors in the pool.", p->file);
+    if( p->num == p->alloc )
+    {
+        p->alloc = p->alloc ? p->alloc * 2 : 4096;
+        p->data  = check_realloc(p->data, (size_t)p->alloc * p->ssz);
+        p->hash  = check_realloc(p->hash, (size_t)p->alloc * sizeof(uint64_t));
+    }
+    memcpy(p->data + (size_t)p->num * p->ssz, data, p->ssz);
+    p->hash[p->num++] = h;
+    p->table[i]       = p->num;
+    // Keep the table at most half full
+    if( p->num * 2 > p->mask )
+    {
+        free(p->table);
+        p->mask  = p->mask * 2 + 1;
+        p->table = check_calloc((size_t)p->mask + 1, sizeof(uint32_t));
+        for( uint32_t n = 0; n < p->num; n++ )
+            p->table[pool_slot(p, p->data + (size_t)n * p->ssz, p->hash[n])] = n + 1;
+    }
+    return p->num;
+}
+
+// Reads the existing pool file, if any
+static void pool_load(struct pool *p, const char *dir, unsigned ssz)
+{
+    p->ssz   = ssz;
+    p->file  = check_malloc(strlen(dir) + 32);
+    p->mask  = 1023;
+    p->table = check_calloc(p->mask + 1, sizeof(uint32_t));
+    sprintf(p->file, "%s/sectors-%u.pool", dir, ssz);
+
+    FILE *f = fopen(p->file, "rb");
+    if( !f )
+    {
+        if( errno != ENOENT )
+            show_error("can't open pool file '%s': %s", p->file, strerror(errno));
+        return;
+    }
+    uint8_t hdr[POOL_HDR];
+    if( POOL_HDR != fread(hdr, 1, POOL_HDR, f) || memcmp(hdr, "ATRP", 4) || hdr[4] != 1 ||
+        (hdr[6] | (hdr[7] << 8)) != ssz )
+        show_error("%s: invalid pool file.", p->file);
+    uint8_t *buf = check_malloc(ssz);
+    size_t len;
+    while( (len = fread(buf, 1, ssz, f)) == ssz )
+        pool_add(p, buf, sector_hash(buf, ssz));
+    if( ferror(f) || len )
+        show_error("%s: error reading pool file.", p->file);
+    if( p->num != (ftell(f) - POOL_HDR) / ssz )
+        show_error("%s: repeated sectors in pool file.", p->file);
+    p->saved = p->num;
+    free(buf);
+    fclose(f);
+}
+
+// Appends the new sectors to the pool file
+static void pool_save(struct pool *p)
+{
+    if( p->saved == p->num )
+        return;
+    FILE *f = fopen(p->file, p->saved ? "ab" : "wb");
+    if( !f )
+        show_error("can't open pool file '%s': %s", p->file, strerror(errno));
+    uint8_t hdr[POOL_HDR] = {'A', 'T', 'R', 'P', 1};
+    put16(hdr + 6, p->ssz);
+    size_t len = (size_t)(p->num - p->saved) * p->ssz;
+    if( (!p->saved && 1 != fwrite(hdr, POOL_HDR, 1, f)) ||
+        1 != fwrite(p->data + (size_t)p->saved * p->ssz, len, 1, f) || fclose(f) )
+        show_error("can't write pool file '%s': %s", p->file, strerror(errno));
+    p->saved = p->num;
+}
+
+static void pool_free(struct pool *p)
+{
+    free(p->file);
+    free(p->data);
+    free(p->hash);
+    free(p->table);
+}
+
+// One image being added
+struct simage
+{
+    const char *name;      // File name
+    char *recipe;          // Name of the recipe in the store
+    int skip;              // Recipe can't be written, the image is not loaded
+    struct atr_image *atr; // Loaded image
+    uint64_t *hash;        // Hash of each sector
+    int error;             // Error loading the image
+    int errnum;            // errno of the error
+};
+
+struct store
+{
+    struct simage *images;
+    int next;
+    int end;
+    size_t bytes; // Memory used by the images loaded in the batch
+    pthread_mutex_t lock;
+};
+
+// Loads the image and calculates the hashes of the sectors
+static void load_image(struct simage *si)
+{
+    if( si->skip )
+        return;
+    si->error = atr_load_file(&si->atr, si->name);
+    if( si->error )
+    {
+        si->errnum = errno;
+        si->atr    = 0;
+        return;
+    }
+    si->error = atr_load_all(si->atr);
+    if( si->error )
+    {
+        atr_free(si->atr);
+        si->atr = 0;
+        return;
+    }
+    unsigned ssz = si->atr->sec_size;
+    si->hash     = check_calloc(si->atr->sec_count, sizeof(uint64_t));
+    for( unsigned i = 0; i < si->atr->sec_count; i++ )
+        si->hash[i] = sector_hash(si->atr->data + (size_t)i * ssz, ssz);
+}
+
+static void *worker(void *arg)
+{
+    struct store *s = arg;
+    for( ;; )
+    {
+        pthread_mutex_lock(&s->lock);
+        int i = s->next < s->end && s->bytes < BATCH_BYTES ? s->next++ : -1;
+        pthread_mutex_unlock(&s->lock);
+        if( i < 0 )
+            return 0;
+        struct simage *si = &s->images[i];
+        load_image(si);
+        if( !si->atr )
+            continue;
+        pthread_mutex_lock(&s->lock);
+        s->bytes += (size_t)si->atr->sec_count * (si->atr->sec_size + sizeof(uint64_t));
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+// Name of the recipe in the store, the name of the image with the extension
+// replaced
+static char *recipe_name(const char *dir, const char *image)
+{
+    const char *base = image;
+    for( const char *p = image; *p; p++ )
+        if( is_separator(*p) )
+            base = p + 1;
+    const char *ext = strrchr(base, '.');
+    size_t len      = ext && ext != base ? (size_t)(ext - base) : strlen(base);
+    char *name      = check_malloc(strlen(dir) + len + 7);
+    sprintf(name, "%s/%.*s.atrs", dir, (int)len, base);
+    return name;
+}
+
+static int cmp_recipe(const void *a, const void *b)
+{
+    const struct simage *x = *(const struct simage *const *)a;
+    const struct simage *y = *(const struct simage *const *)b;
+    int c                  = strcmp(x->recipe, y->recipe);
+    return c ? c : x < y ? -1 : x > y;
+}
+
+// Skips the images that would overwrite a recipe, before adding any sectors to
+// the pools: repeated recipe names and, without "force", existing recipes.
+static void check_recipes(const char *dir, struct simage *images, int num, int force)
+{
+    struct simage **sorted = check_calloc(num, sizeof(struct simage *));
+    for( int i = 0; i < num; i++ )
+    {
+        images[i].recipe = recipe_name(dir, images[i].name);
+        sorted[i]        = &images[i];
+    }
+    qsort(sorted, num, sizeof(struct simage *), cmp_recipe);
+    for( int i = 1; i < num; i++ )
+        if( !strcmp(sorted[i]->recipe, sorted[i - 1]->recipe) )
+            sorted[i]->skip = 1;
+    free(sorted);
+    struct stat st;
+    for( int i = 0; i < num; i++ )
+        if( !force && !images[i].skip && !stat(images[i].recipe, &st) )
+            images[i].skip = 2;
+}
+
+// Statistics of the images added
+struct stats
+{
+    int images;
+    int errors;
+    unsigned long sectors;
+    unsigned long zero;
+    unsigned long repeated;
+    unsigned long bytes;
+    unsigned long stored;
+    unsigned long recipes;
+};
+
+// Adds the sectors of the image to the pool, returns the recipe
+static uint8_t *add_image(struct pool *pools, struct simage *si, size_t *len,
+                          struct stats *st)
+{
+    struct atr_image *atr = si->atr;
+    unsigned ssz          = atr->sec_size;
+    unsigned nsec         = atr->sec_count;
+    struct pool *p        = &pools[ssz == 128 ? 0 : ssz == 256 ? 1 : 2];
+    const char *pname     = strrchr(p->file, '/') + 1;
+    size_t nlen           = strlen(pname);
+    uint8_t *rec          = check_malloc(STORE_HDR + nlen + 4 * (size_t)nsec);
+    memcpy(rec, "ATRS", 4);
+    rec[4] = 1;
+    rec[5] = 0;
+    put16(rec + 6, ssz);
+    put32(rec + 8, nsec);
+    put16(rec + 12, atr->hdr_size);
+    put16(rec + 14, atr->first_size);
+    memcpy(rec + 16, atr->header, 16);
+    put32(rec + 32, adler32(1, atr->data, ssz * nsec));
+    put16(rec + 36, nlen);
+    memcpy(rec + STORE_HDR, pname, nlen);
+    uint8_t *refs = rec + STORE_HDR + nlen;
+    for( unsigned i = 0; i < nsec; i++ )
+    {
+        uint32_t n = 0, old = p->num;
+        if( si->hash[i] )
+            n = pool_add(p, atr->data + (size_t)i * ssz, si->hash[i]);
+        put32(refs + 4 * i, n);
+        if( !n )
+            st->zero++;
+        else if( n <= old )
+            st->repeated++;
+        else
+            st->stored += ssz;
+    }
+    st->images++;
+    st->sectors += nsec;
+    st->bytes += (size_t)ssz * nsec;
+    *len = STORE_HDR + nlen + 4 * (size_t)nsec;
+    return rec;
+}
+
+static int write_recipe(const char *name, const uint8_t *rec, size_t len, int force)
+{
+    FILE *f = fopen(name, force ? "wb" : "wbx");
+    if( !f )
+    {
+        show_msg("can't create recipe '%s': %s", name, strerror(errno));
+        return 1;
+    }
+    if( 1 != fwrite(rec, len, 1, f) || fclose(f) )
+        show_error("can't write recipe '%s': %s", name, strerror(errno));
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = 0;
+    int force       = 0;
+    int num         = 0;
+    struct store s;
+    s.images = check_calloc(argc, sizeof(struct simage));
+
+    prog_name = argv[0];
+    atr_set_msg_handler(msg_handler);
+    for( int i = 1; i < argc; i++ )
+    {
+        char *arg = argv[i];
+        if( arg[0] == '-' && arg[1] )
+        {
+            char op;
+            while( 0 != (op = *++arg) )
+            {
+                if( op == 'h' || op == '?' )
+                    show_usage();
+                else if( op == 'f' )
+                    force = 1;
+                else if( op == 'v' )
+                    show_version();
+                else
+                    show_opt_error("invalid command line option '-%c'", op);
+            }
+        }
+        else if( !dir )
+            dir = arg;
+        else
+            s.images[num++].name = arg;
+    }
+    if( !dir )
+        show_opt_error("missing store directory");
+    if( !num )
+        show_opt_error("missing image file name");
+    if( compat_mkdir(dir) && errno != EEXIST )
+        show_error("can't create store directory '%s': %s", dir, strerror(errno));
+
+    struct pool pools[3];
+    memset(pools, 0, sizeof(pools));
+    for( int i = 0; i < 3; i++ )
+        pool_load(&pools[i], dir, 128 << i);
+
+    struct stats st;
+    memset(&st, 0, sizeof(st));
+    check_recipes(dir, s.images, num, force);
+    uint8_t **recs = check_calloc(BATCH, sizeof(uint8_t *));
+    size_t *lens   = check_calloc(BATCH, sizeof(size_t));
+    long nthreads  = sysconf(_SC_NPROCESSORS_ONLN);
+    if( nthreads < 1 )
+        nthreads = 1;
+    pthread_t *th = check_calloc(nthreads, sizeof(pthread_t));
+    pthread_mutex_init(&s.lock, 0);
+    for( int b = 0; b < num; b = s.end )
+    {
+        // Load the images of the batch, the current thread also loads. The
+        // batch ends at the first image not started when the limit is reached.
+        s.next  = b;
+        s.end   = b + BATCH < num ? b + BATCH : num;
+        s.bytes = 0;
+        for( long i = 1; i < nthreads && i < s.end - b; i++ )
+            if( pthread_create(&th[i], 0, worker, &s) )
+                show_error("can't create threads: %s", strerror(errno));
+        worker(&s);
+        for( long i = 1; i < nthreads && i < s.end - b; i++ )
+            pthread_join(th[i], 0);
+        s.end = s.next;
+
+        // Add the sectors in order, so the store does not depend on the threads
+        for( int i = b; i < s.end; i++ )
+        {
+            struct simage *si = &s.images[i];
+            recs[i - b]       = 0;
+            if( si->skip == 1 )
+                show_msg("%s: recipe '%s' already used by other image.", si->name,
+                         si->recipe);
+            else if( si->skip )
+                show_msg("%s: recipe '%s' already exists, use -f to overwrite.", si->name,
+                         si->recipe);
+            else if( si->error == atr_err_open )
+                show_msg("can´t open disk image '%s': %s", si->name,
+                         strerror(si->errnum));
+            else if( si->error )
+                show_msg("%s: %s", si->name, atr_strerror(si->error));
+            else
+                recs[i - b] = add_image(pools, si, &lens[i - b], &st);
+            if( !recs[i - b] )
+                st.errors++;
+            atr_free(si->atr);
+            free(si->hash);
+        }
+        // Recipes are written after the sectors they use
+        for( int i = 0; i < 3; i++ )
+            pool_save(&pools[i]);
+        for( int i = b; i < s.end; i++ )
+        {
+            if( recs[i - b] )
+            {
+                if( write_recipe(s.images[i].recipe, recs[i - b], lens[i - b], force) )
+                    st.errors++;
+                else
+                    st.recipes += lens[i - b];
+                free(recs[i - b]);
+            }
+            free(s.images[i].recipe);
+        }
+    }
+    pthread_mutex_destroy(&s.lock);
+
+    unsigned long total = st.stored + st.recipes;
+    show_msg("%d images, %lu sectors: %lu zero, %lu repeated, %lu new.", st.images,
+             st.sectors, st.zero, st.repeated, st.sectors - st.zero - st.repeated);
+    show_msg("%lu bytes of sectors, stored %lu bytes (%lu in recipes), ratio %.2f:1.",
+             st.bytes, total, st.recipes, total ? (double)st.bytes / total : 0.0);
+    for( int i = 0; i < 3; i++ )
+    {
+        if( pools[i].num )
+            show_msg("%s: %u sectors.", pools[i].file, pools[i].num);
+        pool_free(&pools[i]);
+    }
+    free(th);
+    free(recs);
+    free(lens);
+    free(s.images);
+    return st.errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,145 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Converts ATR images to and from the compressed format.
+ */
+#include "atr.h"
+#include "compat.h"
+#include "msg.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void show_usage(void)
+{
+    printf("Usage: %s [options] <input_atr> <output_file>\n"
+           "Options:\n"
+           "\t-d\tDecompress, writing a standard ATR image.\n"
+           "\t-h\tShow this help.\n"
+           "\t-v\tShow version information.\n"
+           "\n"
+           "The input can be an ATR image, a raw disk image or a compressed image.\n"
+           "Use '-' as file name to read from standard input or write to standard\n"
+           "output.\n",
+           prog_name);
+    exit(EXIT_SUCCESS);
+}
+
+static void msg_handler(const char *msg)
+{
+    show_msg("%s", msg);
+}
+
+// Returns the image as an ATR file, with the same layout of the original
+static uint8_t *atr_file(const struct atr_image *atr, size_t *len)
+{
+    unsigned ssz = atr->sec_size, nsec = atr->sec_count, hdr = atr->hdr_size;
+    // The layout of the first sectors is lost in repaired images
+    unsigned first = atr->first_size ? atr->first_size : 128;
+    size_t size    = 3 * first + (size_t)(nsec - 3) * ssz;
+    uint8_t *buf   = check_malloc(hdr + size);
+    if( hdr )
+    {
+        memcpy(buf, atr->header, hdr);
+        buf[2] = size >> 4;
+        buf[3] = size >> 12;
+        buf[6] = size >> 20;
+    }
+    for( unsigned i = 0; i < nsec; i++ )
+        memcpy(buf + hdr + (i < 3 ? first * i : 3 * first + (size_t)(i - 3) * ssz),
+               atr->data + (size_t)i * ssz, i < 3 ? first : ssz);
+    *len = hdr + size;
+    return buf;
+}
+
+static void write_file(const char *name, const uint8_t *data, size_t len)
+{
+    FILE *f = stdout;
+    if( strcmp(name, "-") )
+        f = fopen(name, "wb");
+    else
+        compat_set_binary(stdout);
+    if( !f )
+        show_error("can't open output file '%s': %s", name, strerror(errno));
+    if( 1 != fwrite(data, len, 1, f) || (f == stdout ? fflush(f) : fclose(f)) )
+        show_error("can't write output file '%s': %s", name, strerror(errno));
+}
+
+int main(int argc, char **argv)
+{
+    const char *args[2];
+    int num        = 0;
+    int decompress = 0;
+
+    prog_name = argv[0];
+    atr_set_msg_handler(msg_handler);
+    for( int i = 1; i < argc; i++ )
+    {
+        char *arg = argv[i];
+        if( arg[0] == '-' && arg[1] )
+        {
+            char op;
+            while( 0 != (op = *++arg) )
+            {
+                if( op == 'h' || op == '?' )
+                    show_usage();
+                else if( op == 'd' )
+                    decompress = 1;
+                else if( op == 'v' )
+                    show_version();
+                else
+                    show_opt_error("invalid command line option '-%c'", op);
+            }
+        }
+        else if( num < 2 )
+            args[num++] = arg;
+        else
+            show_opt_error("too many arguments");
+    }
+    if( num != 2 )
+        show_opt_error("missing file name");
+
+    struct atr_image *atr;
+    int e;
+    if( !strcmp(args[0], "-") )
+    {
+        compat_set_binary(stdin);
+        e = atr_load_stream(&atr, stdin, "stdin");
+    }
+    else
+        e = atr_load_file(&atr, args[0]);
+    if( e == atr_err_open )
+        show_error("can´t open disk image '%s': %s", args[0], strerror(errno));
+    else if( !e )
+        e = atr_load_all(atr);
+    if( e )
+        show_error("%s: %s", args[0], atr_strerror(e));
+
+    uint8_t *data;
+    size_t len;
+    if( decompress )
+        data = atr_file(atr, &len);
+    else if( (e = atr_compress(atr, &data, &len)) )
+        show_error("%s: %s", args[0], atr_strerror(e));
+    show_msg("%s: %u sectors of %u bytes, written %zu bytes.", args[1], atr->sec_count,
+             atr->sec_size, len);
+    write_file(args[1], data, len);
+    free(data);
+    atr_free(atr);
+    return 0;
+}
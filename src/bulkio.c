@@ -0,0 +1,361 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Reads and writes many whole files, using io_uring when available.
+ */
+#include "bulkio.h"
+#include "msg.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// Maximum value of the "--io-depth" option
+#define MAX_DEPTH 1024
+
+static int use_uring = 0;  // Selected backend
+static int io_depth  = 32; // Files submitted at once
+
+int bulkio_option(int argc, char **argv, int i)
+{
+    if( strcmp(argv[i], "--io") && strcmp(argv[i], "--io-depth") )
+        return 0;
+    if( i + 1 >= argc )
+        show_opt_error("option '%s' needs an argument", argv[i]);
+    return 2;
+}
+
+void bulkio_parse_args(int argc, char **argv)
+{
+    for( int i = 1; i < argc; i++ )
+    {
+        if( !bulkio_option(argc, argv, i) )
+            continue;
+        const char *arg = argv[++i];
+        if( !strcmp(argv[i - 1], "--io-depth") )
+        {
+            char *ep;
+            io_depth = strtol(arg, &ep, 0);
+            if( io_depth < 1 || io_depth > MAX_DEPTH || !ep || *ep )
+                show_error("argument for option '--io-depth' must be from 1 to %d.",
+                           MAX_DEPTH);
+        }
+        else if( !strcmp(arg, "uring") )
+            use_uring = 1;
+        else if( !strcmp(arg, "sync") )
+            use_uring = 0;
+        else
+            show_opt_error("argument for option '--io' must be 'sync' or 'uring'");
+    }
+}
+
+int bulkio_batched(void)
+{
+    return use_uring;
+}
+
+int bulkio_depth(void)
+{
+    return use_uring ? io_depth : 1;
+}
+
+const char *bulkio_strerror(int err)
+{
+    if( err == BULKIO_SHORT )
+        return "file is shorter than expected";
+    return strerror(err);
+}
+
+// Reads or writes one file with plain system calls, returns the error. The file
+// is created if "excl" is 1 and truncated if 0.
+static int sync_file(struct bulkio_file *f, int wr, int excl)
+{
+    int flags = wr ? O_WRONLY | O_CREAT | (excl ? O_EXCL : O_TRUNC) : O_RDONLY;
+    int fd    = open(f->name, flags | O_BINARY, 0666);
+    if( fd < 0 )
+        return errno;
+    int err = 0;
+    for( size_t pos = 0; pos < f->size && !err; )
+    {
+        char *buf = (char *)f->data + pos;
+        ssize_t n = wr ? write(fd, buf, f->size - pos) : read(fd, buf, f->size - pos);
+        if( n > 0 )
+            pos += n;
+        else if( !n )
+            err = wr ? EIO : BULKIO_SHORT;
+        else if( errno != EINTR )
+            err = errno;
+    }
+    if( close(fd) && !err )
+        err = errno;
+    return err;
+}
+
+#ifdef HAVE_URING
+// The ring, mapped from the kernel
+struct uring
+{
+    int fd;
+    unsigned entries;
+    void *ring;
+    size_t ring_len;
+    struct io_uring_sqe *sqes;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+// State of each file, three operations are submitted linked: open, read or
+// write, and close, using a registered file slot.
+struct ufile
+{
+    int slot;
+    int done;   // Operations completed
+    int opened; // File was opened
+    int err;    //
+    size_t len; // Bytes read or written
+};
+
+static void uring_close(struct uring *u)
+{
+    if( u->sqes )
+        munmap(u->sqes, u->entries * sizeof(struct io_uring_sqe));
+    if( u->ring )
+        munmap(u->ring, u->ring_len);
+    close(u->fd);
+}
+
+// Creates the ring with "depth" registered file slots, returns 0 or an errno.
+static int uring_init(struct uring *u, int depth)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(u, 0, sizeof(*u));
+    u->fd = syscall(__NR_io_uring_setup, 3 * depth, &p);
+    if( u->fd < 0 )
+        return errno;
+    // Only kernels with a single mapping for both rings are supported
+    if( !(p.features & IORING_FEAT_SINGLE_MMAP) )
+    {
+        close(u->fd);
+        return ENOSYS;
+    }
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->entries    = p.sq_entries;
+    u->ring_len   = sq_len > cq_len ? sq_len : cq_len;
+    u->ring       = mmap(0, u->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         u->fd, IORING_OFF_SQ_RING);
+    if( u->ring == MAP_FAILED )
+    {
+        int e   = errno;
+        u->ring = 0;
+        uring_close(u);
+        return e;
+    }
+    u->sqes = mmap(0, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if( u->sqes == MAP_FAILED )
+    {
+        int e   = errno;
+        u->sqes = 0;
+        uring_close(u);
+        return e;
+    }
+    char *r     = u->ring;
+    u->sq_head  = (unsigned *)(r + p.sq_off.head);
+    u->sq_tail  = (unsigned *)(r + p.sq_off.tail);
+    u->sq_mask  = (unsigned *)(r + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(r + p.sq_off.array);
+    u->cq_head  = (unsigned *)(r + p.cq_off.head);
+    u->cq_tail  = (unsigned *)(r + p.cq_off.tail);
+    u->cq_mask  = (unsigned *)(r + p.cq_off.ring_mask);
+    u->cqes     = (struct io_uring_cqe *)(r + p.cq_off.cqes);
+
+    // Register the empty file slots
+    int *fds = check_malloc(depth * sizeof(int));
+    for( int i = 0; i < depth; i++ )
+        fds[i] = -1;
+    int e = syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_FILES, fds, depth);
+    free(fds);
+    if( e < 0 )
+    {
+        e = errno;
+        uring_close(u);
+        return e;
+    }
+    return 0;
+}
+
+// Returns a cleared entry at the tail of the submission queue
+static struct io_uring_sqe *uring_sqe(struct uring *u, unsigned *tail)
+{
+    unsigned idx             = *tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    (*tail)++;
+    return sqe;
+}
+
+// Adds the three operations of one file
+static void uring_queue(struct uring *u, struct bulkio_file *f, int n, int slot, int wr)
+{
+    unsigned tail = *u->sq_tail;
+    // Open into the file slot, the next operations are skipped on error
+    struct io_uring_sqe *sqe = uring_sqe(u, &tail);
+    sqe->opcode              = IORING_OP_OPENAT;
+    sqe->flags               = IOSQE_IO_LINK;
+    sqe->fd                  = AT_FDCWD;
+    sqe->addr                = (uintptr_t)f->name;
+    sqe->len                 = 0666;
+    sqe->open_flags          = wr ? O_WRONLY | O_CREAT | O_EXCL : O_RDONLY;
+    sqe->file_index          = slot + 1;
+    sqe->user_data           = (uint64_t)n << 2;
+    // Read or write, the slot is always closed after
+    sqe            = uring_sqe(u, &tail);
+    sqe->opcode    = wr ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->flags     = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+    sqe->fd        = slot;
+    sqe->addr      = (uintptr_t)f->data;
+    sqe->len       = f->size;
+    sqe->user_data = (uint64_t)n << 2 | 1;
+    // Close
+    sqe             = uring_sqe(u, &tail);
+    sqe->opcode     = IORING_OP_CLOSE;
+    sqe->file_index = slot + 1;
+    sqe->user_data  = (uint64_t)n << 2 | 2;
+    __atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE);
+}
+
+// Processes all the files, keeping up to "depth" files in flight. Files with
+// errors are marked, to be retried with plain system calls.
+static void uring_run(struct uring *u, struct bulkio_file *files, int num, int depth,
+                      int wr)
+{
+    struct ufile *st = check_calloc(num, sizeof(struct ufile));
+    int *slots       = check_malloc(depth * sizeof(int));
+    int nfree = depth, next = 0, active = 0;
+    for( int i = 0; i < depth; i++ )
+        slots[i] = depth - 1 - i;
+
+    while( next < num || active )
+    {
+        for( ; next < num && nfree; next++, active++ )
+        {
+            st[next].slot = slots[--nfree];
+            uring_queue(u, &files[next], next, st[next].slot, wr);
+        }
+        // Submit all the entries not consumed yet, and wait for one completion
+        unsigned pending = *u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+        if( 0 > syscall(__NR_io_uring_enter, u->fd, pending, 1, IORING_ENTER_GETEVENTS, 0,
+                        0) &&
+            errno != EINTR )
+            show_error("io_uring error: %s", strerror(errno));
+
+        // Process the completions
+        unsigned head = *u->cq_head;
+        unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+        for( ; head != tail; head++ )
+        {
+            struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+            struct ufile *s          = &st[cqe->user_data >> 2];
+            int op = cqe->user_data & 3, res = cqe->res;
+            if( res >= 0 && op == 0 )
+                s->opened = 1;
+            else if( res >= 0 && op == 1 )
+                s->len = res;
+            else if( res < 0 && !s->err )
+                s->err = -res;
+            if( ++s->done == 3 )
+            {
+                slots[nfree++] = s->slot;
+                active--;
+            }
+        }
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    // Complete the short or failed files with plain system calls, to also
+    // get the same errors
+    for( int i = 0; i < num; i++ )
+    {
+        if( st[i].err || st[i].len != files[i].size )
+            files[i].err = sync_file(&files[i], wr, !st[i].opened);
+        else
+            files[i].err = 0;
+    }
+    free(slots);
+    free(st);
+}
+#endif
+
+static void bulk_run(struct bulkio_file *files, int num, int wr)
+{
+#ifdef HAVE_URING
+    // The ring is created at the first use and kept open
+    static struct uring ring;
+    static int ring_state; // 0 = not created, 1 = ok, -1 = not available
+    if( use_uring && !ring_state && num )
+    {
+        int e = uring_init(&ring, io_depth);
+        if( e )
+            show_msg("io_uring not available, %s, using plain system calls.",
+                     strerror(e));
+        ring_state = e ? -1 : 1;
+    }
+    if( use_uring && ring_state > 0 )
+    {
+        uring_run(&ring, files, num, io_depth, wr);
+        return;
+    }
+#else
+    static int warned;
+    if( use_uring && !warned && num )
+    {
+        show_msg("io_uring not available, using plain system calls.");
+        warned = 1;
+    }
+#endif
+    for( int i = 0; i < num; i++ )
+        files[i].err = sync_file(&files[i], wr, 1);
+}
+
+void bulkio_read(struct bulkio_file *files, int num)
+{
+    bulk_run(files, num, 0);
+}
+
+void bulkio_write(struct bulkio_file *files, int num)
+{
+    bulk_run(files, num, 1);
+}
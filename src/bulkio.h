@@ -0,0 +1,53 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Reads and writes many whole files, with the "--io" and "--io-depth" options.
+ *
+ * The default backend uses plain system calls, one file after the other. The
+ * "uring" backend submits the open, read or write and close of many files at
+ * once with io_uring, falling back to plain system calls if not available.
+ */
+#pragma once
+#include <stddef.h>
+
+// Error returned when a file is shorter than expected
+#define BULKIO_SHORT -1
+
+// One file to read or write
+struct bulkio_file
+{
+    const char *name;
+    void *data;  // Buffer of "size" bytes
+    size_t size; //
+    int err;     // Result, 0, an errno value or BULKIO_SHORT
+};
+
+// Returns the number of arguments used by the "--io" or "--io-depth" options,
+// 0 if the argument is not one of the options.
+int bulkio_option(int argc, char **argv, int i);
+// Selects the backend with the "--io" and "--io-depth" options in the command line.
+void bulkio_parse_args(int argc, char **argv);
+// Returns 1 if the "uring" backend was selected, files should be given in batches.
+int bulkio_batched(void);
+// Number of files to give in each batch, from the "--io-depth" option
+int bulkio_depth(void);
+// Returns a description of the "err" field
+const char *bulkio_strerror(int err);
+// Reads all the files, "size" bytes each.
+void bulkio_read(struct bulkio_file *files, int num);
+// Creates all the files, that must not exist, writing "size" bytes each.
+void bulkio_write(struct bulkio_file *files, int num);
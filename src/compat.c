@@ -17,7 +17,12 @@
 /*
  * Common compatibility functions.
  */
+#include "compat.h"
 #include <sys/stat.h>
+#if( defined(_WIN32) || defined(__WIN32__) )
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 int compat_mkdir(const char *path)
 {
@@ -36,3 +41,12 @@ int is_separator(char c)
     return c == '/';
 #endif
 }
+
+void compat_set_binary(FILE *f)
+{
+#if( defined(_WIN32) || defined(__WIN32__) )
+    _setmode(_fileno(f), _O_BINARY);
+#else
+    (void)f;
+#endif
+}
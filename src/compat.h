@@ -18,9 +18,13 @@
  * Common compatibility functions.
  */
 #pragma once
+#include <stdio.h>
 
 // Checks if given character is a PATH separator
 int is_separator(char c);
 
 // Wrapper for mkdir
 int compat_mkdir(const char *path);
+
+// Sets binary mode in the standard streams
+void compat_set_binary(FILE *f);
@@ -16,35 +16,40 @@
  */
 
 #include "darray.h"
-#include "msg.h"
-#include <stdio.h>
 
-void darray_fill_ptr(void *arr, size_t sz, size_t init)
+int darray_fill_ptr(void *arr, size_t sz, size_t init)
 {
     darray(char) *ret = arr;
-    if( !ret )
-        memory_error();
-    ret->data = check_malloc(sz * init);
-    ret->len  = 0;
-    ret->size = init;
+    ret->data         = malloc(sz * init);
+    ret->len          = 0;
+    ret->size         = init;
+    return ret->data ? 0 : -1;
 }
 
 void *darray_alloc(size_t sz, size_t init)
 {
-    darray(char) *ret = check_malloc(sizeof(darray(char)));
-    darray_fill_ptr(ret, sz, init);
+    darray(char) *ret = malloc(sizeof(darray(char)));
+    if( ret && darray_fill_ptr(ret, sz, init) )
+    {
+        free(ret);
+        ret = 0;
+    }
     return ret;
 }
 
-void darray_grow(void *arr, size_t sz, size_t newsize)
+int darray_grow(void *arr, size_t sz, size_t newsize)
 {
     darray(char) *p = arr;
     while( newsize > p->size )
     {
-        p->size *= 2;
-        if( !p->size || !(p->data = check_realloc(p->data, sz * p->size)) )
-            memory_error();
+        size_t size = p->size ? p->size * 2 : 1;
+        char *data  = realloc(p->data, sz * size);
+        if( !data )
+            return -1;
+        p->data = data;
+        p->size = size;
     }
+    return 0;
 }
 
 void darray_free(void *arr)
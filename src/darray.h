@@ -32,30 +32,30 @@
 #define darray(type) darray_struct(type, )
 
 // Internal interface - don't call those directly.
-void darray_fill_ptr(void *, size_t, size_t);
+int darray_fill_ptr(void *, size_t, size_t);
 void *darray_alloc(size_t, size_t);
-void darray_grow(void *, size_t, size_t);
+int darray_grow(void *, size_t, size_t);
 void darray_delete_ptr(void *);
 
-// Allocate a new dynamic array of the given type with the given initial size
+// Allocate a new dynamic array of the given type with the given initial size,
+// returns NULL if there is not enough memory.
 #define darray_new(type, init_size) darray_alloc(sizeof(type), init_size)
 // Frees a dynamic array allocated with darray_new()
 void darray_free(void *);
 
-// Initialize an already allocated dynamic array with the given initial size
+// Initialize an already allocated dynamic array with the given initial size,
+// returns -1 if there is not enough memory.
 #define darray_init(arr, init_size)                                                      \
     darray_fill_ptr(&(arr), sizeof((arr).data[0]), init_size)
 // Deallocates memory for a dynamic array initialized with darray_init()
 #define darray_delete(arr) darray_delete_ptr(&(arr))
 
-// Adds one element "val" to the dynamic array "arr".
+// Adds one element "val" to the dynamic array "arr", returns -1 if there is
+// not enough memory.
 #define darray_add(arr, val)                                                             \
-    do                                                                                   \
-    {                                                                                    \
-        darray_grow((arr), sizeof((arr)->data[0]), (arr)->len + 1);                      \
-        (arr)->data[(arr)->len] = val;                                                   \
-        (arr)->len++;                                                                    \
-    } while( 0 )
+    (darray_grow((arr), sizeof((arr)->data[0]), (arr)->len + 1)                          \
+         ? -1                                                                            \
+         : ((arr)->data[(arr)->len++] = (val), 0))
 
 // Returns the current length (number of elements) of the dynamic array.
 #define darray_len(arr) ((arr)->len)
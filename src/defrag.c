@@ -0,0 +1,175 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Rewrites a SpartaDOS image with all files contiguous.
+ */
+#include "defrag.h"
+#include "atrfs.h"
+#include "msg.h"
+#include "spartafs.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Maximum directory depth, as in atrfs_walk()
+#define MAX_DEPTH 32
+
+// State of the image read
+struct defrag
+{
+    struct atrfs *fs;
+    file_list flist;
+    unsigned boot_map;                 // Sector map of the boot file
+    struct afile *dirs[MAX_DEPTH + 1]; // Current directory at each level
+};
+
+static unsigned read16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+// Adds each entry to the file list, with the original date and attributes
+static int add_entry(void *ctx, const char *path, const struct atrfs_entry *entry)
+{
+    struct defrag *d = ctx;
+    int level        = 0;
+    for( const char *p = path; *p; p++ )
+        level += *p == '/';
+    if( level > MAX_DEPTH )
+        show_error("%s: directory too deep.", path);
+
+    struct afile *f = check_calloc(1, sizeof(struct afile));
+    f->fname        = (char *)entry->name;
+    f->dir          = d->dirs[level - 1];
+    f->is_dir       = entry->is_dir;
+    f->attribs      = entry->attribs & (at_protected | at_hidden | at_archived);
+    f->boot_file    = !entry->is_dir && entry->sector == d->boot_map;
+    memcpy(f->date, entry->date, 3);
+    memcpy(f->time, entry->time, 3);
+    if( !entry->is_dir )
+    {
+        f->size = entry->size;
+        f->data = check_malloc(entry->size + 1);
+        int len = atrfs_read_file(d->fs, entry, (uint8_t *)f->data, entry->size);
+        if( len < 0 || (unsigned)len != entry->size )
+            show_error("%s: can't read file.", path);
+    }
+    int e = flist_add(&d->flist, f);
+    if( e )
+        show_error("%s: %s", path, mkimage_strerror(e));
+    if( entry->is_dir )
+        d->dirs[level] = f;
+    return 0;
+}
+
+// Writes the new image to a temporary file and replaces the original
+static void write_image(const char *file_name, const struct sfs *sfs)
+{
+    int size      = sfs_get_atr_size(sfs) + 16;
+    uint8_t *data = check_malloc(size);
+    sfs_write_atr(sfs, data);
+
+    char *tmp = check_malloc(strlen(file_name) + 8);
+    sprintf(tmp, "%s.tmp", file_name);
+    FILE *f = fopen(tmp, "wb");
+    if( !f )
+        show_error("can't create file '%s': %s", tmp, strerror(errno));
+    if( 1 != fwrite(data, size, 1, f) || fclose(f) )
+    {
+        remove(tmp);
+        show_error("can't write file '%s': %s", tmp, strerror(errno));
+    }
+    if( rename(tmp, file_name) )
+    {
+        remove(tmp);
+        show_error("can't replace file '%s': %s", file_name, strerror(errno));
+    }
+    free(tmp);
+    free(data);
+}
+
+void defrag_image(const char *file_name, int trim)
+{
+    struct atr_image *atr;
+    struct defrag d;
+    int e = atr_load_file(&atr, file_name);
+    if( e == atr_err_open )
+        show_error("%s: %s: %s", file_name, atr_strerror(e), strerror(errno));
+    else if( e )
+        show_error("%s: %s", file_name, atr_strerror(e));
+    if( atr->zip || atr->stored )
+        show_error("%s: %s", file_name, atr_strerror(atr_err_read_only));
+    e = atrfs_open(&d.fs, atr, 0);
+    if( e )
+        show_error("%s: %s", file_name, atr_strerror(e));
+    if( d.fs->info.type != atrfs_sparta )
+        show_error("%s: only SpartaDOS images can be defragmented.", file_name);
+
+    // Read all files, keeping the date of the main directory
+    const uint8_t *boot = atr_data(atr, 1);
+    d.boot_map          = read16(boot + 40);
+    if( darray_init(d.flist, 1) || flist_add_main_dir(&d.flist) )
+        memory_error();
+    d.dirs[0]             = d.flist.data[0];
+    const uint8_t *map    = atr_data(atr, d.fs->root.sector);
+    const uint8_t *header = map ? atr_data(atr, read16(map + 4)) : 0;
+    if( header )
+    {
+        memcpy(d.dirs[0]->date, header + 17, 3);
+        memcpy(d.dirs[0]->time, header + 20, 3);
+    }
+    e = atrfs_walk(d.fs, add_entry, &d);
+    if( e )
+        show_error("%s: %s", file_name, atr_strerror(e));
+
+    // Build with the same geometry, then reduce the size until the free
+    // sectors are 0.
+    int ssec = atr->sec_size, nsec = atr->sec_count;
+    struct sfs *sfs;
+    e = build_spartafs(&sfs, ssec, nsec, 0x07, &d.flist);
+    while( !e && trim && sfs_get_free_sectors(sfs) > 0 )
+    {
+        struct sfs *n;
+        int e2 = build_spartafs(&n, ssec, nsec - sfs_get_free_sectors(sfs), 0x07, &d.flist);
+        if( e2 )
+            break;
+        nsec = sfs_get_num_sectors(n);
+        sfs_free(sfs);
+        sfs = n;
+    }
+    if( e )
+        show_error("%s: %s", file_name, mkimage_strerror(e));
+
+    // Keep the original boot code and volume name, only the file-system
+    // fields of the first sector are updated.
+    uint8_t *data  = sfs_get_data(sfs);
+    unsigned bsize = ssec == 512 ? 512 : 128;
+    memcpy(data, boot, 7);
+    memcpy(data + 22, boot + 22, 8);
+    memcpy(data + 48, boot + 48, bsize - 48);
+    memcpy(data + ssec, atr_data(atr, 2), bsize);
+    memcpy(data + 2 * ssec, atr_data(atr, 3), bsize);
+
+    show_msg("writing image with %d sectors of %d bytes, %d free.", nsec, ssec,
+             sfs_get_free_sectors(sfs));
+    write_image(file_name, sfs);
+    sfs_free(sfs);
+    flist_free(&d.flist);
+    atrfs_close(d.fs);
+    atr_free(atr);
+}
@@ -0,0 +1,25 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Rewrites a SpartaDOS image with all files contiguous.
+ */
+#pragma once
+
+// Rebuilds the image, placing the map and data of each file in contiguous
+// sectors. If "trim" is set, the image is reduced to the minimum number of
+// sectors, else the geometry is kept.
+void defrag_image(const char *file_name, int trim);
@@ -30,5 +30,6 @@ static struct
                {256, 8192},  //  8192 sectors of 256 bytes,   2M (hard disk)
                {256, 16384}, // 16384 sectors of 256 bytes,   4M (hard disk)
                {256, 32768}, // 32768 sectors of 256 bytes,   8M (hard disk)
-               {256, 65535}, // 65536 sectors of 256 bytes,  16M (biggest possible image)
+               {256, 65535}, // 65535 sectors of 256 bytes,  16M (hard disk)
+               {512, 65535}, // 65535 sectors of 512 bytes,  32M (biggest possible image)
                {0, 0}};
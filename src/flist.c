@@ -18,28 +18,8 @@
  * Manages the list of files & directories
  */
 #include "flist.h"
-#include "msg.h"
-#include <errno.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <time.h>
-#include <unistd.h>
-
-static char *read_file(const char *fname, size_t size)
-{
-    char *data;
-    FILE *f = fopen(fname, "rb");
-    if( !f )
-        show_error("can't open file '%s': %s", fname, strerror(errno));
-    data = check_malloc(size);
-    if( size != fread(data, 1, size, f) )
-        show_error("error reading file '%s': %s", fname, strerror(errno));
-    fclose(f);
-    return data;
-}
 
 // Checks if given character is a PATH separator
 static int is_separator(char c)
@@ -51,12 +31,12 @@ static int is_separator(char c)
 #endif
 }
 
-static char *atari_name(const char *fname)
+char *flist_atari_name(const char *fname)
 {
     // Convert to 8+3 filename
     char *out = strdup("           ");
     if( !out )
-        memory_error();
+        return 0;
 
     // Search last part of filename (similar to "basename")
     const char *in, *p;
@@ -104,7 +84,9 @@ static char *atari_name(const char *fname)
 static char *path_name(const char *dir, const char *name)
 {
     size_t n  = strlen(dir);
-    char *ret = check_malloc(n + 14);
+    char *ret = malloc(n + 14);
+    if( !ret )
+        return 0;
     strcpy(ret, dir);
     ret[n++] = '>';
     int i;
@@ -121,111 +103,144 @@ static char *path_name(const char *dir, const char *name)
     return ret;
 }
 
-void flist_add_main_dir(file_list *flist)
+void flist_set_time(struct afile *f, time_t t)
 {
-    // Creates MAIN directory
-    struct afile *dir = check_malloc(sizeof(struct afile));
     // Convert time to broken time
-    time_t ttim    = time(0);
-    struct tm *tim = localtime(&ttim);
-
-    dir->date[0]   = tim->tm_mday;
-    dir->date[1]   = tim->tm_mon + 1;
-    dir->date[2]   = tim->tm_year % 100;
-    dir->time[0]   = tim->tm_hour;
-    dir->time[1]   = tim->tm_min;
-    dir->time[2]   = tim->tm_sec;
-    dir->fname     = "";
-    dir->aname     = "MAIN       ";
-    dir->pname     = "";
+    struct tm tm_buf;
+#if( defined(_WIN32) || defined(__WIN32__) )
+    struct tm *tim = localtime(&t);
+    if( tim )
+        tm_buf = *tim;
+#else
+    localtime_r(&t, &tm_buf);
+#endif
+    f->date[0] = tm_buf.tm_mday;
+    f->date[1] = tm_buf.tm_mon + 1;
+    f->date[2] = tm_buf.tm_year % 100;
+    f->time[0] = tm_buf.tm_hour;
+    f->time[1] = tm_buf.tm_min;
+    f->time[2] = tm_buf.tm_sec;
+}
+
+static void free_entry(struct afile *f)
+{
+    free(f->fname);
+    free(f->aname);
+    free(f->pname);
+    free(f->data);
+    free(f);
+}
+
+int flist_add_main_dir(file_list *flist)
+{
+    // Creates MAIN directory
+    struct afile *dir = calloc(1, sizeof(struct afile));
+    if( !dir )
+        return mkimage_err_memory;
+    flist_set_time(dir, time(0));
+    dir->fname     = strdup("");
+    dir->aname     = strdup("MAIN       ");
+    dir->pname     = strdup("");
     dir->dir       = 0;
     dir->size      = 23;
     dir->is_dir    = 1;
     dir->boot_file = 0;
-    dir->data      = check_malloc(SFS_MAX_DIR_SIZE);
+    dir->data      = malloc(SFS_MAX_DIR_SIZE);
     dir->level     = 0;
 
-    darray_add(flist, dir);
+    if( !dir->fname || !dir->aname || !dir->pname || !dir->data ||
+        darray_add(flist, dir) )
+    {
+        free_entry(dir);
+        return mkimage_err_memory;
+    }
+    return mkimage_ok;
 }
 
-void flist_add_file(file_list *flist, const char *fname, int boot_file,
-                    enum fattr attribs)
+struct afile *flist_find(const file_list *flist, const struct afile *dir,
+                         const char *aname)
 {
-    struct stat st;
-
-    if( 0 != stat(fname, &st) )
-        show_error("reading input file '%s': %s", fname, strerror(errno));
-
-    if( S_ISREG(st.st_mode) || S_ISDIR(st.st_mode) )
+    struct afile **ptr;
+    darray_foreach(ptr, flist)
     {
-        struct afile *f = check_malloc(sizeof(struct afile));
+        struct afile *af = *ptr;
+        if( af->dir == dir && !strncmp(af->aname, aname, 11) )
+            return af;
+    }
+    return 0;
+}
 
-        // Search in the file list if the path is inside an added directory
-        struct afile *dir = 0, **ptr;
-        darray_foreach(ptr, flist)
+int flist_add(file_list *flist, struct afile *f)
+{
+    struct afile *dir = f->dir;
+    char *dir_data    = 0;
+    int err           = mkimage_err_memory;
+
+    f->fname = strdup(f->fname);
+    f->aname = f->fname ? flist_atari_name(f->fname) : 0;
+    f->pname = f->aname ? path_name(dir->pname, f->aname) : 0;
+    f->level = dir->level + 1;
+    if( !f->pname )
+        goto error;
+
+    err = mkimage_err_name;
+    if( !strcmp(f->aname, "           ") )
+        goto error;
+
+    // Search for repeated files, and count files in the same directory
+    int num = 0;
+    struct afile **ptr;
+    darray_foreach(ptr, flist)
+    {
+        struct afile *af = *ptr;
+        if( af->dir == dir )
         {
-            struct afile *af = *ptr;
-            if( af->is_dir && fname == strstr(fname, af->fname) &&
-                (!dir || strlen(dir->fname) < strlen(af->fname)) )
-                dir = af;
+            err = mkimage_err_repeated;
+            if( !strncmp(af->aname, f->aname, 11) )
+                goto error;
+            num++;
         }
+    }
+    // Check directory size, including the header entry
+    err = mkimage_err_dir_full;
+    if( 23 * (num + 2) > SFS_MAX_DIR_SIZE )
+        goto error;
 
-        if( !dir )
-            show_error("internal error - no main directory");
-
-        // Convert time to broken time
-        struct tm *tim = localtime(&st.st_mtime);
-
-        f->date[0] = tim->tm_mday;
-        f->date[1] = tim->tm_mon + 1;
-        f->date[2] = tim->tm_year % 100;
-        f->time[0] = tim->tm_hour;
-        f->time[1] = tim->tm_min;
-        f->time[2] = tim->tm_sec;
-        f->fname   = fname;
-        f->aname   = atari_name(fname);
-        f->pname   = path_name(dir->pname, f->aname);
-        f->dir     = dir;
-        f->level   = dir->level + 1;
-        f->attribs = attribs;
-
-        if( !f->aname || !strcmp(f->aname, "           ") )
-            show_error("can't add file/directory named '%s'", fname);
-
-        // Search for repeated files
-        darray_foreach(ptr, flist)
-        {
-            struct afile *af = *ptr;
-            if( af->dir == f->dir && !strncmp(af->aname, f->aname, 11) )
-                show_error("repeated file/directory named '%s'", f->pname);
-        }
+    err = mkimage_err_too_big;
+    if( !f->is_dir && f->size > SFS_MAX_FILE_SIZE )
+        goto error;
 
-        if( S_ISDIR(st.st_mode) )
-        {
-            f->size      = 23;
-            f->is_dir    = 1;
-            f->boot_file = 0;
-            f->data      = check_malloc(SFS_MAX_DIR_SIZE);
+    err = mkimage_err_memory;
+    if( f->is_dir )
+    {
+        dir_data = malloc(SFS_MAX_DIR_SIZE);
+        if( !dir_data )
+            goto error;
+        f->size      = 23;
+        f->boot_file = 0;
+        f->data      = dir_data;
+    }
+    if( darray_add(flist, f) )
+        goto error;
+    return mkimage_ok;
+
+error:
+    free(f->fname);
+    free(f->aname);
+    free(f->pname);
+    free(dir_data);
+    if( dir_data )
+        f->data = 0;
+    f->fname = f->aname = f->pname = 0;
+    return err;
+}
 
-            show_msg("added dir  '%-20s', from '%s'.", f->pname, f->fname);
-        }
-        else
-        {
-            if( st.st_size > 0x1000000 )
-                show_error("file size too big '%s'", fname);
-
-            f->size      = st.st_size;
-            f->is_dir    = 0;
-            f->boot_file = boot_file;
-            f->data      = read_file(f->fname, f->size);
-
-            show_msg("added file '%-20s', %5ld bytes, from '%s'%s%s%s%s.", f->pname,
-                     (long)f->size, f->fname, attribs & at_protected ? ", +p" : "",
-                     attribs & at_hidden ? ", +h" : "",
-                     attribs & at_archived ? ", +a" : "", boot_file ? ", (boot)" : "");
-        }
-        darray_add(flist, f);
+void flist_free(file_list *flist)
+{
+    struct afile **ptr;
+    darray_foreach(ptr, flist)
+    {
+        free_entry(*ptr);
     }
-    else
-        show_error("invalid file type '%s'", fname);
+    darray_delete(*flist);
 }
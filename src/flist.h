@@ -20,23 +20,28 @@
 #pragma once
 
 #include "darray.h"
+#include "mkimage.h"
+#include <time.h>
 
 /* File attributes */
 enum fattr
 {
-    at_protected = 1,
-    at_hidden    = 2,
-    at_archived  = 4
+    at_protected = mkimage_protected,
+    at_hidden    = mkimage_hidden,
+    at_archived  = mkimage_archived
 };
 
 /* One file or directory */
 struct afile
 {
-    const char *fname;
-    const char *aname;
-    const char *pname; // Full path name
+    char *fname;
+    char *aname;
+    char *pname; // Full path name
     char *data;
     size_t size;
+    // Reads the file data when "data" is NULL, "len" bytes at "pos" into "buf",
+    // called with "buf" NULL after the last read. Returns 0 if ok.
+    int (*read_data)(struct afile *f, void *buf, size_t pos, size_t len);
     struct afile *dir; // Parent directory
     int level;         // Level inside directory structure, 0 = root
     int is_dir;
@@ -50,8 +55,22 @@ struct afile
 /* Max directory size in bytes, 32kb */
 #define SFS_MAX_DIR_SIZE 32768
 
+/* Max file size, 16MB */
+#define SFS_MAX_FILE_SIZE 0x1000000
+
 typedef darray(struct afile *) file_list;
 
-void flist_add_main_dir(file_list *flist);
-void flist_add_file(file_list *flist, const char *fname, int boot_file,
-                    enum fattr attribs);
+int flist_add_main_dir(file_list *flist);
+// Returns the Atari 8+3 name of the last component of the path, in a new buffer
+char *flist_atari_name(const char *fname);
+// Adds a new entry inside the directory "f->dir", the Atari name and full path
+// name are generated from "f->fname", that is copied. Returns 0 or an error code,
+// on success the list owns the entry and its data.
+int flist_add(file_list *flist, struct afile *f);
+// Search an entry inside a directory, by Atari name
+struct afile *flist_find(const file_list *flist, const struct afile *dir,
+                         const char *aname);
+// Sets date and time of the entry
+void flist_set_time(struct afile *f, time_t t);
+// Frees all entries in the list
+void flist_free(file_list *flist);
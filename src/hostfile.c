@@ -0,0 +1,493 @@
+/*
+ *  Copyright (C) 2016 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Adds files from the host file-system or from ATR images to the list of files.
+ */
+#include "hostfile.h"
+#include "atrfs.h"
+#include "bulkio.h"
+#include "compat.h"
+#include "msg.h"
+#include "stats.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// File open by read_data() and the description of the last error, kept per
+// thread as images can be built in parallel.
+static _Thread_local int cur_fd = -1;
+static _Thread_local const struct afile *cur;
+static _Thread_local char read_error[512];
+
+const char *flist_read_error(void)
+{
+    return read_error;
+}
+
+// Closes the current file
+static void close_current(void)
+{
+    if( cur_fd >= 0 )
+        close(cur_fd);
+    cur_fd = -1;
+    cur    = 0;
+}
+
+// Closes the current file, returns the error to the builder
+static int read_failed(const struct afile *f, const char *msg)
+{
+    snprintf(read_error, sizeof(read_error), "error reading file '%s': %s", f->fname,
+             msg);
+    close_current();
+    return mkimage_err_read;
+}
+
+// Reads "len" bytes at "pos", returns the number of bytes read or -1 on error
+static ssize_t read_at(int fd, void *buf, size_t pos, size_t len)
+{
+    size_t done = 0;
+    while( done < len )
+    {
+        ssize_t n = pread(fd, (char *)buf + done, len - done, pos + done);
+        if( n < 0 && errno == EINTR )
+            continue;
+        if( n < 0 )
+            return -1;
+        if( !n )
+            break;
+        done += n;
+    }
+    return done;
+}
+
+// Reads the data of regular files when building the image, directly to the
+// image sectors. The file is opened at the first read and closed after the last.
+static int read_data(struct afile *f, void *buf, size_t pos, size_t len)
+{
+    if( !buf )
+    {
+        close_current();
+        return 0;
+    }
+    int e = 0;
+    stats_begin(stats_read);
+    if( cur != f )
+    {
+        close_current();
+        cur_fd = open(f->fname, O_RDONLY | O_BINARY);
+        cur    = f;
+        if( cur_fd < 0 )
+            e = read_failed(f, strerror(errno));
+    }
+    if( !e )
+    {
+        uint8_t extra;
+        ssize_t n = read_at(cur_fd, buf, pos, len);
+        if( n < 0 )
+            e = read_failed(f, strerror(errno));
+        else if( (size_t)n != len )
+            e = read_failed(f, "file is shorter than expected");
+        // At the end, check that the file did not grow after it was added
+        else if( pos + len == f->size && (n = read_at(cur_fd, &extra, f->size, 1)) )
+            e = read_failed(f, n < 0 ? strerror(errno) : "file is longer than expected");
+    }
+    stats_end(stats_read);
+    if( !e )
+        stats_add(stats_bytes_read, len);
+    return e;
+}
+
+// Reads a stream of unknown size, a pipe or FIFO, until the end
+static char *read_stream(FILE *f, const char *fname, size_t *size)
+{
+    size_t len = 0, alloc = 65536;
+    char *data = check_malloc(alloc);
+    for( ;; )
+    {
+        size_t n = fread(data + len, 1, alloc - len, f);
+        len += n;
+        if( len > SFS_MAX_FILE_SIZE )
+            show_error("file size too big '%s'", fname);
+        if( len < alloc )
+            break;
+        alloc *= 2;
+        data = check_realloc(data, alloc);
+    }
+    if( ferror(f) )
+        show_error("error reading file '%s': %s", fname, strerror(errno));
+    *size = len;
+    stats_add(stats_bytes_read, len);
+    return data;
+}
+
+// Searches in the file list if the path is inside an added directory
+static struct afile *parent_dir(file_list *flist, const char *fname)
+{
+    struct afile *dir = 0, **ptr;
+    darray_foreach(ptr, flist)
+    {
+        struct afile *af = *ptr;
+        if( af->is_dir && fname == strstr(fname, af->fname) &&
+            (!dir || strlen(dir->fname) < strlen(af->fname)) )
+            dir = af;
+    }
+    return dir;
+}
+
+// Adds one entry inside "dir", or if NULL the directory is searched using
+// "fname". The "fname" is also used to get the Atari name, "from" is shown in
+// the messages.
+static struct afile *add_entry(file_list *flist, struct afile *dir, const char *fname,
+                               const char *from, int is_dir, char *data, size_t size,
+                               time_t mtime, int boot_file, enum fattr attribs)
+{
+    if( !dir )
+        dir = parent_dir(flist, fname);
+
+    if( !dir )
+        show_error("internal error - no main directory");
+
+    struct afile *f = check_calloc(1, sizeof(struct afile));
+    flist_set_time(f, mtime);
+    f->fname   = (char *)fname;
+    f->dir     = dir;
+    f->attribs = attribs;
+    f->is_dir  = is_dir;
+    if( !is_dir )
+    {
+        f->size      = size;
+        f->boot_file = boot_file;
+        f->data      = data;
+        // Files without data are read when building the image
+        if( !data )
+            f->read_data = read_data;
+    }
+
+    stats_add(is_dir ? stats_dirs : stats_files, 1);
+    int e = flist_add(flist, f);
+    if( e == mkimage_err_name )
+        show_error("can't add file/directory named '%s'", from);
+    else if( e == mkimage_err_repeated )
+    {
+        char *aname       = flist_atari_name(fname);
+        struct afile *rep = aname ? flist_find(flist, dir, aname) : 0;
+        show_error("repeated file/directory named '%s'", rep ? rep->pname : from);
+    }
+    else if( e == mkimage_err_dir_full )
+        show_error("too many files in directory %s.", dir->pname);
+    else if( e )
+        show_error("%s: %s", from, mkimage_strerror(e));
+
+    if( f->is_dir )
+        show_msg("added dir  '%-20s', from '%s'.", f->pname, from);
+    else
+        show_msg("added file '%-20s', %5ld bytes, from '%s'%s%s%s%s.", f->pname,
+                 (long)f->size, from, attribs & at_protected ? ", +p" : "",
+                 attribs & at_hidden ? ", +h" : "", attribs & at_archived ? ", +a" : "",
+                 boot_file ? ", (boot)" : "");
+    return f;
+}
+
+void flist_add_file(file_list *flist, const char *fname, int boot_file,
+                    enum fattr attribs)
+{
+    double start = trace_now();
+    struct stat st;
+
+    if( 0 != stat(fname, &st) )
+        show_error("reading input file '%s': %s", fname, strerror(errno));
+
+    char *data  = 0;
+    size_t size = 0;
+    if( S_ISREG(st.st_mode) )
+    {
+        if( st.st_size > SFS_MAX_FILE_SIZE )
+            show_error("file size too big '%s'", fname);
+        // Check that the file can be read, data is read later; in batches the
+        // errors are shown when reading.
+        if( !bulkio_batched() )
+        {
+            FILE *f = fopen(fname, "rb");
+            if( !f )
+                show_error("can't open file '%s': %s", fname, strerror(errno));
+            fclose(f);
+        }
+        size = st.st_size;
+    }
+#ifdef S_ISFIFO
+    else if( S_ISFIFO(st.st_mode) )
+    {
+        FILE *f = fopen(fname, "rb");
+        if( !f )
+            show_error("can't open file '%s': %s", fname, strerror(errno));
+        data = read_stream(f, fname, &size);
+        fclose(f);
+        // Use current time, as the FIFO time is not related to the data
+        st.st_mtime = time(0);
+    }
+#endif
+    else if( !S_ISDIR(st.st_mode) )
+        show_error("invalid file type '%s'", fname);
+
+    add_entry(flist, 0, fname, fname, S_ISDIR(st.st_mode), data, size, st.st_mtime,
+              boot_file, attribs);
+    trace_span("read", fname, start, "\"bytes\": %zu", size);
+}
+
+int flist_reload_file(struct afile *f)
+{
+    double start = trace_now();
+    struct stat st;
+
+    if( 0 != stat(f->fname, &st) )
+    {
+        show_msg("reading input file '%s': %s", f->fname, strerror(errno));
+        return -1;
+    }
+    if( !S_ISREG(st.st_mode) )
+    {
+        show_msg("invalid file type '%s'", f->fname);
+        return -1;
+    }
+    if( st.st_size > SFS_MAX_FILE_SIZE )
+    {
+        show_msg("file size too big '%s'", f->fname);
+        return -1;
+    }
+    FILE *fp = fopen(f->fname, "rb");
+    if( !fp )
+    {
+        show_msg("can't open file '%s': %s", f->fname, strerror(errno));
+        return -1;
+    }
+    size_t size = st.st_size;
+    char *data  = check_malloc(size ? size : 1);
+    if( size != fread(data, 1, size, fp) )
+    {
+        show_msg("error reading file '%s': %s", f->fname,
+                 ferror(fp) ? strerror(errno) : "file is shorter than expected");
+        fclose(fp);
+        free(data);
+        return -1;
+    }
+    fclose(fp);
+    free(f->data);
+    f->data      = data;
+    f->size      = size;
+    f->read_data = 0;
+    flist_set_time(f, st.st_mtime);
+    stats_add(stats_bytes_read, size);
+    trace_span("read", f->fname, start, "\"bytes\": %zu", size);
+    return 0;
+}
+
+void flist_preload(file_list *flist)
+{
+    double start             = trace_now();
+    struct bulkio_file *bf   = check_calloc(darray_len(flist) + 1, sizeof(*bf));
+    struct afile **ptr, **fl = check_calloc(darray_len(flist) + 1, sizeof(*fl));
+    int num                  = 0;
+    size_t total             = 0;
+    darray_foreach(ptr, flist)
+    {
+        struct afile *f = *ptr;
+        if( f->is_dir || f->read_data != read_data )
+            continue;
+        bf[num].name = f->fname;
+        bf[num].data = check_malloc(f->size ? f->size : 1);
+        bf[num].size = f->size;
+        fl[num++]    = f;
+        total += f->size;
+    }
+    bulkio_read(bf, num);
+    for( int i = 0; i < num; i++ )
+    {
+        if( bf[i].err )
+            show_error("error reading file '%s': %s", bf[i].name,
+                       bulkio_strerror(bf[i].err));
+        fl[i]->data      = bf[i].data;
+        fl[i]->read_data = 0;
+    }
+    stats_add(stats_bytes_read, total);
+    trace_span("read", "preload", start, "\"files\": %d, \"bytes\": %zu", num, total);
+    free(fl);
+    free(bf);
+}
+
+void flist_add_stdin(file_list *flist, const char *name, int boot_file,
+                     enum fattr attribs)
+{
+    double start = trace_now();
+    size_t size;
+    compat_set_binary(stdin);
+    char *data = read_stream(stdin, "-", &size);
+    add_entry(flist, 0, name, "-", 0, data, size, time(0), boot_file, attribs);
+    trace_span("read", "-", start, "\"bytes\": %zu", size);
+}
+
+// Maximum directory depth, as in atrfs_walk()
+#define MAX_DEPTH 32
+
+// State of the import of files from an image
+struct image_import
+{
+    struct atrfs *fs;
+    file_list *flist;
+    const char *image;                 // Image file name
+    const char *path;                  // Path selected inside the image
+    size_t plen;                       //
+    int base;                          // Level of the selected path
+    time_t mtime;                      // Time of entries without date
+    int boot_file;                     //
+    enum fattr attribs;                //
+    int found;                         // Selected path found
+    struct afile *dirs[MAX_DEPTH + 1]; // Current directory at each level
+};
+
+// Shows warnings from the image readers
+static void image_msg(const char *msg)
+{
+    show_msg("%s", msg);
+}
+
+static int path_level(const char *path, size_t len)
+{
+    int level = 0;
+    for( size_t i = 0; i < len; i++ )
+        level += path[i] == '/';
+    return level;
+}
+
+static int import_entry(void *ctx, const char *path, const struct atrfs_entry *entry)
+{
+    struct image_import *im = ctx;
+    // Only the selected path and the entries inside it are added
+    if( im->plen && (strncasecmp(path, im->path, im->plen) ||
+                     (path[im->plen] && path[im->plen] != '/')) )
+        return 0;
+    int level = path_level(path, strlen(path)) - im->base;
+    if( level < 1 || level > MAX_DEPTH )
+        show_error("%s:%s: directory too deep.", im->image, path);
+    if( level == 1 )
+    {
+        im->found = 1;
+        if( im->boot_file && entry->is_dir )
+            show_error("%s:%s: boot file can't be a directory.", im->image, path);
+    }
+
+    char *fname = check_malloc(strlen(im->image) + strlen(path) + 2);
+    sprintf(fname, "%s:%s", im->image, path);
+    char *data = 0;
+    if( !entry->is_dir )
+    {
+        data    = check_malloc(entry->size + 1);
+        int len = atrfs_read_file(im->fs, entry, (uint8_t *)data, entry->size);
+        if( len < 0 || (unsigned)len != entry->size )
+            show_error("%s: can't read file from image.", fname);
+        stats_add(stats_bytes_read, entry->size);
+    }
+    struct afile *f =
+        add_entry(im->flist, im->dirs[level - 1], fname, fname, entry->is_dir, data,
+                  entry->size, im->mtime, im->boot_file, im->attribs | entry->attribs);
+    if( entry->has_date )
+    {
+        memcpy(f->date, entry->date, 3);
+        memcpy(f->time, entry->time, 3);
+    }
+    if( entry->is_dir )
+        im->dirs[level] = f;
+    free(fname);
+    return 0;
+}
+
+const char *flist_image_path(const char *arg)
+{
+    const char *sep = strrchr(arg, ':');
+    if( !sep || (sep[1] && sep[1] != '/') )
+        return 0;
+    // The image name must be an existing file
+    char *image = check_malloc(sep - arg + 1);
+    memcpy(image, arg, sep - arg);
+    image[sep - arg] = 0;
+    struct stat st;
+    int ok = !stat(image, &st) && S_ISREG(st.st_mode);
+    free(image);
+    return ok ? sep : 0;
+}
+
+void flist_add_image(file_list *flist, const char *arg, int boot_file, enum fattr attribs)
+{
+    double start    = trace_now();
+    const char *sep = flist_image_path(arg);
+    if( !sep )
+        show_error("invalid image path '%s'", arg);
+    struct image_import im;
+    char *image = check_malloc(sep - arg + 1);
+    memcpy(image, arg, sep - arg);
+    image[sep - arg] = 0;
+
+    struct stat st;
+    struct atr_image *atr;
+    atr_set_msg_handler(image_msg);
+    int e = atr_load_file(&atr, image);
+    if( e == atr_err_open )
+        show_error("%s: %s: %s", image, atr_strerror(e), strerror(errno));
+    else if( e )
+        show_error("%s: %s", image, atr_strerror(e));
+    e = atrfs_open(&im.fs, atr, 0);
+    if( e )
+        show_error("%s: %s", image, atr_strerror(e));
+
+    // Remove the trailing '/' from the selected path
+    im.flist = flist;
+    im.image = image;
+    im.path  = sep + 1;
+    im.plen  = strlen(im.path);
+    while( im.plen && im.path[im.plen - 1] == '/' )
+        im.plen--;
+    int level    = path_level(im.path, im.plen);
+    im.base      = level ? level - 1 : 0;
+    im.mtime     = stat(image, &st) ? time(0) : st.st_mtime;
+    im.boot_file = boot_file;
+    im.attribs   = attribs;
+    im.found     = 0;
+    im.dirs[0]   = parent_dir(flist, image);
+    if( boot_file && !im.plen )
+        show_error("%s: boot file must be one file from the image.", arg);
+    e = atrfs_walk(im.fs, import_entry, &im);
+    if( e )
+        show_error("%s: %s", image, atr_strerror(e));
+    if( im.plen && !im.found )
+        show_error("%s: not found in image.", arg);
+
+    atrfs_close(im.fs);
+    atr_free(atr);
+    trace_span("read", arg, start, 0);
+    free(image);
+}
@@ -0,0 +1,43 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Adds files from the host file-system or from ATR images to the list of files.
+ */
+#pragma once
+#include "flist.h"
+
+// Adds a file or directory, files can also be named pipes.
+void flist_add_file(file_list *flist, const char *fname, int boot_file,
+                    enum fattr attribs);
+// Returns the description of the last error reading a file while building the
+// image in the current thread, when the builder returns mkimage_err_read.
+const char *flist_read_error(void);
+// Reads the data of all the regular files added with flist_add_file, keeping it
+// in memory, using the "--io" backend.
+void flist_preload(file_list *flist);
+// Adds a file read from the standard input, with the given name.
+void flist_add_stdin(file_list *flist, const char *name, int boot_file,
+                     enum fattr attribs);
+// Reads again a regular file added with flist_add_file, keeping the data in
+// memory. On errors shows a message, keeps the old data and returns -1.
+int flist_reload_file(struct afile *f);
+// Returns the position of the ':' if the argument is an image path, as
+// "image.atr:" or "image.atr:/DIR/FILE", or NULL if not.
+const char *flist_image_path(const char *arg);
+// Adds the files from an image path, all the files if no path is given inside
+// the image. The date and attributes of the entries are kept.
+void flist_add_image(file_list *flist, const char *arg, int boot_file, enum fattr attribs);
@@ -17,47 +17,470 @@
 /*
  * Loads an ATR with a SpartaDOS file-system and list contents.
  */
-#include "atr.h"
+#define _GNU_SOURCE
+#include "atrfs.h"
+#include "bulkio.h"
 #include "compat.h"
-#include "lsdos.h"
-#include "lsextra.h"
-#include "lshowfen.h"
-#include "lssfs.h"
+#include "darray.h"
+#include "lsgrep.h"
+#include "lsserve.h"
 #include "msg.h"
+#include "stats.h"
+#include "tar.h"
+#include "trace.h"
 #include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
+#include <utime.h>
 
 //---------------------------------------------------------------------
 static void show_usage(void)
 {
-    printf("Usage: %s [options] <atr_image_file>\n"
+    printf("Usage: %s [options] <atr_image_file> [<path> ...]\n"
            "Options:\n"
            "\t-a\tShow listing in Atari instead of UNIX format.\n"
            "\t-l\tConvert filenames to lower-case.\n"
            "\t-x\tExtract listed files to current path.\n"
            "\t-X path\tExtract listed files to given path.\n"
+           "\t--io sync|uring\n"
+           "\t       \tWrite the extracted files one by one, the default, or in\n"
+           "\t       \tbatches with io_uring.\n"
+           "\t--io-depth num\n"
+           "\t       \tFiles written at once with io_uring, default 32.\n"
+           "\t--tar file\n"
+           "\t       \tWrite listed files to a tar archive, '-' for standard output.\n"
+           "\t--grep string\n"
+           "\t       \tSearch the string in the files of all the given images,\n"
+           "\t       \tcan be repeated and include '\\xHH' escapes.\n"
+           "\t--serve socket\n"
+           "\t       \tAnswer queries about images over a Unix socket, see README.\n"
+           "\t--cache size\n"
+           "\t       \tMemory used to cache images in server mode, in MB, default 64.\n"
+           "\t--stats[=file.json]\n"
+           "\t       \tShow performance statistics, or write them to a JSON file.\n"
+           "\t--trace file.json\n"
+           "\t       \tWrite a timeline of the program, in the trace-event format.\n"
            "\t-h\tShow this help.\n"
-           "\t-v\tShow version information.\n",
+           "\t-v\tShow version information.\n"
+           "\n"
+           "Use '-' as the image file name to read it from standard input.\n"
+           "Paths list or extract only the matching files and directories, can\n"
+           "include wildcards, as in '/GAMES/*.XEX'.\n",
            prog_name);
     exit(EXIT_SUCCESS);
 }
 
+//---------------------------------------------------------------------
+// Global state
+struct lsatr
+{
+    struct atrfs *fs;
+    int atari_list;
+    int extract_files;
+    struct tar *tar; // Archive to write the files, NULL if not used
+    time_t now;      // Time of entries without date in the archive
+    char **patterns; // Paths to list or extract, NULL terminated
+    int *matched;    // Number of entries matched by each path
+    // Extracted files waiting to be written, with their entries
+    darray(struct bulkio_file) out;
+    darray(struct atrfs_entry) out_entries;
+};
+
+// State of one directory listing
+struct lsdir
+{
+    struct lsatr *ls;
+    const char *name;
+    darray(struct atrfs_entry) subdirs;
+};
+
+// Returns the time/date of the entry
+static time_t entry_time(const struct atrfs_entry *e)
+{
+    struct tm t;
+    memset(&t, 0, sizeof(t));
+    t.tm_sec   = e->time[2];
+    t.tm_min   = e->time[1];
+    t.tm_hour  = e->time[0];
+    t.tm_mday  = e->date[0];
+    t.tm_mon   = e->date[1] - 1;
+    t.tm_year  = e->date[2] > 83 ? e->date[2] : e->date[2] + 100;
+    t.tm_isdst = -1;
+    return mktime(&t);
+}
+
+static void set_times(const char *path, const struct atrfs_entry *e)
+{
+    struct utimbuf tb;
+    tb.actime = tb.modtime = entry_time(e);
+    utime(path, &tb);
+}
+
+static void msg_handler(const char *msg)
+{
+    show_msg("%s", msg);
+}
+
+// Returns true if the file-system has sub-directories
+static int has_dirs(const struct atrfs *fs)
+{
+    return fs->info.type == atrfs_sparta || fs->info.type == atrfs_dos;
+}
+
+static void show_header(const struct atrfs *fs, const char *atr_name, int atari_list)
+{
+    const struct atr_image *atr   = fs->atr;
+    const struct atrfs_info *info = &fs->info;
+    if( info->type == atrfs_sparta )
+    {
+        if( atari_list )
+            printf("ATR image: %s\n"
+                   "Image size: %u sectors of %u bytes\n"
+                   "Volume Name: %s\n",
+                   atr_name, atr->sec_count, atr->sec_size,
+                   *info->volume ? info->volume : "NONE");
+        else
+            printf("%s: %u sectors of %u bytes, volume name '%s'.\n", atr_name,
+                   atr->sec_count, atr->sec_size, info->volume);
+    }
+    else if( info->type == atrfs_dos )
+    {
+        if( atari_list )
+            printf("ATR image: %s\n"
+                   "Image size: %u sectors of %u bytes\n"
+                   "DOS size: %u sectors free of %u total\n"
+                   "Volume: %s\n",
+                   atr_name, atr->sec_count, atr->sec_size, info->free_sectors,
+                   info->total_sectors, info->format);
+        else
+            printf("%s: %u sectors of %u bytes, %s, %d sectors free of %d total.\n",
+                   atr_name, atr->sec_count, atr->sec_size, info->format,
+                   info->free_sectors, info->total_sectors);
+    }
+    else
+    {
+        if( atari_list )
+            printf("ATR image: %s\n"
+                   "Image size: %u sectors of %u bytes\n"
+                   "Volume: %s\n",
+                   atr_name, atr->sec_count, atr->sec_size, info->format);
+        else
+            printf("%s: %u sectors of %u bytes, %s.\n", atr_name, atr->sec_count,
+                   atr->sec_size, info->format);
+    }
+}
+
+static void read_dir(struct lsatr *ls, const struct atrfs_entry *dir, const char *name);
+
+// Matches the path of an entry against one pattern, comparing each path
+// component; returns 2 if the entry matches or is inside a matching directory,
+// 1 if the entry is a directory that can contain matching entries and 0 if not.
+static int match_pattern(const char *pat, const char *path)
+{
+    char pc[256], nc[256];
+    for( ;; )
+    {
+        pat += strspn(pat, "/");
+        path += strspn(path, "/");
+        if( !*pat )
+            return 2;
+        if( !*path )
+            return 1;
+        size_t pl = strcspn(pat, "/"), nl = strcspn(path, "/");
+        snprintf(pc, sizeof(pc), "%.*s", (int)pl, pat);
+        snprintf(nc, sizeof(nc), "%.*s", (int)nl, path);
+        if( fnmatch(pc, nc, FNM_CASEFOLD) )
+            return 0;
+        pat += pl;
+        path += nl;
+    }
+}
+
+// Matches the path against all the patterns in the command line, see above.
+// Directories that can't contain matches are not read.
+static int match_path(struct lsatr *ls, const char *path)
+{
+    if( !*ls->patterns )
+        return 2;
+    int ret = 0;
+    for( int i = 0; ls->patterns[i]; i++ )
+    {
+        int m = match_pattern(ls->patterns[i], path);
+        if( m == 2 )
+            ls->matched[i]++;
+        if( m > ret )
+            ret = m;
+    }
+    return ret;
+}
+
+// Writes all the extracted files waiting, and sets their time/date
+static void write_files(struct lsatr *ls)
+{
+    size_t num = darray_len(&ls->out);
+    if( !num )
+        return;
+    double start = trace_now();
+    bulkio_write(ls->out.data, num);
+    for( size_t i = 0; i < num; i++ )
+    {
+        struct bulkio_file *f       = &darray_i(&ls->out, i);
+        const struct atrfs_entry *e = &darray_i(&ls->out_entries, i);
+        if( f->err == EEXIST )
+            show_error("%s: file already exists.", f->name);
+        else if( f->err )
+            show_error("%s: can´t write file, %s", f->name, bulkio_strerror(f->err));
+        // Set time/date
+        if( e->has_date )
+            set_times(f->name, e);
+        free((char *)f->name);
+        free(f->data);
+    }
+    trace_span("write", "files", start, "\"files\": %zu", num);
+    ls->out.len         = 0;
+    ls->out_entries.len = 0;
+}
+
+// Adds the file to the files waiting to be written, takes ownership of "fdata"
+static void extract_file(struct lsatr *ls, const struct atrfs_entry *e,
+                         const char *path, uint8_t *fdata, unsigned fsize)
+{
+    fprintf(stderr, "%s\n", path);
+    struct bulkio_file f = {strdup(path), fdata, fsize, 0};
+    if( !f.name || darray_add(&ls->out, f) || darray_add(&ls->out_entries, *e) )
+        memory_error();
+    if( darray_len(&ls->out) >= (size_t)bulkio_depth() )
+        write_files(ls);
+}
+
+// Reads the data of the file, returns a new buffer
+static uint8_t *read_entry(struct lsatr *ls, const struct atrfs_entry *e,
+                           const char *name, unsigned *size)
+{
+    uint8_t *fdata = check_malloc(e->size ? e->size : 1);
+    int r          = atrfs_read_file(ls->fs, e, fdata, e->size);
+    *size          = e->size;
+    if( r < 0 || (unsigned)r != e->size )
+    {
+        show_msg("%s: short file in disk", name);
+        *size = r < 0 ? 0 : r;
+    }
+    return fdata;
+}
+
+// Adds the entry to the tar archive
+static void tar_entry(struct lsatr *ls, const struct atrfs_entry *e, const char *path,
+                      const uint8_t *fdata, unsigned fsize)
+{
+    time_t mtime = e->has_date ? entry_time(e) : ls->now;
+    int r = e->is_dir ? tar_add_dir(ls->tar, path, mtime)
+                      : tar_add_file(ls->tar, path, fdata, fsize, mtime);
+    if( r && errno == ENAMETOOLONG )
+        show_error("%s: path too long for tar archive.", path);
+    else if( r )
+        show_error("can´t write tar archive, %s", strerror(errno));
+}
+
+static int list_entry(void *ctx, const struct atrfs_entry *e)
+{
+    struct lsdir *ld = ctx;
+    struct lsatr *ls = ld->ls;
+    int name_width   = ls->fs->info.type == atrfs_howfen ? 20 : 12;
+
+    char *new_name;
+    if( asprintf(&new_name, "%s/%s", ld->name, e->name) < 0 )
+        memory_error();
+    int match = match_path(ls, new_name);
+    if( !match || (match == 1 && !e->is_dir) )
+    {
+        free(new_name);
+        return 0;
+    }
+    if( e->is_dir )
+    {
+        if( ls->extract_files )
+        {
+            struct stat st;
+            const char *path = new_name + 1;
+            if( match == 2 )
+                fprintf(stderr, "%s/\n", path);
+            // Check if directory already exists:
+            if( stat(path, &st) || !S_ISDIR(st.st_mode) )
+            {
+                // Create new directory
+                if( compat_mkdir(path) )
+                    show_error("%s: can´t create directory, %s", path, strerror(errno));
+            }
+            // Extract files inside, all written before setting the directory time
+            read_dir(ls, e, new_name);
+            write_files(ls);
+            // Set time/date
+            if( e->has_date )
+                set_times(path, e);
+        }
+        else if( ls->tar )
+        {
+            // Directories traversed to reach the matching paths are also
+            // stored, to keep their time/date
+            if( match == 2 )
+                fprintf(stderr, "%s/\n", new_name + 1);
+            tar_entry(ls, e, new_name + 1, 0, 0);
+            read_dir(ls, e, new_name);
+        }
+        else if( ls->atari_list )
+        {
+            // Print entry, but don´t recurse
+            // Directories only traversed to reach the matching paths are not shown
+            if( match == 2 && e->has_date )
+                printf("%-12s  <DIR>  %02d-%02d-%02d %02d:%02d\n", e->aname, e->date[0],
+                       e->date[1], e->date[2], e->time[0], e->time[1]);
+            else if( match == 2 )
+                printf("%-12s  <DIR>\n", e->aname);
+            if( darray_add(&ld->subdirs, *e) )
+                memory_error();
+        }
+        else
+        {
+            if( match == 2 && e->has_date )
+                printf("%8u\t%02d-%02d-%02d %02d:%02d:%02d\t%s/\n", e->size, e->date[0],
+                       e->date[1], e->date[2], e->time[0], e->time[1], e->time[2],
+                       new_name);
+            else if( match == 2 )
+                printf("%8u\t\t%s/\n", e->size, new_name);
+            read_dir(ls, e, new_name);
+        }
+    }
+    else
+    {
+        uint8_t *fdata = 0;
+        unsigned fsize = e->size;
+        stats_add(stats_files, 1);
+        if( ls->extract_files || ls->tar )
+        {
+            stats_begin(stats_extract);
+            double start = trace_now();
+            fdata        = read_entry(ls, e, new_name, &fsize);
+            if( ls->tar )
+            {
+                fprintf(stderr, "%s\n", new_name + 1);
+                tar_entry(ls, e, new_name + 1, fdata, fsize);
+            }
+            else
+            {
+                extract_file(ls, e, new_name + 1, fdata, fsize);
+                fdata = 0;
+            }
+            trace_span("extract", new_name, start, "\"bytes\": %u", fsize);
+            stats_end(stats_extract);
+            stats_add(stats_bytes_copied, fsize);
+            stats_add(stats_bytes_written, fsize);
+        }
+        else if( ls->atari_list )
+        {
+            if( e->has_date )
+                printf("%-12s %7u %02d-%02d-%02d %02d:%02d\n", e->aname, fsize, e->date[0],
+                       e->date[1], e->date[2], e->time[0], e->time[1]);
+            else
+                printf("%-*s %7u\n", name_width, e->aname, fsize);
+        }
+        else if( e->has_date )
+            printf("%8u\t%02d-%02d-%02d %02d:%02d:%02d\t%s\n", fsize, e->date[0],
+                   e->date[1], e->date[2], e->time[0], e->time[1], e->time[2], new_name);
+        else
+            printf("%8u\t\t%s\n", fsize, new_name);
+        free(fdata);
+    }
+    free(new_name);
+    return 0;
+}
+
+static void read_dir(struct lsatr *ls, const struct atrfs_entry *dir, const char *name)
+{
+    double start  = trace_now();
+    int show_dirs = ls->atari_list && has_dirs(ls->fs);
+    if( show_dirs )
+        printf("Directory of %s\n\n", *name ? name : "/");
+
+    struct lsdir ld;
+    ld.ls   = ls;
+    ld.name = name;
+    stats_add(stats_dirs, 1);
+    if( darray_init(ld.subdirs, 1) )
+        memory_error();
+    if( 0 > atrfs_read_dir(ls->fs, dir, list_entry, &ld) )
+        show_msg("%s: can´t get directory data", name);
+
+    // traverse dir again if listing in Atari format, to show sub directories
+    if( show_dirs )
+    {
+        printf("\n");
+        struct atrfs_entry *e;
+        darray_foreach(e, &ld.subdirs)
+        {
+            char *new_name;
+            if( asprintf(&new_name, "%s/%s", name, e->name) < 0 )
+                memory_error();
+            read_dir(ls, e, new_name);
+            free(new_name);
+        }
+    }
+    darray_delete(ld.subdirs);
+    trace_span("dir", *name ? name : "/", start, 0);
+}
+
 //---------------------------------------------------------------------
 int main(int argc, char **argv)
 {
     const char *atr_name = 0;
     const char *ext_path = 0;
+    const char *stats    = stats_parse_args(argc, argv);
     int lower_case       = 0;
     int atari_list       = 0;
     int extract_files    = 0;
+    const char *serve    = 0;
+    const char *tar_name = 0;
+    long cache_size      = 64;
+    char **patterns      = check_calloc(argc, sizeof(char *));
+    int num_patterns     = 0;
+    char **greps         = check_calloc(argc, sizeof(char *));
+    int num_greps        = 0;
     prog_name            = argv[0];
+    trace_parse_args(argc, argv);
+    bulkio_parse_args(argc, argv);
     for( int i = 1; i < argc; i++ )
     {
         char *arg = argv[i];
-        if( arg[0] == '-' )
+        if( stats_option(arg) )
+            continue;
+        else if( trace_option(argc, argv, i) || bulkio_option(argc, argv, i) )
+            i++;
+        else if( !strcmp(arg, "--serve") || !strcmp(arg, "--cache") ||
+                 !strcmp(arg, "--grep") || !strcmp(arg, "--tar") )
+        {
+            if( i + 1 >= argc )
+                show_opt_error("option '%s' needs an argument", arg);
+            i++;
+            if( arg[2] == 's' )
+                serve = argv[i];
+            else if( arg[2] == 'g' )
+                greps[num_greps++] = argv[i];
+            else if( arg[2] == 't' )
+                tar_name = argv[i];
+            else
+            {
+                char *ep;
+                cache_size = strtol(argv[i], &ep, 0);
+                if( cache_size <= 0 || !ep || *ep )
+                    show_error("argument for option '--cache' must be positive.");
+            }
+        }
+        else if( arg[0] == '-' && arg[1] )
         {
             char op;
             while( 0 != (op = *++arg) )
@@ -87,16 +510,58 @@ int main(int argc, char **argv)
         else if( !atr_name )
             atr_name = arg;
         else
-            show_opt_error("multiple ATR files in command line");
+            patterns[num_patterns++] = arg;
+    }
+    if( serve )
+    {
+        if( atr_name || extract_files || atari_list || num_patterns || num_greps ||
+            tar_name )
+            show_opt_error("option '--serve' only allows '-l'");
+        atr_set_msg_handler(msg_handler);
+        serve_images(serve, lower_case, (size_t)cache_size << 20);
     }
     if( !atr_name )
         show_opt_error("ATR file name expected");
 
+    if( num_greps )
+    {
+        // All the file names are images to search
+        if( extract_files || atari_list || tar_name )
+            show_opt_error("option '--grep' only allows '-l'");
+        memmove(patterns + 1, patterns, num_patterns * sizeof(char *));
+        patterns[0] = (char *)atr_name;
+        num_patterns++;
+        atr_set_msg_handler(msg_handler);
+        return grep_images(greps, num_greps, patterns, num_patterns, lower_case);
+    }
+
     if( extract_files && atari_list )
         show_opt_error("options '-x' and '-a' not compatible");
+    if( tar_name && (extract_files || atari_list) )
+        show_opt_error("option '--tar' not compatible with '-x' or '-a'");
 
     // Load ATR image file
-    struct atr_image *atr = load_atr_image(atr_name);
+    struct atr_image *atr;
+    atr_set_msg_handler(msg_handler);
+    int e;
+    double start = trace_now();
+    stats_begin(stats_load);
+    if( !strcmp(atr_name, "-") )
+    {
+        // Read from standard input
+        atr_name = "stdin";
+        compat_set_binary(stdin);
+        e = atr_load_stream(&atr, stdin, atr_name);
+    }
+    else
+        e = atr_load_file(&atr, atr_name);
+    if( e == atr_err_open )
+        show_error("can´t open disk image '%s': %s", atr_name, strerror(errno));
+    else if( e )
+        show_error("%s: %s", atr_name, atr_strerror(e));
+    stats_end(stats_load);
+    trace_span("load", atr_name, start, "\"sectors\": %u", atr->sec_count);
+    stats_add(stats_bytes_read, (long long)atr->sec_size * atr->sec_count);
 
     // Open target directory
     if( ext_path && chdir(ext_path) )
@@ -113,16 +578,47 @@ int main(int argc, char **argv)
             show_error("%s: invalid extract path, %s", ext_path, strerror(errno));
     }
 
-    int e = sfs_read(atr, atr_name, atari_list, lower_case, extract_files);
-    if( e )
-        e = howfen_read(atr, atr_name, atari_list, lower_case, extract_files);
-    if( e )
-        e = dos_read(atr, atr_name, atari_list, lower_case, extract_files);
-    if( e )
-        e = extra_read(atr, atr_name, atari_list, lower_case, extract_files);
+    struct lsatr ls;
+    e = atrfs_open(&ls.fs, atr, lower_case ? atrfs_lower_case : 0);
     if( e )
         show_msg("%s: ATR image format not supported.", atr_name);
+    else
+    {
+        ls.atari_list    = atari_list;
+        ls.extract_files = extract_files;
+        ls.tar           = 0;
+        ls.now           = time(0);
+        ls.patterns      = patterns;
+        ls.matched       = check_calloc(num_patterns + 1, sizeof(int));
+        if( darray_init(ls.out, 1) || darray_init(ls.out_entries, 1) )
+            memory_error();
+        if( tar_name && !(ls.tar = tar_open(tar_name)) )
+            show_error("can't create tar archive '%s': %s", tar_name, strerror(errno));
+        // The standard output can be the archive
+        if( !tar_name )
+            show_header(ls.fs, atr_name, atari_list);
+        stats_begin(stats_list);
+        read_dir(&ls, 0, "");
+        write_files(&ls);
+        if( ls.tar && tar_close(ls.tar) )
+            show_error("can´t write tar archive, %s", strerror(errno));
+        stats_end(stats_list);
+        for( int i = 0; i < num_patterns; i++ )
+        {
+            if( !ls.matched[i] )
+            {
+                show_msg("%s: not found in image.", patterns[i]);
+                e = 1;
+            }
+        }
+        free(ls.matched);
+        darray_delete(ls.out);
+        darray_delete(ls.out_entries);
+        atrfs_close(ls.fs);
+    }
+    free(patterns);
     atr_free(atr);
+    stats_report(stats);
 
-    return e;
+    return e ? 1 : 0;
 }
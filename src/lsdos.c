@@ -17,33 +17,9 @@
 /*
  * Reads a DOS 2 or DOS 2.5 file-system.
  */
-#define _GNU_SOURCE
 #include "lsdos.h"
-#include "atr.h"
-#include "compat.h"
-#include "msg.h"
-#include <errno.h>
-#include <fcntl.h>
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <time.h>
-#include <unistd.h>
-#include <utime.h>
-
-//---------------------------------------------------------------------
-// Global state
-struct lsdos
-{
-    struct atr_image *atr;
-    int atari_list;
-    int lower_case;
-    int extract_files;
-    int dir_size;
-    int ldos_csize;
-    int fix_bibo;
-};
 
 //---------------------------------------------------------------------
 static uint16_t read16(const uint8_t *p)
@@ -84,20 +60,22 @@ static unsigned get_name(char *name, char *aname, const uint8_t *data, int max,
     return l;
 }
 
-// Read up to size bytes from file at given map sector
+// Read up to size bytes from file at given map sector, returns the total file
+// length.
 static unsigned read_file(struct atr_image *atr, unsigned sect, unsigned size,
                           uint8_t *data, int dos2, int mdos)
 {
     // To avoid circular references, keep a bitmap with all the sectors already used
-    uint8_t *visited = check_calloc(65536, 1);
-    unsigned lst     = atr->sec_size - 3;
-    unsigned pos     = 0;
+    uint8_t visited[65536 / 8];
+    unsigned lst = atr->sec_size - 3;
+    unsigned pos = 0;
+    memset(visited, 0, sizeof(visited));
     while( sect )
     {
         const uint8_t *m = atr_data(atr, sect);
         if( sect < 2 || !m )
         {
-            show_msg("invalid sector link");
+            atr_msg("invalid sector link");
             break;
         }
         unsigned len  = m[lst + 2];
@@ -113,13 +91,14 @@ static unsigned read_file(struct atr_image *atr, unsigned sect, unsigned size,
         if( !mdos || atr->sec_count < 1023 )
             link = link & 0x3FF;
 
-        if( visited[sect & 0xFFFF] )
+        unsigned bit = 1 << (sect & 7);
+        if( visited[(sect & 0xFFFF) >> 3] & bit )
         {
-            show_msg("loop in sector link at sector %d", sect);
+            atr_msg("loop in sector link at sector %d", sect);
             break;
         }
         else
-            visited[sect & 0xFFFF] = 1;
+            visited[(sect & 0xFFFF) >> 3] |= bit;
 
         if( size > pos )
         {
@@ -129,38 +108,36 @@ static unsigned read_file(struct atr_image *atr, unsigned sect, unsigned size,
         pos += len;
         sect = link;
     }
-    free(visited);
     return pos;
 }
 
-static const uint8_t *dir_data(struct lsdos *ls, unsigned dir, unsigned fn)
+static const uint8_t *dir_data(struct atrfs *fs, unsigned dir, unsigned fn)
 {
-    if( ls->ldos_csize )
+    if( fs->ldos_csize )
     {
-        int cluster = dir / ls->ldos_csize;
-        int pos     = (dir + fn / 8) % ls->ldos_csize;
-        int sector  = cluster * ls->ldos_csize + pos;
-        return atr_data(ls->atr, sector);
+        int cluster = dir / fs->ldos_csize;
+        int pos     = (dir + fn / 8) % fs->ldos_csize;
+        int sector  = cluster * fs->ldos_csize + pos;
+        return atr_data(fs->atr, sector);
     }
-    else if( ls->fix_bibo )
+    else if( fs->fix_bibo )
     {
-        const uint8_t *data = atr_data(ls->atr, dir + fn / 16);
-        return fn & 8 ? data + 0x80 : data;
+        const uint8_t *data = atr_data(fs->atr, dir + fn / 16);
+        return data && (fn & 8) ? data + 0x80 : data;
     }
     else
-        return atr_data(ls->atr, dir + fn / 8);
+        return atr_data(fs->atr, dir + fn / 8);
 }
 
-static void read_dir(struct lsdos *ls, unsigned dir, const char *name)
+int dos_read_dir(struct atrfs *fs, const struct atrfs_entry *dir, atrfs_dir_cb cb,
+                 void *ctx)
 {
-    unsigned ssize = ls->atr->sec_size;
-
-    if( ls->atari_list )
-        printf("Directory of %s\n\n", *name ? name : "/");
+    unsigned ssize = fs->atr->sec_size;
 
-    for( int fn = 0; fn < ls->dir_size; fn++ )
+    int ret = 0;
+    for( int fn = 0; !ret && fn < fs->dir_size; fn++ )
     {
-        const uint8_t *data = dir_data(ls, dir, fn);
+        const uint8_t *data = dir_data(fs, dir->sector, fn);
         if( !data )
             break;
         const uint8_t *entry = data + (fn & 7) * 16;
@@ -171,124 +148,60 @@ static void read_dir(struct lsdos *ls, unsigned dir, const char *name)
             break;
         if( flags & 0x80 ) // Deleted
             continue;
-        char fname[32], aname[32];
-        if( !get_name(fname, aname, entry + 5, 11, ls->lower_case) || !*fname )
+        struct atrfs_entry e;
+        if( !get_name(e.name, e.aname, entry + 5, 11, fs->lower_case) || !*e.name )
         {
-            show_msg("%s: invalid file name, skip", name);
+            atr_msg("%s: invalid file name, skip", dir->name);
             continue;
         }
         if( sect < 2 )
         {
-            show_msg("%s: invalid file sector, skip", name);
+            atr_msg("%s: invalid file sector, skip", dir->name);
             continue;
         }
-        char *new_name;
-        asprintf(&new_name, "%s/%s", name, fname);
-
-        if( flags == 0x10 )
-        {
-            if( ls->extract_files )
-            {
-                struct stat st;
-                const char *path = new_name + 1;
-                fprintf(stderr, "%s/\n", path);
-                // Check if directory already exists:
-                if( stat(path, &st) || !S_ISDIR(st.st_mode) )
-                {
-                    // Create new directory
-                    if( compat_mkdir(path) )
-                        show_error("%s: can´t create directory, %s", path,
-                                   strerror(errno));
-                }
-                // Extract files inside
-                read_dir(ls, sect, new_name);
-            }
-            else if( ls->atari_list )
-            {
-                // Print entry, but don´t recurse
-                printf("%-12s  <DIR>\n", aname);
-            }
-            else
-            {
-                printf("%8u\t\t%s/\n", size * ssize, new_name);
-                read_dir(ls, sect, new_name);
-            }
-        }
+        e.is_dir   = flags == 0x10;
+        e.has_date = 0;
+        e.attribs  = (flags & 0x20) ? atrfs_protected : 0;
+        e.flags    = flags;
+        e.sector   = sect;
+        if( e.is_dir )
+            e.size = size * ssize;
         else if( 0 != (flags & 0x41) )
         {
-            int mdos       = flags & 0x04;
-            int dos2       = flags & 0x02;
-            int max_size   = size * ssize;
-            uint8_t *fdata = check_malloc(max_size);
-            unsigned fsize = 0;
+            unsigned max_size = size * ssize;
+            e.size            = 0;
             // Skip files of size 0
             if( max_size > 0 )
             {
-                fsize = read_file(ls->atr, sect, max_size, fdata, dos2, mdos);
-                if( fsize > max_size )
-                    show_msg("%s: file too long in disk", new_name);
+                e.size = read_file(fs->atr, sect, 0, 0, flags & 0x02, flags & 0x04);
+                if( e.size > max_size )
+                    atr_msg("%s: file too long in disk", e.name);
             }
-            if( ls->extract_files )
-            {
-                struct stat st;
-                const char *path = new_name + 1;
-                fprintf(stderr, "%s\n", path);
-                // Check if file already exists:
-                if( 0 == stat(path, &st) )
-                    show_error("%s: file already exists.", path);
-                // Create new file
-                int fd = creat(path, 0666);
-                if( fd == -1 )
-                    show_error("%s: can´t create file, %s", path, strerror(errno));
-                if( fsize != write(fd, fdata, fsize) )
-                    show_error("%s: can´t write file, %s", path, strerror(errno));
-                if( close(fd) )
-                    show_error("%s: can´t write file, %s", path, strerror(errno));
-            }
-            else if( ls->atari_list )
-                printf("%-12s %7u\n", aname, fsize);
-            else
-                printf("%8u\t\t%s\n", fsize, new_name);
-            free(fdata);
         }
         else
         {
-            show_msg("%s: invalid file type %02x", new_name, flags);
+            atr_msg("%s: invalid file type %02x", e.name, flags);
+            continue;
         }
-        free(new_name);
+        ret = cb(ctx, &e);
     }
-    // traverse dir again if listing in Atari format, to show sub directories
-    if( ls->atari_list )
-    {
-        printf("\n");
-        for( int fn = 0; fn < ls->dir_size; fn++ )
-        {
-            const uint8_t *data = dir_data(ls, dir, fn);
-            if( !data )
-                break;
-            const uint8_t *entry = data + (fn & 7) * 16;
-            int flags            = entry[0];
-            unsigned sect        = read16(entry + 3);
-            if( !flags )
-                break;          // End of directory
-            if( flags != 0x10 ) // Not directory
-                continue;
+    return ret;
+}
 
-            char fname[32], aname[32];
-            if( !get_name(fname, aname, entry + 5, 11, ls->lower_case) || !*fname )
-                continue;
-            char *new_name;
-            asprintf(&new_name, "%s/%s", name, fname);
-            read_dir(ls, sect, new_name);
-            free(new_name);
-        }
-    }
+int dos_read_file(struct atrfs *fs, const struct atrfs_entry *file, uint8_t *buf,
+                  unsigned size)
+{
+    if( !size )
+        return 0;
+    unsigned len = read_file(fs->atr, file->sector, size, buf, file->flags & 0x02,
+                             file->flags & 0x04);
+    return len < size ? len : size;
 }
 
 // Detect Bibo-DOS directory format, it uses the full sector in DD for the
 // directory data, instead of the first 128 bytes of MyDOS and DOS 2.0D.
 // Note that Bibo-DOS 7.0 fixes this, so it will be detected ad MyDOS.
-int detect_bibo(struct atr_image *atr, int dir_sect)
+static int detect_bibo(struct atr_image *atr, int dir_sect)
 {
     const uint8_t *data = atr_data(atr, dir_sect);
     if( !data )
@@ -320,9 +233,11 @@ int detect_bibo(struct atr_image *atr, int dir_sect)
     return 0;
 }
 
-int dos_read(struct atr_image *atr, const char *atr_name, int atari_list, int lower_case,
-             int extract_files)
+int dos_open(struct atrfs *fs)
 {
+    struct atr_image *atr = fs->atr;
+    const char *atr_name  = atr->name;
+
     // Check DOS filesystem
     // Read VTOC
     const uint8_t *vtoc = atr_data(atr, 360);
@@ -413,16 +328,16 @@ int dos_read(struct atr_image *atr, const char *atr_name, int atari_list, int lo
         if( 0 != (bitmap_0 & 0xC0) || (signature == 2 && 0 != (bitmap_0 & 0xF0)) ||
             0 != (bitmap_360 & 0x80) )
         {
-            show_msg("%s: invalid DOS file system, bitmap not ok.", atr_name);
+            atr_msg("%s: invalid DOS file system, bitmap not ok.", atr_name);
             return 1;
         }
     }
 
     if( alloc_sect > atr->sec_count )
-        show_msg("%s: DOS sectors (%d) more than ATR image (%d).", atr_name, alloc_sect,
-                 atr->sec_count);
+        atr_msg("%s: DOS sectors (%d) more than ATR image (%d).", atr_name, alloc_sect,
+                atr->sec_count);
     if( free_sect > alloc_sect )
-        show_msg("%s: DOS free sectors more than allocated.", atr_name);
+        atr_msg("%s: DOS free sectors more than allocated.", atr_name);
 
     const char *dosver = "DOS 1";
     if( signature == 2 && atr->sec_count > 943 )
@@ -444,28 +359,13 @@ int dos_read(struct atr_image *atr, const char *atr_name, int atari_list, int lo
         fix_bibo = 1;
     }
 
-    if( atari_list )
-        printf("ATR image: %s\n"
-               "Image size: %u sectors of %u bytes\n"
-               "DOS size: %u sectors free of %u total\n"
-               "Volume: %s%s\n",
-               atr_name, atr->sec_count, atr->sec_size, free_sect, alloc_sect, dosver,
-               bad_sig);
-    else
-        printf("%s: %u sectors of %u bytes, %s%s, %d sectors free of %d total.\n",
-               atr_name, atr->sec_count, atr->sec_size, dosver, bad_sig, free_sect,
-               alloc_sect);
-
-    struct lsdos *ls  = check_malloc(sizeof(struct lsdos));
-    ls->atr           = atr;
-    ls->atari_list    = atari_list;
-    ls->lower_case    = lower_case;
-    ls->extract_files = extract_files;
-    ls->dir_size      = dir_size;
-    ls->ldos_csize    = ldos_csize;
-    ls->fix_bibo      = fix_bibo;
-    read_dir(ls, 361, "");
-
-    free(ls);
+    fs->info.type          = atrfs_dos;
+    fs->info.free_sectors  = free_sect;
+    fs->info.total_sectors = alloc_sect;
+    snprintf(fs->info.format, sizeof(fs->info.format), "%s%s", dosver, bad_sig);
+    fs->dir_size    = dir_size;
+    fs->ldos_csize  = ldos_csize;
+    fs->fix_bibo    = fix_bibo;
+    fs->root.sector = 361;
     return 0;
 }
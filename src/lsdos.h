@@ -18,7 +18,10 @@
  * Reads an Atari DOS file-system.
  */
 #pragma once
-#include "atr.h"
+#include "atrfs.h"
 
-int dos_read(struct atr_image *atr, const char *atr_name, int atari_list, int lower_case,
-             int extract_files);
+int dos_open(struct atrfs *fs);
+int dos_read_dir(struct atrfs *fs, const struct atrfs_entry *dir, atrfs_dir_cb cb,
+                 void *ctx);
+int dos_read_file(struct atrfs *fs, const struct atrfs_entry *file, uint8_t *buf,
+                  unsigned size);
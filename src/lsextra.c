@@ -17,17 +17,10 @@
 /*
  * Extracts various simple boot formats.
  */
-#define _GNU_SOURCE
-#include "crc32.h"
 #include "lsextra.h"
-#include "msg.h"
-#include <errno.h>
-#include <fcntl.h>
+#include "crc32.h"
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <unistd.h>
 
 static unsigned get_name(char *name, char *aname, const uint8_t *data, int max,
                          int lower_case)
@@ -96,74 +89,56 @@ static int check_bas2boot(struct atr_image *atr)
     return 1;
 }
 
-static void extract_bas2boot(struct atr_image *atr, int atari_list, int lower_case,
-                             int extract_files)
+static void bas2boot_entry(struct atrfs *fs, struct atrfs_entry *e)
 {
+    struct atr_image *atr = fs->atr;
     // Get headers
     const uint8_t *sec1 = atr_data(atr, 1);
     const uint8_t *sec2 = atr_data(atr, 2);
     // Get filename
-    char path[32], aname[32];
-    if( !get_name(path, aname, sec2 + 0x60, 12, lower_case) || !*path )
+    if( !get_name(e->name, e->aname, sec2 + 0x60, 12, fs->lower_case) || !*e->name )
     {
-        strcpy(path, "noname.bas");
-        strcpy(aname, "NONAME  BAS");
+        strcpy(e->name, "noname.bas");
+        strcpy(e->aname, "NONAME  BAS");
     }
     // Adds '.BAS' if no extension is present
-    if( !strchr(path, '.') )
+    if( !strchr(e->name, '.') )
     {
-        const char *ext = lower_case ? ".bas" : ".BAS";
-        strcat(path, ext);
-        memcpy(aname + 9, ext + 1, 3);
+        const char *ext = fs->lower_case ? ".bas" : ".BAS";
+        strcat(e->name, ext);
+        memcpy(e->aname + 9, ext + 1, 3);
     }
+    // Get length
+    e->size = read16(sec1 + 8);
+}
 
-    // Get data and length
-    unsigned fsize = read16(sec1 + 8);
-    uint8_t *fdata = check_malloc(fsize < 16 ? 16 : fsize);
+static unsigned read_bas2boot(struct atr_image *atr, uint8_t *data, unsigned size)
+{
+    const uint8_t *sec2 = atr_data(atr, 2);
+    uint8_t hdr[14];
 
     // Read header and undo bad conversion for certain files
-    memcpy(fdata, sec2 + 0x72, 14);
+    memcpy(hdr, sec2 + 0x72, 14);
     for( int i = 2; i < 14; i += 2 )
     {
-        int x        = fdata[0] + fdata[1] * 256;
-        int y        = fdata[i] + fdata[i + 1] * 256 + x;
-        fdata[i]     = y & 0xFF;
-        fdata[i + 1] = y >> 8;
+        int x      = hdr[0] + hdr[1] * 256;
+        int y      = hdr[i] + hdr[i + 1] * 256 + x;
+        hdr[i]     = y & 0xFF;
+        hdr[i + 1] = y >> 8;
     }
+    memcpy(data, hdr, size < 14 ? size : 14);
     // Read rest of file
     unsigned secnum = 3;
-    for( unsigned pos = 14; pos < fsize; pos += 128, secnum++ )
+    for( unsigned pos = 14; pos < size; pos += 128, secnum++ )
     {
-        unsigned len     = fsize - pos < 128 ? fsize - pos : 128;
+        unsigned len     = size - pos < 128 ? size - pos : 128;
         const uint8_t *s = atr_data(atr, secnum);
         if( !s )
-            memset(fdata + pos, 0, len);
+            memset(data + pos, 0, len);
         else
-            memcpy(fdata + pos, s, len);
+            memcpy(data + pos, s, len);
     }
-
-    if( extract_files )
-    {
-        struct stat st;
-        fprintf(stderr, "%s\n", path);
-        // Check if file already exists:
-        if( 0 == stat(path, &st) )
-            show_error("%s: file already exists.", path);
-        // Create new file
-        int fd = creat(path, 0666);
-        if( fd == -1 )
-            show_error("%s: can´t create file, %s", path, strerror(errno));
-        if( fsize != write(fd, fdata, fsize) )
-            show_error("%s: can´t write file, %s", path, strerror(errno));
-        if( close(fd) )
-            show_error("%s: can´t write file, %s", path, strerror(errno));
-    }
-    else if( atari_list )
-        printf("%-12s %7u\n", aname, fsize);
-    else
-        printf("%8u\t\t%s\n", fsize, path);
-
-    free(fdata);
+    return size;
 }
 
 static int check_kboot(struct atr_image *atr)
@@ -185,91 +160,75 @@ static int check_kboot(struct atr_image *atr)
     return 0 == memcmp("\x00\x03\x00\x07\x14\x07\x4c\x14\x07", sec, 9);
 }
 
-static void extract_kboot(struct atr_image *atr, const char *atr_name, int atari_list,
-                          int lower_case, int extract_files)
+static int kboot_entry(struct atrfs *fs, struct atrfs_entry *e)
 {
-
-    const uint8_t *sec = atr_data(atr, 1);
-    unsigned fsize     = sec[9] + (sec[10] << 8) + (sec[11] << 16);
+    struct atr_image *atr = fs->atr;
+    const uint8_t *sec    = atr_data(atr, 1);
+    unsigned fsize        = sec[9] + (sec[10] << 8) + (sec[11] << 16);
     if( !fsize )
-    {
-        if( atari_list )
-            printf("<EMPTY>\n");
-        else
-            printf("%8u\t\t/\n", 0);
-        return;
-    }
+        return 1;
     // Get file data
-    unsigned max_len     = atr->sec_count * 128 - 3 * 128;
-    const uint8_t *fdata = atr_data(atr, 4);
-    if( !fdata )
-    {
-        show_error("%s: missing file data", atr_name);
-        return;
-    }
+    unsigned max_len = atr->sec_count * 128 - 3 * 128;
     if( max_len < fsize )
     {
-        show_msg("%s: data shorter than expected, truncating", atr_name);
+        atr_msg("%s: data shorter than expected, truncating", atr->name);
         fsize = max_len;
     }
-
-    unsigned crc = crc32(0, fdata, fsize);
-    if( extract_files )
-    {
-        char *path;
-        asprintf(&path, "kboot-%08x.xex", crc);
-        struct stat st;
-        fprintf(stderr, "%s\n", path);
-        // Check if file already exists:
-        if( 0 == stat(path, &st) )
-            show_error("%s: file already exists.", path);
-        // Create new file
-        int fd = creat(path, 0666);
-        if( fd == -1 )
-            show_error("%s: can´t create file, %s", path, strerror(errno));
-        if( fsize != write(fd, fdata, fsize) )
-            show_error("%s: can´t write file, %s", path, strerror(errno));
-        if( close(fd) )
-            show_error("%s: can´t write file, %s", path, strerror(errno));
-        free(path);
-    }
-    else if( atari_list )
-        printf("%08X COM %7u\n", crc, fsize);
-    else
+    const uint8_t *fdata = atr_data_run(atr, 4, fsize);
+    if( !fdata )
     {
-        printf("%8u\t\t/kboot-%08x.xex\n", fsize, crc);
+        atr_msg("%s: missing file data", atr->name);
+        return 1;
     }
-}
 
-static void show_header(struct atr_image *atr, const char *atr_name, int atari_list,
-                        const char *volname)
-{
-    if( atari_list )
-        printf("ATR image: %s\n"
-               "Image size: %u sectors of %u bytes\n"
-               "Volume: %s\n",
-               atr_name, atr->sec_count, atr->sec_size, volname);
-    else
-        printf("%s: %u sectors of %u bytes, %s.\n", atr_name, atr->sec_count,
-               atr->sec_size, volname);
+    unsigned crc = crc32(0, fdata, fsize);
+    snprintf(e->name, sizeof(e->name), "kboot-%08x.xex", crc);
+    snprintf(e->aname, sizeof(e->aname), "%08X COM", crc);
+    e->size = fsize;
+    return 0;
 }
 
-int extra_read(struct atr_image *atr, const char *atr_name, int atari_list,
-               int lower_case, int extract_files)
+int extra_open(struct atrfs *fs)
 {
     // Check BAS2BOOT
-    if( check_bas2boot(atr) )
+    if( check_bas2boot(fs->atr) )
     {
-        show_header(atr, atr_name, atari_list, "BAS2BOOT");
-        extract_bas2boot(atr, atari_list, lower_case, extract_files);
+        fs->info.type = atrfs_bas2boot;
+        strcpy(fs->info.format, "BAS2BOOT");
         return 0;
     }
-    else if( check_kboot(atr) )
+    else if( check_kboot(fs->atr) )
     {
-        show_header(atr, atr_name, atari_list, "K-BOOT");
-        extract_kboot(atr, atr_name, atari_list, lower_case, extract_files);
+        fs->info.type = atrfs_kboot;
+        strcpy(fs->info.format, "K-BOOT");
         return 0;
     }
 
     return 1;
 }
+
+int extra_read_dir(struct atrfs *fs, const struct atrfs_entry *dir, atrfs_dir_cb cb,
+                   void *ctx)
+{
+    // Images contain only one file
+    struct atrfs_entry e;
+    memset(&e, 0, sizeof(e));
+    if( fs->info.type == atrfs_bas2boot )
+        bas2boot_entry(fs, &e);
+    else if( kboot_entry(fs, &e) )
+        return 0;
+    return cb(ctx, &e);
+}
+
+int extra_read_file(struct atrfs *fs, const struct atrfs_entry *file, uint8_t *buf,
+                    unsigned size)
+{
+    if( fs->info.type == atrfs_bas2boot )
+        return read_bas2boot(fs->atr, buf, size);
+    // K-Boot file data is contiguous from sector 4
+    const uint8_t *fdata = atr_data_run(fs->atr, 4, size);
+    if( !fdata )
+        return atr_err_invalid;
+    memcpy(buf, fdata, size);
+    return size;
+}
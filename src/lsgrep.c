@@ -0,0 +1,229 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Searches byte strings inside the files of many images.
+ *
+ * Each image is loaded and searched by one thread of a pool, the output of
+ * each image is collected in memory and shown in the order of the command line.
+ */
+#define _GNU_SOURCE
+#include "lsgrep.h"
+#include "atrfs.h"
+#include "msg.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// One search pattern
+struct pattern
+{
+    char *data;
+    size_t len;
+};
+
+// Results of one image
+struct gimage
+{
+    const char *name;
+    char *out;    // Matches, "image:path:offset" lines
+    size_t len;   //
+    int matches;  // Number of matches
+    int error;    // Error loading the image
+    int errnum;   // Value of errno on open errors
+};
+
+// Shared state of the search
+struct grep
+{
+    struct pattern *pats;
+    int num_pats;
+    struct gimage *images;
+    int num_images;
+    int next; // Next image to search
+    int lower_case;
+    pthread_mutex_t lock;
+};
+
+// State while searching one image
+struct gsearch
+{
+    struct grep *g;
+    struct gimage *gi;
+    struct atrfs *fs;
+    FILE *out;
+    uint8_t *buf;
+    unsigned buf_size;
+};
+
+static int hex_digit(char c)
+{
+    if( c >= '0' && c <= '9' )
+        return c - '0';
+    if( c >= 'a' && c <= 'f' )
+        return c - 'a' + 10;
+    if( c >= 'A' && c <= 'F' )
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Decodes the escapes in the pattern
+static void parse_pattern(struct pattern *p, const char *str)
+{
+    p->data = check_malloc(strlen(str) + 1);
+    p->len  = 0;
+    while( *str )
+    {
+        if( str[0] == '\\' && str[1] == 'x' && hex_digit(str[2]) >= 0 &&
+            hex_digit(str[3]) >= 0 )
+        {
+            p->data[p->len++] = hex_digit(str[2]) * 16 + hex_digit(str[3]);
+            str += 4;
+        }
+        else if( str[0] == '\\' && str[1] == '\\' )
+        {
+            p->data[p->len++] = '\\';
+            str += 2;
+        }
+        else
+            p->data[p->len++] = *str++;
+    }
+    if( !p->len )
+        show_error("empty search pattern.");
+}
+
+static int search_file(void *ctx, const char *path, const struct atrfs_entry *e)
+{
+    struct gsearch *gs = ctx;
+    if( e->is_dir || !e->size )
+        return 0;
+    if( e->size > gs->buf_size )
+    {
+        gs->buf_size = e->size;
+        gs->buf      = check_realloc(gs->buf, gs->buf_size);
+    }
+    int len = atrfs_read_file(gs->fs, e, gs->buf, e->size);
+    if( len <= 0 )
+        return 0;
+
+    for( int i = 0; i < gs->g->num_pats; i++ )
+    {
+        const struct pattern *p = &gs->g->pats[i];
+        const uint8_t *pos      = gs->buf;
+        const uint8_t *end      = gs->buf + len;
+        while( (pos = memmem(pos, end - pos, p->data, p->len)) )
+        {
+            fprintf(gs->out, "%s:%s:%ld\n", gs->gi->name, path, (long)(pos - gs->buf));
+            gs->gi->matches++;
+            pos++;
+        }
+    }
+    return 0;
+}
+
+static void search_image(struct grep *g, struct gimage *gi)
+{
+    struct atr_image *atr;
+    struct gsearch gs = {g, gi, 0, 0, 0, 0};
+
+    gi->error = atr_load_file(&atr, gi->name);
+    if( gi->error )
+    {
+        gi->errnum = errno;
+        return;
+    }
+    gi->error = atrfs_open(&gs.fs, atr, g->lower_case ? atrfs_lower_case : 0);
+    if( !gi->error )
+    {
+        gs.out = open_memstream(&gi->out, &gi->len);
+        if( !gs.out )
+            memory_error();
+        atrfs_walk(gs.fs, search_file, &gs);
+        fclose(gs.out);
+        atrfs_close(gs.fs);
+    }
+    free(gs.buf);
+    atr_free(atr);
+}
+
+static void *worker(void *arg)
+{
+    struct grep *g = arg;
+    for( ;; )
+    {
+        pthread_mutex_lock(&g->lock);
+        int i = g->next < g->num_images ? g->next++ : -1;
+        pthread_mutex_unlock(&g->lock);
+        if( i < 0 )
+            return 0;
+        search_image(g, &g->images[i]);
+    }
+}
+
+int grep_images(char **patterns, int num_patterns, char **images, int num_images,
+                int lower_case)
+{
+    struct grep g;
+    g.pats       = check_calloc(num_patterns, sizeof(struct pattern));
+    g.num_pats   = num_patterns;
+    g.images     = check_calloc(num_images, sizeof(struct gimage));
+    g.num_images = num_images;
+    g.next       = 0;
+    g.lower_case = lower_case;
+    pthread_mutex_init(&g.lock, 0);
+    for( int i = 0; i < num_patterns; i++ )
+        parse_pattern(&g.pats[i], patterns[i]);
+    for( int i = 0; i < num_images; i++ )
+        g.images[i].name = images[i];
+
+    // Start the threads, the current thread also searches
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if( nthreads > num_images )
+        nthreads = num_images;
+    pthread_t *th = check_calloc(nthreads, sizeof(pthread_t));
+    for( long i = 1; i < nthreads; i++ )
+        if( pthread_create(&th[i], 0, worker, &g) )
+            show_error("can't create threads: %s", strerror(errno));
+    worker(&g);
+    for( long i = 1; i < nthreads; i++ )
+        pthread_join(th[i], 0);
+    free(th);
+
+    int matches = 0;
+    for( int i = 0; i < num_images; i++ )
+    {
+        struct gimage *gi = &g.images[i];
+        if( gi->error == atr_err_open )
+            show_msg("can´t open disk image '%s': %s", gi->name, strerror(gi->errnum));
+        else if( gi->error == atr_err_no_fs )
+            show_msg("%s: ATR image format not supported.", gi->name);
+        else if( gi->error )
+            show_msg("%s: %s", gi->name, atr_strerror(gi->error));
+        if( gi->len )
+            fwrite(gi->out, 1, gi->len, stdout);
+        matches += gi->matches;
+        free(gi->out);
+    }
+    for( int i = 0; i < num_patterns; i++ )
+        free(g.pats[i].data);
+    free(g.pats);
+    free(g.images);
+    pthread_mutex_destroy(&g.lock);
+    return matches ? 0 : 1;
+}
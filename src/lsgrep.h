@@ -0,0 +1,26 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Searches byte strings inside the files of many images.
+ */
+#pragma once
+
+// Searches all the patterns in the files of all the images, reading the images
+// in parallel. Patterns can include "\xHH" escapes. Shows each match as
+// "image:path:offset" in the standard output, returns 0 if there were matches.
+int grep_images(char **patterns, int num_patterns, char **images, int num_images,
+                int lower_case);
@@ -17,19 +17,8 @@
 /*
  * Reads a HOWFEN DOS menu disk.
  */
-#define _GNU_SOURCE
 #include "lshowfen.h"
-
-#include "atr.h"
-#include "compat.h"
-#include "msg.h"
-#include <errno.h>
-#include <fcntl.h>
-#include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <unistd.h>
 
 // Read data and write a UNIX filename and an "Atari" filename.
 static unsigned get_name(char *name, char *aname, const uint8_t *data, int max,
@@ -63,7 +52,7 @@ static unsigned get_name(char *name, char *aname, const uint8_t *data, int max,
 }
 
 // Decode decimal length
-int get_len(const uint8_t *p)
+static int get_len(const uint8_t *p)
 {
     int len = 0;
     for( int i = 0; i < 4; i++ )
@@ -74,10 +63,10 @@ int get_len(const uint8_t *p)
     return len;
 }
 
-int howfen_read(struct atr_image *atr, const char *atr_name, int atari_list,
-                int lower_case, int extract_files)
+int howfen_open(struct atrfs *fs)
 {
-    const uint8_t *sec1 = atr_data(atr, 1);
+    struct atr_image *atr = fs->atr;
+    const uint8_t *sec1   = atr_data(atr, 1);
     if( !sec1 )
         return 1;
     // Minimal number of sectors is 10
@@ -101,15 +90,17 @@ int howfen_read(struct atr_image *atr, const char *atr_name, int atari_list,
     {
         ver[0] = 0;
     }
+    fs->info.type = atrfs_howfen;
+    strcpy(fs->info.format, "HOWFEN DOS ");
+    strcat(fs->info.format, ver);
+    return 0;
+}
 
-    if( atari_list )
-        printf("ATR image: %s\n"
-               "Image size: %u sectors of %u bytes\n"
-               "Volume: HOWFEN DOS %s\n",
-               atr_name, atr->sec_count, atr->sec_size, ver);
-    else
-        printf("%s: %u sectors of %u bytes, HOWFEN DOS %s.\n", atr_name, atr->sec_count,
-               atr->sec_size, ver);
+int howfen_read_dir(struct atrfs *fs, const struct atrfs_entry *dir, atrfs_dir_cb cb,
+                    void *ctx)
+{
+    struct atr_image *atr = fs->atr;
+    const uint8_t *sec1   = atr_data(atr, 1);
 
     // This is the actual tables in the loader:
     // $89 + N*$20 : line with letter, name and size
@@ -125,17 +116,17 @@ int howfen_read(struct atr_image *atr, const char *atr_name, int atari_list,
     // $06 ... : Run data
 
     // Read directory
-    char fname[32];
-    char aname[32];
-    for( int i = 0; i < 20; i++ )
+    int ret = 0;
+    for( int i = 0; !ret && i < 20; i++ )
     {
         const uint8_t *pos = sec1 + 0x8A + i * 0x20;
         if( *pos == (0x21 + i) )
         {
+            struct atrfs_entry e;
             // Get file size
             int slen = get_len(pos + 0x1B);
             // Check filename
-            if( get_name(fname, aname, pos + 2, 25, lower_case) )
+            if( get_name(e.name, e.aname, pos + 2, 25, fs->lower_case) )
             {
                 // Get sector number
                 uint16_t snum = sec1[0x32A + i] + (sec1[0x33E + i] << 8);
@@ -145,45 +136,41 @@ int howfen_read(struct atr_image *atr, const char *atr_name, int atari_list,
                 {
                     int ilen = fdata[1] + (fdata[0] == 1 ? 0x100 : 0);
                     if( ilen != slen )
-                        show_msg("length does not match");
+                        atr_msg("length does not match");
                     // Check that we have all the data
                     if( snum + slen - 1 > atr->sec_count )
                     {
-                        show_msg("truncated file");
+                        atr_msg("truncated file");
                         slen = atr->sec_count - snum + 1;
                     }
                 }
                 else
                 {
-                    show_msg("invalid sector number");
+                    atr_msg("invalid sector number");
                     slen = 0;
                 }
-                unsigned fsize = slen * atr->sec_size;
-                if( extract_files )
-                {
-                    struct stat st;
-                    fprintf(stderr, "%s\n", fname);
-                    // Check if file already exists:
-                    if( 0 == stat(fname, &st) )
-                        show_error("%s: file already exists.", fname);
-                    // Create new file
-                    int fd = creat(fname, 0666);
-                    if( fd == -1 )
-                        show_error("%s: can´t create file, %s", fname, strerror(errno));
-                    if( fsize != write(fd, fdata, fsize) )
-                        show_error("%s: can´t write file, %s", fname, strerror(errno));
-                    if( close(fd) )
-                        show_error("%s: can´t write file, %s", fname, strerror(errno));
-                }
-                else if( atari_list )
-                    printf("%-20s %7u\n", aname, fsize);
-                else
-                    printf("%8u\t\t/%s\n", fsize, fname);
+                e.size     = slen * atr->sec_size;
+                e.is_dir   = 0;
+                e.has_date = 0;
+                e.attribs  = 0;
+                e.flags    = 0;
+                e.sector   = snum;
+                ret        = cb(ctx, &e);
             }
         }
         else
-            show_msg("invalid entry at pos %c", 'A' + i);
+            atr_msg("invalid entry at pos %c", 'A' + i);
     }
+    return ret;
+}
 
-    return 0;
+int howfen_read_file(struct atrfs *fs, const struct atrfs_entry *file, uint8_t *buf,
+                     unsigned size)
+{
+    // Data is contiguos on disk, just copy
+    const uint8_t *fdata = atr_data_run(fs->atr, file->sector, size);
+    if( !fdata )
+        return atr_err_invalid;
+    memcpy(buf, fdata, size);
+    return size;
 }
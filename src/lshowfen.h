@@ -1,5 +1,5 @@
 /*
- *  Copyright (C) 2023 Daniel Serpell
+ *  Copyright (C) 2024 Daniel Serpell
  *
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -18,7 +18,10 @@
  * Reads a HOWFEN DOS menu disk.
  */
 #pragma once
-#include "atr.h"
+#include "atrfs.h"
 
-int howfen_read(struct atr_image *atr, const char *atr_name, int atari_list, int lower_case,
-                int extract_files);
+int howfen_open(struct atrfs *fs);
+int howfen_read_dir(struct atrfs *fs, const struct atrfs_entry *dir, atrfs_dir_cb cb,
+                    void *ctx);
+int howfen_read_file(struct atrfs *fs, const struct atrfs_entry *file, uint8_t *buf,
+                     unsigned size);
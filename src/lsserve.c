@@ -0,0 +1,659 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Server mode of lsatr: answers queries about images over a Unix socket.
+ *
+ * Each request is one line with fields separated by TAB characters, the first
+ * field is the command and the second the image file name:
+ *
+ *   INFO <image>          Image and file-system information.
+ *   LIST <image> [<dir>]  Lists one directory, default the root.
+ *   STAT <image> <path>   Shows one entry, in the same format as LIST.
+ *   READ <image> <path>   Returns the contents of one file.
+ *
+ * The reply is "OK <length>" followed by the data, or "ERR <message>". Many
+ * requests can be sent over the same connection.
+ *
+ * Loaded images are kept in a cache, the least recently used are released
+ * when the memory limit is reached. Images are loaded again if the file
+ * changes. The main thread waits for requests in all the connections, and each
+ * connection with a request is handled by one of a pool of threads.
+ */
+#define _GNU_SOURCE
+#include "lsserve.h"
+#include "atrfs.h"
+#include "darray.h"
+#include "msg.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Maximum length of one request line
+#define MAX_REQUEST 4096
+
+//---------------------------------------------------------------------
+// Cache of loaded images
+struct cimage
+{
+    char *path;          // File name, as given in the request
+    dev_t dev;           // File identity, to detect changes
+    ino_t ino;           //
+    off_t size;          //
+    time_t mtime;        //
+    struct atr_image *atr;
+    struct atrfs *fs;
+    size_t mem;          // Memory used by the image data
+    int refs;            // Requests using the image
+    int removed;         // Not in the cache list, free when not used
+    struct cimage *prev; // LRU list, most recently used first
+    struct cimage *next; //
+};
+
+static struct
+{
+    pthread_mutex_t lock;
+    struct cimage *first, *last;
+    size_t mem, max_mem;
+    int lower_case;
+} cache = {PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 0};
+
+static void cimage_free(struct cimage *ci)
+{
+    if( ci->fs )
+        atrfs_close(ci->fs);
+    atr_free(ci->atr);
+    free(ci->path);
+    free(ci);
+}
+
+static void cache_unlink(struct cimage *ci)
+{
+    if( ci->prev )
+        ci->prev->next = ci->next;
+    else
+        cache.first = ci->next;
+    if( ci->next )
+        ci->next->prev = ci->prev;
+    else
+        cache.last = ci->prev;
+    ci->prev = ci->next = 0;
+    cache.mem -= ci->mem;
+    ci->removed = 1;
+}
+
+static void cache_push(struct cimage *ci)
+{
+    ci->prev = 0;
+    ci->next = cache.first;
+    if( cache.first )
+        cache.first->prev = ci;
+    else
+        cache.last = ci;
+    cache.first = ci;
+    cache.mem += ci->mem;
+    ci->removed = 0;
+}
+
+// Releases one reference, the cache must be locked
+static void cache_release(struct cimage *ci)
+{
+    if( !--ci->refs && ci->removed )
+        cimage_free(ci);
+}
+
+// Releases least recently used images until memory is below the limit, the
+// cache must be locked. Images in use are removed from the list and freed
+// when released.
+static void cache_trim(void)
+{
+    struct cimage *ci = cache.last;
+    while( ci && cache.mem > cache.max_mem && ci != cache.first )
+    {
+        struct cimage *prev = ci->prev;
+        cache_unlink(ci);
+        if( !ci->refs )
+            cimage_free(ci);
+        ci = prev;
+    }
+}
+
+static int same_file(const struct cimage *ci, const struct stat *st)
+{
+    return ci->dev == st->st_dev && ci->ino == st->st_ino && ci->size == st->st_size &&
+           ci->mtime == st->st_mtime;
+}
+
+// Returns the image with the given file name, loading it if not in the cache.
+// On errors returns NULL and sets "err" to the error code.
+static struct cimage *cache_get(const char *path, int *err)
+{
+    struct stat st;
+    if( stat(path, &st) )
+    {
+        *err = atr_err_open;
+        return 0;
+    }
+
+    pthread_mutex_lock(&cache.lock);
+    for( struct cimage *ci = cache.first; ci; ci = ci->next )
+    {
+        if( strcmp(ci->path, path) )
+            continue;
+        cache_unlink(ci);
+        if( same_file(ci, &st) )
+        {
+            cache_push(ci);
+            ci->refs++;
+            pthread_mutex_unlock(&cache.lock);
+            return ci;
+        }
+        // File changed, load again
+        if( !ci->refs )
+            cimage_free(ci);
+        break;
+    }
+    pthread_mutex_unlock(&cache.lock);
+
+    // Load outside the lock, other threads can continue
+    struct cimage *ci = check_calloc(1, sizeof(*ci));
+    ci->path          = strdup(path);
+    ci->dev           = st.st_dev;
+    ci->ino           = st.st_ino;
+    ci->size          = st.st_size;
+    ci->mtime         = st.st_mtime;
+    ci->refs          = 1;
+    if( !ci->path )
+        memory_error();
+    *err = atr_load_file(&ci->atr, path);
+    // Images are shared between threads, decompress all the data now
+    if( !*err )
+        *err = atr_load_all(ci->atr);
+    if( !*err )
+        *err = atrfs_open(&ci->fs, ci->atr, cache.lower_case ? atrfs_lower_case : 0);
+    if( *err )
+    {
+        cimage_free(ci);
+        return 0;
+    }
+    ci->mem = (size_t)ci->atr->sec_size * ci->atr->sec_count + sizeof(*ci);
+
+    // Other thread could have loaded the same image meanwhile
+    pthread_mutex_lock(&cache.lock);
+    for( struct cimage *c = cache.first; c; c = c->next )
+    {
+        if( strcmp(c->path, path) )
+            continue;
+        cache_unlink(c);
+        if( same_file(c, &st) )
+        {
+            cache_push(c);
+            c->refs++;
+            pthread_mutex_unlock(&cache.lock);
+            cimage_free(ci);
+            return c;
+        }
+        if( !c->refs )
+            cimage_free(c);
+        break;
+    }
+    cache_push(ci);
+    cache_trim();
+    pthread_mutex_unlock(&cache.lock);
+    return ci;
+}
+
+static void cache_put(struct cimage *ci)
+{
+    pthread_mutex_lock(&cache.lock);
+    cache_release(ci);
+    pthread_mutex_unlock(&cache.lock);
+}
+
+//---------------------------------------------------------------------
+// Path search inside the image
+struct find_ctx
+{
+    const char *name;
+    size_t len;
+    struct atrfs_entry *entry;
+};
+
+static int find_entry(void *ctx, const struct atrfs_entry *e)
+{
+    struct find_ctx *fc = ctx;
+    if( strlen(e->name) != fc->len || strncasecmp(e->name, fc->name, fc->len) )
+        return 0;
+    *fc->entry = *e;
+    return 1;
+}
+
+// Searches the entry with the given path, returns 1 if found, 0 if not found or
+// an error code.
+static int find_path(struct atrfs *fs, const char *path, struct atrfs_entry *entry)
+{
+    *entry = fs->root;
+    for( ;; )
+    {
+        while( *path == '/' )
+            path++;
+        if( !*path )
+            return 1;
+        if( !entry->is_dir )
+            return 0;
+        struct find_ctx fc = {path, strcspn(path, "/"), entry};
+        path += fc.len;
+        struct atrfs_entry dir = *entry;
+        int e = atrfs_read_dir(fs, &dir, find_entry, &fc);
+        if( e <= 0 )
+            return e;
+    }
+}
+
+//---------------------------------------------------------------------
+// Request processing, the reply data is written to "out"
+static void print_entry(FILE *out, const char *dir, const struct atrfs_entry *e)
+{
+    const char *sep = *dir && dir[strlen(dir) - 1] == '/' ? "" : "/";
+    if( e->has_date )
+        fprintf(out, "%u\t%02d-%02d-%02d %02d:%02d:%02d\t%s%s%s%s\n", e->size, e->date[0],
+                e->date[1], e->date[2], e->time[0], e->time[1], e->time[2], dir, sep,
+                e->name, e->is_dir ? "/" : "");
+    else
+        fprintf(out, "%u\t\t%s%s%s%s\n", e->size, dir, sep, e->name, e->is_dir ? "/" : "");
+}
+
+struct list_ctx
+{
+    FILE *out;
+    const char *dir;
+};
+
+static int list_entry(void *ctx, const struct atrfs_entry *e)
+{
+    struct list_ctx *lc = ctx;
+    print_entry(lc->out, lc->dir, e);
+    return 0;
+}
+
+static const char *do_info(struct cimage *ci, FILE *out)
+{
+    const struct atrfs_info *info = &ci->fs->info;
+    fprintf(out,
+            "format\t%s\nsectors\t%u\nsector_size\t%u\nvolume\t%s\n"
+            "free_sectors\t%u\ntotal_sectors\t%u\n",
+            info->format, ci->atr->sec_count, ci->atr->sec_size, info->volume,
+            info->free_sectors, info->total_sectors);
+    return 0;
+}
+
+static const char *do_list(struct cimage *ci, const char *path, FILE *out)
+{
+    struct atrfs_entry dir;
+    int e = find_path(ci->fs, path, &dir);
+    if( e < 0 )
+        return atr_strerror(e);
+    if( !e )
+        return "file not found";
+    if( !dir.is_dir )
+        return "not a directory";
+    struct list_ctx lc = {out, *path ? path : "/"};
+    e = atrfs_read_dir(ci->fs, &dir, list_entry, &lc);
+    return e < 0 ? atr_strerror(e) : 0;
+}
+
+static const char *do_stat(struct cimage *ci, const char *path, FILE *out)
+{
+    struct atrfs_entry ent;
+    int e = find_path(ci->fs, path, &ent);
+    if( e < 0 )
+        return atr_strerror(e);
+    if( !e )
+        return "file not found";
+    // Print the parent directory path before the name
+    const char *base = path + strlen(path);
+    while( base > path && base[-1] == '/' )
+        base--;
+    while( base > path && base[-1] != '/' )
+        base--;
+    char *dir = strndup(path, base - path);
+    if( !dir )
+        memory_error();
+    print_entry(out, dir, &ent);
+    free(dir);
+    return 0;
+}
+
+static const char *do_read(struct cimage *ci, const char *path, FILE *out)
+{
+    struct atrfs_entry ent;
+    int e = find_path(ci->fs, path, &ent);
+    if( e < 0 )
+        return atr_strerror(e);
+    if( !e )
+        return "file not found";
+    if( ent.is_dir )
+        return "is a directory";
+    uint8_t *data = check_malloc(ent.size ? ent.size : 1);
+    e             = atrfs_read_file(ci->fs, &ent, data, ent.size);
+    if( e >= 0 )
+        fwrite(data, 1, e, out);
+    free(data);
+    return e < 0 ? atr_strerror(e) : 0;
+}
+
+// Splits the request in TAB separated fields, returns the number of fields
+static int split_fields(char *line, char **fields, int max)
+{
+    int num = 0;
+    line[strcspn(line, "\r\n")] = 0;
+    while( num < max )
+    {
+        fields[num++] = line;
+        line          = strchr(line, '\t');
+        if( !line )
+            break;
+        *line++ = 0;
+    }
+    return num;
+}
+
+// Processes one request, returns the reply in a new buffer
+static char *process(char *line, size_t *len)
+{
+    char *f[4], *data = 0;
+    const char *err = 0;
+    int n           = split_fields(line, f, 4);
+    FILE *out       = open_memstream(&data, len);
+    if( !out )
+        memory_error();
+
+    int info = !strcmp(f[0], "INFO"), list = !strcmp(f[0], "LIST");
+    int file = !strcmp(f[0], "STAT") || !strcmp(f[0], "READ");
+    if( !info && !list && !file )
+        err = "invalid command";
+    else if( n < 2 || (info && n != 2) || (file && n != 3) || n > 3 )
+        err = "invalid number of arguments";
+    else
+    {
+        int e;
+        struct cimage *ci = cache_get(f[1], &e);
+        if( !ci )
+            err = e == atr_err_open ? strerror(errno) : atr_strerror(e);
+        else
+        {
+            if( info )
+                err = do_info(ci, out);
+            else if( list )
+                err = do_list(ci, n == 3 ? f[2] : "/", out);
+            else if( !strcmp(f[0], "STAT") )
+                err = do_stat(ci, f[2], out);
+            else
+                err = do_read(ci, f[2], out);
+            cache_put(ci);
+        }
+    }
+    fclose(out);
+
+    // Prepend the reply header
+    char *reply;
+    int hlen;
+    if( err )
+        hlen = asprintf(&reply, "ERR %s\n", err);
+    else
+        hlen = asprintf(&reply, "OK %zu\n", *len);
+    if( hlen < 0 )
+        memory_error();
+    if( !err && *len )
+    {
+        reply = check_realloc(reply, hlen + *len);
+        memcpy(reply + hlen, data, *len);
+    }
+    *len = hlen + (err ? 0 : *len);
+    free(data);
+    return reply;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while( len )
+    {
+        ssize_t n = write(fd, buf, len);
+        if( n < 0 && errno == EINTR )
+            continue;
+        if( n <= 0 )
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// One client connection, with the data of an incomplete request
+struct conn
+{
+    int fd;
+    size_t len;
+    char buf[MAX_REQUEST];
+};
+
+// Reads the available data from the client and answers the complete requests,
+// returns -1 if the connection must be closed.
+static int serve_client(struct conn *c)
+{
+    ssize_t n = read(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+    if( n < 0 && (errno == EINTR || errno == EAGAIN) )
+        return 0;
+    if( n <= 0 )
+        return -1;
+    c->len += n;
+    for( ;; )
+    {
+        char *end = memchr(c->buf, '\n', c->len);
+        if( !end )
+        {
+            static const char too_long[] = "ERR request too long\n";
+            if( c->len < sizeof(c->buf) - 1 )
+                return 0;
+            write_all(c->fd, too_long, sizeof(too_long) - 1);
+            return -1;
+        }
+        *end = 0;
+        size_t len;
+        char *reply = process(c->buf, &len);
+        int e       = write_all(c->fd, reply, len);
+        free(reply);
+        if( e )
+            return -1;
+        c->len -= end + 1 - c->buf;
+        memmove(c->buf, end + 1, c->len);
+    }
+}
+
+//---------------------------------------------------------------------
+// Connections with requests, consumed by the worker threads, and connections
+// returned to the main thread to wait for more requests.
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    darray(struct conn *) ready;
+    darray(struct conn *) idle;
+    int wake; // Pipe to wake up the main thread
+} queue = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, {0, 0, 0}, {0, 0, 0}, -1};
+
+static void *worker(void *arg)
+{
+    for( ;; )
+    {
+        pthread_mutex_lock(&queue.lock);
+        while( !darray_len(&queue.ready) )
+            pthread_cond_wait(&queue.cond, &queue.lock);
+        struct conn *c = darray_i(&queue.ready, 0);
+        memmove(queue.ready.data, queue.ready.data + 1,
+                --queue.ready.len * sizeof(queue.ready.data[0]));
+        pthread_mutex_unlock(&queue.lock);
+        if( serve_client(c) )
+        {
+            close(c->fd);
+            free(c);
+            continue;
+        }
+        pthread_mutex_lock(&queue.lock);
+        if( darray_add(&queue.idle, c) )
+            memory_error();
+        pthread_mutex_unlock(&queue.lock);
+        char b = 0;
+        if( write(queue.wake, &b, 1) < 0 && errno != EAGAIN )
+            show_error("can't wake up main thread: %s", strerror(errno));
+    }
+    return 0;
+}
+
+static const char *sock_name;
+
+static void remove_socket(int sig)
+{
+    unlink(sock_name);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+void serve_images(const char *socket_path, int lower_case, size_t cache_size)
+{
+    struct sockaddr_un addr;
+    if( strlen(socket_path) >= sizeof(addr.sun_path) )
+        show_error("socket path too long '%s'.", socket_path);
+
+    cache.max_mem    = cache_size;
+    cache.lower_case = lower_case;
+    int wake[2];
+    if( darray_init(queue.ready, 16) || darray_init(queue.idle, 16) )
+        memory_error();
+    if( pipe(wake) || fcntl(wake[1], F_SETFL, O_NONBLOCK) )
+        show_error("can't create pipe: %s", strerror(errno));
+    queue.wake = wake[1];
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if( sock < 0 )
+        show_error("can't create socket: %s", strerror(errno));
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    // Remove a stale socket from a previous run
+    struct stat st;
+    if( !stat(socket_path, &st) && S_ISSOCK(st.st_mode) )
+        unlink(socket_path);
+    if( bind(sock, (struct sockaddr *)&addr, sizeof(addr)) || listen(sock, 64) )
+        show_error("can't listen on socket '%s': %s", socket_path, strerror(errno));
+
+    sock_name = socket_path;
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, remove_socket);
+    signal(SIGTERM, remove_socket);
+
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if( nthreads < 2 )
+        nthreads = 2;
+    for( long i = 0; i < nthreads; i++ )
+    {
+        pthread_t th;
+        if( pthread_create(&th, 0, worker, 0) )
+            show_error("can't create threads: %s", strerror(errno));
+        pthread_detach(th);
+    }
+    show_msg("serving on '%s' with %ld threads, cache of %zu KB.", socket_path, nthreads,
+             cache_size / 1024);
+
+    // Connections waiting for requests, only handled by the main thread
+    darray(struct conn *) conns;
+    darray(struct pollfd) pfds;
+    if( darray_init(conns, 16) || darray_init(pfds, 16) )
+        memory_error();
+    for( ;; )
+    {
+        // Get the connections returned by the workers
+        pthread_mutex_lock(&queue.lock);
+        for( size_t i = 0; i < darray_len(&queue.idle); i++ )
+            if( darray_add(&conns, darray_i(&queue.idle, i)) )
+                memory_error();
+        darray_len(&queue.idle) = 0;
+        pthread_mutex_unlock(&queue.lock);
+
+        darray_len(&pfds) = 0;
+        struct pollfd p = {sock, POLLIN, 0}, w = {wake[0], POLLIN, 0};
+        if( darray_add(&pfds, p) || darray_add(&pfds, w) )
+            memory_error();
+        for( size_t i = 0; i < darray_len(&conns); i++ )
+        {
+            struct pollfd c = {darray_i(&conns, i)->fd, POLLIN, 0};
+            if( darray_add(&pfds, c) )
+                memory_error();
+        }
+        if( poll(pfds.data, darray_len(&pfds), -1) < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            show_error("can't wait for connections: %s", strerror(errno));
+        }
+        if( darray_i(&pfds, 1).revents )
+        {
+            char buf[256];
+            if( read(wake[0], buf, sizeof(buf)) < 0 && errno != EINTR )
+                show_error("can't read pipe: %s", strerror(errno));
+        }
+
+        // Pass the connections with requests to the workers
+        pthread_mutex_lock(&queue.lock);
+        for( size_t i = darray_len(&conns); i-- > 0; )
+        {
+            if( !darray_i(&pfds, i + 2).revents )
+                continue;
+            if( darray_add(&queue.ready, darray_i(&conns, i)) )
+                memory_error();
+            darray_i(&conns, i) = darray_i(&conns, darray_len(&conns) - 1);
+            darray_len(&conns)--;
+            pthread_cond_signal(&queue.cond);
+        }
+        pthread_mutex_unlock(&queue.lock);
+
+        if( darray_i(&pfds, 0).revents )
+        {
+            int fd = accept(sock, 0, 0);
+            if( fd < 0 )
+            {
+                if( errno == EINTR || errno == ECONNABORTED || errno == EAGAIN )
+                    continue;
+                show_error("can't accept connections: %s", strerror(errno));
+            }
+            struct conn *c = check_calloc(1, sizeof(struct conn));
+            c->fd          = fd;
+            if( darray_add(&conns, c) )
+                memory_error();
+        }
+    }
+}
@@ -0,0 +1,26 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Server mode of lsatr: answers queries about images over a Unix socket,
+ * keeping the recently used images loaded in memory.
+ */
+#pragma once
+#include <stddef.h>
+
+// Serves requests on the socket at the given path, "cache_size" is the maximum
+// memory used by the loaded images, in bytes. Only returns on errors.
+void serve_images(const char *socket_path, int lower_case, size_t cache_size);
@@ -18,7 +18,10 @@
  * Reads a SpartaDOS file-system.
  */
 #pragma once
-#include "atr.h"
+#include "atrfs.h"
 
-int sfs_read(struct atr_image *atr, const char *atr_name, int atari_list, int lower_case,
-             int extract_files);
+int sfs_open(struct atrfs *fs);
+int sfs_read_dir(struct atrfs *fs, const struct atrfs_entry *dir, atrfs_dir_cb cb,
+                 void *ctx);
+int sfs_read_file(struct atrfs *fs, const struct atrfs_entry *file, uint8_t *buf,
+                  unsigned size);
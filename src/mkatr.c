@@ -17,13 +17,23 @@
 /*
  * Creates an ATR with the given files as contents.
  */
+#include "bulkio.h"
+#include "atr.h"
+#include "compat.h"
 #include "disksizes.h"
 #include "flist.h"
+#include "hostfile.h"
 #include "msg.h"
+#include "span.h"
 #include "spartafs.h"
+#include "stats.h"
+#include "trace.h"
+#include "watch.h"
+#include "xex.h"
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 
 static void show_usage(void)
 {
@@ -35,104 +45,251 @@ static void show_usage(void)
            "\t-s size\tSpecify the minimal image size to the given size in bytes.\n"
            "\t-B page\tRelocate the bootloader to this page address. Please, read\n"
            "\t       \tthe documentation before using this option.\n"
+           "\t-n name\tName of the file read from standard input, default 'STDIN'.\n"
+           "\t--stats[=file.json]\n"
+           "\t       \tShow performance statistics, or write them to a JSON file.\n"
+           "\t--span geometry\n"
+           "\t       \tSplit the files between many images of the given geometry,\n"
+           "\t       \tas 'sectors x size', for example '720x128'.\n"
+           "\t--io sync|uring\n"
+           "\t       \tRead the input files one by one, the default, or in batches\n"
+           "\t       \twith io_uring.\n"
+           "\t--io-depth num\n"
+           "\t       \tFiles read at once with io_uring, default 32.\n"
+           "\t--merge-xex\n"
+           "\t       \tMerge the adjacent segments of the boot file, to load faster.\n"
+           "\t--watch\tKeep running, updating the image when the input files change.\n"
+           "\t--trace file.json\n"
+           "\t       \tWrite a timeline of the program, in the trace-event format.\n"
            "\t-h\tShow this help.\n"
            "\t-v\tShow version information.\n"
            "\n"
            "In front of each file, you can also add attributes:\n"
            "\t+h\tHidden from directory.\n"
            "\t+p\tRead-only (protected) file.\n"
-           "\t+a\tArchived file.\n",
+           "\t+a\tArchived file.\n"
+           "\n"
+           "Use '-' as output file name to write the image to standard output, and\n"
+           "as one input file name to read the file from standard input. Output\n"
+           "names ending in '.atz' are written as compressed images.\n"
+           "\n"
+           "Use 'image.atr:' as input to copy all files from other ATR image, or\n"
+           "'image.atr:/path' to copy only one file or directory.\n",
            prog_name);
     exit(EXIT_SUCCESS);
 }
 
-static void write_atr(const char *out, const uint8_t *data, int ssec, int nsec)
+// Returns true if the output name has the ".atz" extension of compressed images
+static int is_compressed(const char *out)
+{
+    size_t len = strlen(out);
+    return len > 4 && !strcasecmp(out + len - 4, ".atz");
+}
+
+static void write_atr(const char *out, const struct sfs *sfs)
 {
-    int size = (nsec > 3) ? ssec * (nsec - 3) + 128 * 3 : 128 * nsec;
+    int ssec = sfs_get_sector_size(sfs);
+    int nsec = sfs_get_num_sectors(sfs);
+    int size = sfs_get_atr_size(sfs);
     show_msg("writing image with %d sectors of %d bytes, total %d bytes.", nsec, ssec,
              size);
+    uint8_t *data = check_malloc(size + 16);
+    size_t len    = size + 16;
+    sfs_write_atr(sfs, data);
+    stats_add(stats_bytes_copied, size + 16);
+    if( is_compressed(out) )
+    {
+        struct atr_image *atr;
+        uint8_t *zdata = 0;
+        int e          = atr_load_mem(&atr, data, len, out);
+        if( !e )
+        {
+            e = atr_compress(atr, &zdata, &len);
+            atr_free(atr);
+        }
+        if( e )
+            show_error("%s: %s", out, atr_strerror(e));
+        free(data);
+        data = zdata;
+        show_msg("compressed image to %zu bytes.", len);
+    }
+    stats_add(stats_bytes_written, len);
+    if( !strcmp(out, "-") )
+    {
+        compat_set_binary(stdout);
+        if( 1 != fwrite(data, len, 1, stdout) || fflush(stdout) )
+            show_error("can't write to standard output: %s", strerror(errno));
+        free(data);
+        return;
+    }
     FILE *f = fopen(out, "wb");
     if( !f )
         show_error("can't open output file '%s': %s", out, strerror(errno));
-    putc(0x96, f);
-    putc(0x02, f);
-    putc(size >> 4, f);
-    putc(size >> 12, f);
-    putc(ssec, f);
-    putc(ssec >> 8, f);
-    putc(size >> 20, f);
-    putc(0, f);
-    putc(0, f);
-    putc(0, f);
-    putc(0, f);
-    putc(0, f);
-    putc(0, f);
-    putc(0, f);
-    putc(0, f);
-    putc(0, f);
+    fwrite(data, len, 1, f);
+    free(data);
+    if( 0 != fclose(f) )
+        show_error("can't write output fil '%s': %s", out, strerror(errno));
+}
 
-    for( int i = 0; i < nsec; i++ )
+// Parses the geometry of the "--span" option, must be one of the standard sizes
+static void parse_geometry(const char *arg, int *nsec, int *ssec)
+{
+    char *ep;
+    *nsec = strtol(arg, &ep, 10);
+    *ssec = (*ep == 'x' || *ep == 'X') ? strtol(ep + 1, &ep, 10) : 0;
+    for( int i = 0; sectors[i].size; i++ )
+        if( !*ep && sectors[i].num == *nsec && sectors[i].size == *ssec )
+            return;
+    show_msg("invalid geometry '%s', valid values are:", arg);
+    for( int i = 0; sectors[i].size; i++ )
+        show_msg("    %dx%d", sectors[i].num, sectors[i].size);
+    show_opt_error("invalid argument for option '--span'");
+}
+
+// Name of one image of a set, adding the number before the extension
+static char *span_name(const char *out, int n)
+{
+    const char *ext = strrchr(out, '.');
+    if( !ext || strpbrk(ext, "/\\") )
+        ext = out + strlen(out);
+    char *name = check_malloc(strlen(out) + 16);
+    sprintf(name, "%.*s%d%s", (int)(ext - out), out, n, ext);
+    return name;
+}
+
+// Splits the files between many images and writes all of them
+static void write_span(const char *out, file_list *flist, int nsec, int ssec,
+                       unsigned boot_addr)
+{
+    file_list *lists;
+    stats_begin(stats_build);
+    int num = span_split(flist, ssec, nsec, &lists);
+    show_msg("splitting files in %d image%s.", num, num > 1 ? "s" : "");
+    struct sfs **images = check_calloc(num, sizeof(struct sfs *));
+    span_build(lists, num, ssec, nsec, boot_addr, images);
+    stats_end(stats_build);
+
+    stats_begin(stats_write);
+    for( int i = 0; i < num; i++ )
     {
-        // First three sectors are 128 bytes
-        if( i < 3 )
-            fwrite(data + ssec * i, 128, 1, f);
-        else
-            fwrite(data + ssec * i, ssec, 1, f);
+        char *name   = span_name(out, i + 1);
+        double start = trace_now();
+        write_atr(name, images[i]);
+        trace_span("write", name, start, 0);
+        free(name);
+        sfs_free(images[i]);
+        flist_free(&lists[i]);
     }
-    if( 0 != fclose(f) )
-        show_error("can't write output fil '%s': %s", out, strerror(errno));
+    stats_end(stats_write);
+    free(images);
+    free(lists);
 }
 
-// Get image size given number of sectors and sector size, taking account for
-// first 3 sectors of 128 bytes.
-static int image_size(int nsec, int ssec)
+// Merges the segments of the boot file, keeping the new data in memory
+static void merge_boot_file(file_list *flist)
 {
-    if( ssec == 256 )
+    struct afile **ptr;
+    darray_foreach(ptr, flist)
     {
-        if( nsec < 3 )
-            return nsec * 128;
-        else
-            return nsec * ssec - 3 * 128;
+        struct afile *f = *ptr;
+        if( !f->boot_file )
+            continue;
+        if( f->read_data && flist_reload_file(f) )
+            show_error("can't read boot file '%s'.", f->fname);
+        uint8_t *data;
+        size_t size;
+        int segs_in, segs_out;
+        if( xex_merge((const uint8_t *)f->data, f->size, &data, &size, &segs_in,
+                      &segs_out) )
+        {
+            show_msg("boot file '%s' is not a valid binary file, not merged.", f->pname);
+            return;
+        }
+        show_msg("boot file '%s', merged %d segments into %d, %ld bytes.", f->pname,
+                 segs_in, segs_out, (long)size);
+        free(f->data);
+        f->data = (char *)data;
+        f->size = size;
     }
-    else
-        return nsec * ssec;
 }
 
-// Get number of sectors needed to hold the given size.
-static int image_sect(int size, int ssec)
+// Measures each image build attempt and adds it to the trace
+static void attempt_hook(int begin, int sector_size, int num_sectors, int err)
 {
-    if( ssec == 256 )
+    static _Thread_local double start;
+    if( begin )
     {
-        if( size < 3 * 128 )
-            return (size + 127) / 128;
-        else
-            return (size + 3 * 128 + 255) / 256;
+        start = trace_now();
+        stats_begin(stats_attempt);
     }
     else
-        return (size + ssec - 1) / ssec;
+    {
+        stats_end(stats_attempt);
+        trace_span("build", "build_spartafs", start,
+                   "\"sector_size\": %d, \"sectors\": %d, \"result\": %d", sector_size,
+                   num_sectors, err);
+    }
+}
+
+// Measures the parts of each attempt
+static void phase_hook(enum sfs_phase phase, int begin)
+{
+    enum stats_phase p = phase == sfs_phase_layout ? stats_layout : stats_crc;
+    if( begin )
+        stats_begin(p);
+    else
+        stats_end(p);
 }
 
 int main(int argc, char **argv)
 {
-    char *out = 0;
+    char *out         = 0;
+    const char *stats = stats_parse_args(argc, argv);
     int i;
-    unsigned boot_addr = 0x07;                   // Standard boot address: $800
-    int boot_file      = 0;                      // Next file is boot file
-    enum fattr attribs = 0;                      // Next file attributes
-    int exact_size     = 0;                      // Use image of exact size
-    int min_size       = 0;                      // Minimum image size
-    const int max_size = image_size(65535, 256); // Maximum image size
+    unsigned boot_addr     = 0x07;                       // Standard boot address: $800
+    int boot_file          = 0;                          // Next file is boot file
+    enum fattr attribs     = 0;                          // Next file attributes
+    int exact_size         = 0;                          // Use image of exact size
+    int min_size           = 0;                          // Minimum image size
+    const int max_size     = sfs_image_size(65535, 512); // Maximum image size
+    const char *stdin_name = "STDIN";                    // Name of file read from stdin
+    int stdin_used         = 0;                          // Stdin already read
+    int watch              = 0;                          // Watch input files
+    int span_nsec          = 0;                          // Geometry of spanned images
+    int span_ssec          = 0;                          //
+    int merge_xex          = 0;                          // Merge boot file segments
 
     prog_name = argv[0];
+    trace_parse_args(argc, argv);
+    bulkio_parse_args(argc, argv);
+    if( trace_enabled || stats_enabled )
+        sfs_set_attempt_hook(attempt_hook);
+    if( stats_enabled )
+        sfs_set_phase_hook(phase_hook);
 
     file_list flist;
-    darray_init(flist, 1);
-    flist_add_main_dir(&flist);
+    if( darray_init(flist, 1) || flist_add_main_dir(&flist) )
+        memory_error();
 
     for( i = 1; i < argc; i++ )
     {
         char *arg = argv[i];
-        if( arg[0] == '-' )
+        if( stats_option(arg) )
+            continue;
+        else if( trace_option(argc, argv, i) || bulkio_option(argc, argv, i) )
+            i++;
+        else if( !strcmp(arg, "--watch") )
+            watch = 1;
+        else if( !strcmp(arg, "--merge-xex") )
+            merge_xex = 1;
+        else if( !strcmp(arg, "--span") )
+        {
+            if( i + 1 >= argc )
+                show_opt_error("option '--span' needs an argument");
+            i++;
+            parse_geometry(argv[i], &span_nsec, &span_ssec);
+        }
+        else if( arg[0] == '-' && arg[1] )
         {
             char op;
             while( 0 != (op = *++arg) )
@@ -157,6 +314,13 @@ int main(int argc, char **argv)
                     if( boot_addr <= 3 || boot_addr >= 0xF0 || !ep || *ep )
                         show_error("argument for option '-B' must be from 3 to 240.");
                 }
+                else if( op == 'n' )
+                {
+                    if( i + 1 >= argc )
+                        show_opt_error("option '-n' needs an argument");
+                    i++;
+                    stdin_name = argv[i];
+                }
                 else if( op == 's' )
                 {
                     char *ep;
@@ -194,9 +358,32 @@ int main(int argc, char **argv)
         }
         else if( !out && boot_file != 1 )
             out = arg;
+        else if( !strcmp(arg, "-") )
+        {
+            if( stdin_used )
+                show_error("standard input can only be used once.");
+            stdin_used = 1;
+            stats_begin(stats_read);
+            flist_add_stdin(&flist, stdin_name, boot_file == 1, attribs);
+            stats_end(stats_read);
+            if( boot_file )
+                boot_file = -1;
+            attribs = 0;
+        }
+        else if( flist_image_path(arg) )
+        {
+            stats_begin(stats_read);
+            flist_add_image(&flist, arg, boot_file == 1, attribs);
+            stats_end(stats_read);
+            if( boot_file )
+                boot_file = -1;
+            attribs = 0;
+        }
         else
         {
+            stats_begin(stats_read);
             flist_add_file(&flist, arg, boot_file == 1, attribs);
+            stats_end(stats_read);
             if( boot_file )
                 boot_file = -1;
             attribs = 0;
@@ -204,53 +391,74 @@ int main(int argc, char **argv)
     }
     if( !out )
         show_opt_error("missing output file name");
+    if( watch && !strcmp(out, "-") )
+        show_error("can't watch files when writing to standard output.");
+    if( watch && is_compressed(out) )
+        show_error("can't watch files when writing a compressed image.");
+    if( merge_xex )
+    {
+        if( watch )
+            show_opt_error("option '--merge-xex' is not compatible with '--watch'");
+        merge_boot_file(&flist);
+    }
+    // Read all the files before building, when watching the data is kept
+    struct watch *wt = 0;
+    if( watch )
+    {
+        stats_begin(stats_read);
+        wt = watch_init(&flist);
+        stats_end(stats_read);
+    }
+    else if( bulkio_batched() )
+    {
+        stats_begin(stats_read);
+        flist_preload(&flist);
+        stats_end(stats_read);
+    }
+    if( span_nsec )
+    {
+        if( watch || exact_size || min_size )
+            show_opt_error("option '--span' is not compatible with '--watch', '-x' or '-s'");
+        if( !strcmp(out, "-") )
+            show_error("can't write many images to standard output.");
+        write_span(out, &flist, span_nsec, span_ssec, boot_addr);
+        flist_free(&flist);
+        stats_report(stats);
+        return 0;
+    }
 
+    stats_begin(stats_build);
     struct sfs *sfs = 0;
-    if( exact_size )
-    {
-        // Try biggest size and the try reducing:
-        if( min_size <= image_size(65535, 128) )
-            sfs = build_spartafs(128, 65535, boot_addr, &flist);
-        if( !sfs )
-            sfs = build_spartafs(256, 65535, boot_addr, &flist);
-        if( sfs )
-        {
-            int nsec = 65535 - sfs_get_free_sectors(sfs);
-            int ssec = sfs_get_sector_size(sfs);
+    int e           = build_spartafs_fit(&sfs, &flist, exact_size, min_size, boot_addr);
+    if( e == mkimage_err_no_space )
+        show_error("can't create an image big enough.");
+    else if( e == mkimage_err_read )
+        show_error("%s", flist_read_error());
+    else if( e )
+        show_error("%s", mkimage_strerror(e));
+    stats_end(stats_build);
 
-            if( image_size(nsec, ssec) < min_size )
-                nsec = image_sect(min_size, ssec);
+    struct sfs_stats st;
+    sfs_get_stats(sfs, &st);
+    stats_add(stats_attempts, st.attempts);
+    stats_add(stats_map_sectors, st.map_sectors);
+    stats_add(stats_data_sectors, st.data_sectors);
+    stats_add(stats_dir_sectors, st.dir_sectors);
+    stats_add(stats_bytes_copied, st.bytes_copied);
 
-            for( ; nsec > 5 && image_size(nsec, ssec) >= min_size; nsec-- )
-            {
-                struct sfs *n = build_spartafs(ssec, nsec, boot_addr, &flist);
-                if( !n )
-                    break;
-                sfs_free(sfs);
-                sfs = n;
-                if( sfs_get_free_sectors(sfs) > 0 &&
-                    image_size(nsec - 1, ssec) > min_size )
-                {
-                    nsec = nsec - sfs_get_free_sectors(sfs) + 1;
-                    if( image_size(nsec, ssec) < min_size )
-                        nsec = 1 + image_sect(min_size, ssec);
-                }
-            }
-        }
-    }
-    else
+    stats_begin(stats_write);
+    double start = trace_now();
+    write_atr(out, sfs);
+    trace_span("write", out, start, 0);
+    stats_end(stats_write);
+    if( watch )
     {
-        for( i = 0; !sfs && sectors[i].size; i++ )
-        {
-            if( image_size(sectors[i].size, sectors[i].num) < min_size )
-                continue;
-            sfs = build_spartafs(sectors[i].size, sectors[i].num, boot_addr, &flist);
-        }
+        struct watch_build opts = {exact_size, min_size, boot_addr};
+        stats_report(stats);
+        watch_inputs(wt, &flist, out, sfs, &opts);
     }
-    if( sfs )
-        write_atr(out, sfs_get_data(sfs), sfs_get_sector_size(sfs),
-                  sfs_get_num_sectors(sfs));
-    else
-        show_error("can't create an image big enough.");
+    sfs_free(sfs);
+    flist_free(&flist);
+    stats_report(stats);
     return 0;
 }
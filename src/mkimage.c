@@ -0,0 +1,266 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Builds SpartaDOS ATR images in memory.
+ */
+#include "mkimage.h"
+#include "flist.h"
+#include "spartafs.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct mkimage
+{
+    file_list flist;
+    int exact_size;
+    int min_size;
+    unsigned boot_addr;
+    int has_boot;
+};
+
+const char *mkimage_strerror(int err)
+{
+    switch( err )
+    {
+        case mkimage_ok: return "no error";
+        case mkimage_err_memory: return "out of memory";
+        case mkimage_err_name: return "invalid file name";
+        case mkimage_err_repeated: return "repeated file/directory name";
+        case mkimage_err_too_big: return "file size too big";
+        case mkimage_err_dir_full: return "too many files in directory";
+        case mkimage_err_not_dir: return "path component is not a directory";
+        case mkimage_err_boot: return "can specify only one boot file";
+        case mkimage_err_option: return "invalid option value";
+        case mkimage_err_no_space: return "can't create an image big enough";
+        case mkimage_err_buffer: return "output buffer too small";
+        case mkimage_err_read: return "error reading file data";
+        case mkimage_err_boot_size: return "boot files need sectors of 128 or 256 bytes";
+        default: return "unknown error";
+    }
+}
+
+struct mkimage *mkimage_new(void)
+{
+    struct mkimage *m = calloc(1, sizeof(struct mkimage));
+    if( !m )
+        return 0;
+    m->boot_addr = 0x07; // Standard boot address: $800
+    if( darray_init(m->flist, 1) )
+    {
+        free(m);
+        return 0;
+    }
+    if( flist_add_main_dir(&m->flist) )
+    {
+        darray_delete(m->flist);
+        free(m);
+        return 0;
+    }
+    return m;
+}
+
+void mkimage_free(struct mkimage *m)
+{
+    if( !m )
+        return;
+    flist_free(&m->flist);
+    free(m);
+}
+
+int mkimage_set_min_size(struct mkimage *m, int size)
+{
+    if( size < 0 || size > sfs_image_size(65535, 512) )
+        return mkimage_err_option;
+    m->min_size = size;
+    return mkimage_ok;
+}
+
+void mkimage_set_exact_size(struct mkimage *m, int exact)
+{
+    m->exact_size = exact;
+}
+
+int mkimage_set_boot_page(struct mkimage *m, unsigned page)
+{
+    if( page <= 3 || page >= 0xF0 )
+        return mkimage_err_option;
+    m->boot_addr = page;
+    return mkimage_ok;
+}
+
+// Searches the parent directory of the path, creating intermediate directories
+// as needed. Returns the position of the last path component in "name".
+static int get_parent(struct mkimage *m, const char *path, time_t mtime,
+                      struct afile **parent, size_t *name)
+{
+    struct afile *dir = m->flist.data[0];
+    size_t start      = 0;
+    for( size_t i = 0; path[i]; i++ )
+    {
+        if( path[i] != '/' )
+            continue;
+        if( i == start )
+        {
+            // Skip empty components
+            start = i + 1;
+            continue;
+        }
+        if( !path[i + 1] )
+            break;
+
+        // Search the directory with this name
+        char *prefix = strndup(path, i);
+        char *aname  = prefix ? flist_atari_name(prefix) : 0;
+        if( !aname )
+        {
+            free(prefix);
+            return mkimage_err_memory;
+        }
+        struct afile *f = flist_find(&m->flist, dir, aname);
+        free(aname);
+        if( f && !f->is_dir )
+        {
+            free(prefix);
+            return mkimage_err_not_dir;
+        }
+        else if( !f )
+        {
+            f = calloc(1, sizeof(struct afile));
+            if( !f )
+            {
+                free(prefix);
+                return mkimage_err_memory;
+            }
+            flist_set_time(f, mtime);
+            f->fname  = prefix;
+            f->dir    = dir;
+            f->is_dir = 1;
+            int e     = flist_add(&m->flist, f);
+            if( e )
+            {
+                free(f);
+                free(prefix);
+                return e;
+            }
+        }
+        free(prefix);
+        dir   = f;
+        start = i + 1;
+    }
+    *parent = dir;
+    *name   = start;
+    return mkimage_ok;
+}
+
+static int add_entry(struct mkimage *m, const char *path, int is_dir, const void *data,
+                     size_t size, unsigned attribs, time_t mtime)
+{
+    struct afile *dir;
+    size_t name;
+    int e = get_parent(m, path, mtime, &dir, &name);
+    if( e )
+        return e;
+    if( !path[name] )
+        return mkimage_err_name;
+
+    int boot_file = !is_dir && (attribs & mkimage_boot);
+    if( boot_file && m->has_boot )
+        return mkimage_err_boot;
+    if( !is_dir && size > SFS_MAX_FILE_SIZE )
+        return mkimage_err_too_big;
+
+    struct afile *f = calloc(1, sizeof(struct afile));
+    if( !f )
+        return mkimage_err_memory;
+    flist_set_time(f, mtime);
+    f->fname     = (char *)path;
+    f->dir       = dir;
+    f->is_dir    = is_dir;
+    f->attribs   = attribs & (at_protected | at_hidden | at_archived);
+    f->boot_file = boot_file;
+    if( !is_dir )
+    {
+        f->size = size;
+        f->data = malloc(size ? size : 1);
+        if( !f->data )
+        {
+            free(f);
+            return mkimage_err_memory;
+        }
+        if( size )
+            memcpy(f->data, data, size);
+    }
+    e = flist_add(&m->flist, f);
+    if( e )
+    {
+        free(f->data);
+        free(f);
+        return e;
+    }
+    if( boot_file )
+        m->has_boot = 1;
+    return mkimage_ok;
+}
+
+int mkimage_add_dir(struct mkimage *m, const char *path, unsigned attribs, time_t mtime)
+{
+    return add_entry(m, path, 1, 0, 0, attribs, mtime);
+}
+
+int mkimage_add_file(struct mkimage *m, const char *path, const void *data, size_t size,
+                     unsigned attribs, time_t mtime)
+{
+    return add_entry(m, path, 0, data, size, attribs, mtime);
+}
+
+int mkimage_build(struct mkimage *m, uint8_t *buf, size_t buf_size, size_t *atr_size)
+{
+    struct sfs *sfs = 0;
+    int e = build_spartafs_fit(&sfs, &m->flist, m->exact_size, m->min_size, m->boot_addr);
+    if( e )
+        return e;
+    size_t size = sfs_get_atr_size(sfs) + 16;
+    if( atr_size )
+        *atr_size = size;
+    if( !buf || buf_size < size )
+        e = mkimage_err_buffer;
+    else
+        sfs_write_atr(sfs, buf);
+    sfs_free(sfs);
+    return e;
+}
+
+int mkimage_build_alloc(struct mkimage *m, uint8_t **atr, size_t *atr_size)
+{
+    struct sfs *sfs = 0;
+    int e = build_spartafs_fit(&sfs, &m->flist, m->exact_size, m->min_size, m->boot_addr);
+    if( e )
+        return e;
+    size_t size = sfs_get_atr_size(sfs) + 16;
+    uint8_t *buf = malloc(size);
+    if( !buf )
+        e = mkimage_err_memory;
+    else
+    {
+        sfs_write_atr(sfs, buf);
+        *atr = buf;
+        if( atr_size )
+            *atr_size = size;
+    }
+    sfs_free(sfs);
+    return e;
+}
@@ -0,0 +1,85 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Builds SpartaDOS ATR images in memory.
+ *
+ * This is the interface of the "libmkatr" library: no function here reads
+ * or writes files, writes to the console or exits the program, all errors are
+ * returned as the negative codes from "enum mkimage_error".
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Error codes returned by the library functions, always negative.
+enum mkimage_error
+{
+    mkimage_ok            = 0,
+    mkimage_err_memory    = -1,  // Out of memory.
+    mkimage_err_name      = -2,  // Invalid file name.
+    mkimage_err_repeated  = -3,  // Repeated file name in the same directory.
+    mkimage_err_too_big   = -4,  // File size too big.
+    mkimage_err_dir_full  = -5,  // Too many files in directory.
+    mkimage_err_not_dir   = -6,  // Path component is not a directory.
+    mkimage_err_boot      = -7,  // Only one boot file is possible.
+    mkimage_err_option    = -8,  // Invalid option value.
+    mkimage_err_no_space  = -9,  // Can't create an image big enough.
+    mkimage_err_buffer    = -10, // Output buffer too small.
+    mkimage_err_read      = -11, // Error reading file data.
+    mkimage_err_boot_size = -12  // Boot file needs 128 or 256 byte sectors.
+};
+
+// File attributes
+enum mkimage_attr
+{
+    mkimage_protected = 1, // Read-only file.
+    mkimage_hidden    = 2, // Hidden from directory.
+    mkimage_archived  = 4, // Archived file.
+    mkimage_boot      = 8  // File loaded at boot, in Atari binary format.
+};
+
+struct mkimage;
+
+// Returns a description of the error code.
+const char *mkimage_strerror(int err);
+
+// Creates a new, empty, image
+struct mkimage *mkimage_new(void);
+void mkimage_free(struct mkimage *m);
+
+// Minimum size of the image in bytes, default 0.
+int mkimage_set_min_size(struct mkimage *m, int size);
+// Use the exact number of sectors needed instead of the standard sizes.
+void mkimage_set_exact_size(struct mkimage *m, int exact);
+// Page of the bootloader, from 4 to 239, default 7.
+int mkimage_set_boot_page(struct mkimage *m, unsigned page);
+
+// Adds a directory at the given path ("DIR/SUB"), parent directories are
+// created as needed.
+int mkimage_add_dir(struct mkimage *m, const char *path, unsigned attribs, time_t mtime);
+// Adds a file at the given path ("DIR/FILE.COM"), the data is copied.
+int mkimage_add_file(struct mkimage *m, const char *path, const void *data, size_t size,
+                     unsigned attribs, time_t mtime);
+
+// Builds the image and writes the ATR file to "buf". If "buf" is NULL or
+// "buf_size" too small returns mkimage_err_buffer; "atr_size" is always set to
+// the size of the ATR file.
+int mkimage_build(struct mkimage *m, uint8_t *buf, size_t buf_size, size_t *atr_size);
+// Builds the image and returns the ATR file in a new buffer, to be released
+// with free().
+int mkimage_build_alloc(struct mkimage *m, uint8_t **atr, size_t *atr_size);
@@ -0,0 +1,533 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Modifies a SpartaDOS file-system.
+ */
+#include "sfsedit.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Size of one directory entry
+#define DIR_ENTRY 23
+
+// Flags of the directory entries
+#define FL_USED   0x08
+#define FL_ERASED 0x10
+#define FL_DIR    0x20
+
+static unsigned read16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static unsigned read24(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16);
+}
+
+static void write16(uint8_t *p, unsigned x)
+{
+    p[0] = x;
+    p[1] = x >> 8;
+}
+
+//---------------------------------------------------------------------
+// Sector bitmap, a bit set means the sector is free. Returns 0 if the sector
+// is not in the file-system or the bitmap sector is outside the bitmap.
+static uint8_t *bitmap_byte(struct atr_image *atr, unsigned sec, int write)
+{
+    const uint8_t *boot = atr_data(atr, 1);
+    if( !sec || sec > read16(boot + 11) )
+        return 0;
+    unsigned bsec = read16(boot + 16) + (sec >> 3) / atr->sec_size;
+    unsigned pos  = (sec >> 3) % atr->sec_size;
+    if( bsec < read16(boot + 16) || bsec >= read16(boot + 16) + boot[15] )
+        return 0;
+    uint8_t *p = write ? atr_data_rw(atr, bsec) : (uint8_t *)atr_data(atr, bsec);
+    return p ? p + pos : 0;
+}
+
+static int is_free(struct atr_image *atr, unsigned sec)
+{
+    const uint8_t *p = bitmap_byte(atr, sec, 0);
+    return p && (*p & (128 >> (sec & 7)));
+}
+
+// Marks the sector as free or used, updating the free sector count
+static int set_free(struct atr_image *atr, unsigned sec, int free)
+{
+    uint8_t *p = bitmap_byte(atr, sec, 1);
+    if( !p )
+        return atr_err_invalid;
+    if( free == is_free(atr, sec) )
+        return atr_ok;
+    uint8_t *boot = atr_data_rw(atr, 1);
+    unsigned num  = read16(boot + 13);
+    if( free )
+    {
+        *p |= 128 >> (sec & 7);
+        write16(boot + 13, num + 1);
+        // Keep the first free sector pointers before the freed sector
+        if( sec < read16(boot + 18) )
+            write16(boot + 18, sec);
+        if( sec < read16(boot + 20) )
+            write16(boot + 20, sec);
+    }
+    else
+    {
+        *p &= ~(128 >> (sec & 7));
+        write16(boot + 13, num - 1);
+    }
+    return atr_ok;
+}
+
+// Allocates a free sector and clears the data, returns 0 if no space
+static unsigned alloc_sector(struct atr_image *atr)
+{
+    unsigned total = read16(atr_data(atr, 1) + 11);
+    if( total > atr->sec_count )
+        total = atr->sec_count;
+    for( unsigned sec = 2; sec <= total; sec++ )
+    {
+        if( is_free(atr, sec) )
+        {
+            set_free(atr, sec, 0);
+            memset(atr_data_rw(atr, sec), 0, atr->sec_size);
+            return sec;
+        }
+    }
+    return 0;
+}
+
+// Frees all the sectors of a file or directory, given the first sector map
+static int free_file(struct atr_image *atr, unsigned map)
+{
+    // Limit the number of maps read to avoid loops in corrupted images
+    for( unsigned n = 0; map && n < atr->sec_count; n++ )
+    {
+        const uint8_t *m = atr_data(atr, map);
+        if( map < 2 || !m )
+            return atr_err_invalid;
+        for( unsigned s = 4; s < atr->sec_size; s += 2 )
+            if( read16(m + s) && set_free(atr, read16(m + s), 1) )
+                return atr_err_invalid;
+        if( set_free(atr, map, 1) )
+            return atr_err_invalid;
+        map = read16(m);
+    }
+    return atr_ok;
+}
+
+//---------------------------------------------------------------------
+// A directory loaded in memory, written back with dir_store()
+struct sdir
+{
+    unsigned map;  // First sector map
+    unsigned *sec; // Data sectors
+    unsigned nsec; // Number of data sectors
+    unsigned size; // Size in bytes, from the header
+    uint8_t *data; // Contents of all the data sectors
+};
+
+static void dir_free(struct sdir *d)
+{
+    free(d->sec);
+    free(d->data);
+    d->sec  = 0;
+    d->data = 0;
+}
+
+static int dir_load(struct atr_image *atr, unsigned map, struct sdir *d)
+{
+    unsigned ssz = atr->sec_size;
+    memset(d, 0, sizeof(*d));
+    d->map = map;
+    for( unsigned n = 0; map && n < atr->sec_count; n++ )
+    {
+        const uint8_t *m = atr_data(atr, map);
+        if( map < 2 || !m )
+            break;
+        for( unsigned s = 4; s < ssz && read16(m + s); s += 2 )
+        {
+            unsigned sec = read16(m + s);
+            if( sec < 2 || !atr_data(atr, sec) )
+            {
+                dir_free(d);
+                return atr_err_invalid;
+            }
+            // Grow the array at each power of two
+            if( !(d->nsec & (d->nsec - 1)) )
+            {
+                unsigned *p = realloc(d->sec, sizeof(unsigned) * (d->nsec ? 2 * d->nsec : 1));
+                if( !p )
+                {
+                    dir_free(d);
+                    return atr_err_memory;
+                }
+                d->sec = p;
+            }
+            d->sec[d->nsec++] = sec;
+        }
+        map = read16(m);
+    }
+    if( !d->nsec )
+        return atr_err_invalid;
+    d->data = malloc(ssz * d->nsec);
+    if( !d->data )
+    {
+        dir_free(d);
+        return atr_err_memory;
+    }
+    for( unsigned i = 0; i < d->nsec; i++ )
+        memcpy(d->data + i * ssz, atr_data(atr, d->sec[i]), ssz);
+    d->size = read24(d->data + 3);
+    if( d->size < DIR_ENTRY || d->size > ssz * d->nsec )
+    {
+        dir_free(d);
+        return atr_err_invalid;
+    }
+    return atr_ok;
+}
+
+// Writes the sectors of the directory that changed
+static void dir_store(struct atr_image *atr, const struct sdir *d)
+{
+    unsigned ssz = atr->sec_size;
+    for( unsigned i = 0; i < d->nsec; i++ )
+        if( memcmp(atr_data(atr, d->sec[i]), d->data + i * ssz, ssz) )
+            memcpy(atr_data_rw(atr, d->sec[i]), d->data + i * ssz, ssz);
+}
+
+// Adds one data sector at the end of the directory
+static int dir_grow(struct atr_image *atr, struct sdir *d)
+{
+    unsigned ssz = atr->sec_size;
+    // Search the last sector map and the first free position
+    unsigned map = d->map, pos = 0;
+    for( unsigned n = 0; n < atr->sec_count; n++ )
+    {
+        const uint8_t *m = atr_data(atr, map);
+        if( !read16(m) )
+        {
+            for( pos = 4; pos < ssz && read16(m + pos); pos += 2 )
+                ;
+            break;
+        }
+        map = read16(m);
+    }
+    if( !pos )
+        return atr_err_invalid;
+    unsigned sec = alloc_sector(atr);
+    if( !sec )
+        return atr_err_no_space;
+    if( pos >= ssz )
+    {
+        // Link a new sector map
+        unsigned nmap = alloc_sector(atr);
+        if( !nmap )
+        {
+            set_free(atr, sec, 1);
+            return atr_err_no_space;
+        }
+        write16(atr_data_rw(atr, map), nmap);
+        write16(atr_data_rw(atr, nmap) + 2, map);
+        map = nmap;
+        pos = 4;
+    }
+    write16(atr_data_rw(atr, map) + pos, sec);
+
+    unsigned *s   = realloc(d->sec, sizeof(unsigned) * (d->nsec + 1));
+    uint8_t *data = s ? realloc(d->data, ssz * (d->nsec + 1)) : 0;
+    if( s )
+        d->sec = s;
+    if( !data )
+        return atr_err_memory;
+    d->data = data;
+    memset(d->data + ssz * d->nsec, 0, ssz);
+    d->sec[d->nsec++] = sec;
+    return atr_ok;
+}
+
+// Sets the size of the directory in the header and in the parent entry
+static int dir_set_size(struct atr_image *atr, struct sdir *d, unsigned size)
+{
+    d->size       = size;
+    d->data[3]    = size;
+    d->data[4]    = size >> 8;
+    d->data[5]    = size >> 16;
+    unsigned pmap = read16(d->data + 1);
+    if( !pmap )
+        return atr_ok;
+    struct sdir parent;
+    int e = dir_load(atr, pmap, &parent);
+    if( e )
+        return e;
+    for( unsigned i = DIR_ENTRY; i < parent.size && parent.data[i]; i += DIR_ENTRY )
+    {
+        uint8_t *ent = parent.data + i;
+        if( (ent[0] & (FL_USED | FL_ERASED | FL_DIR)) == (FL_USED | FL_DIR) &&
+            read16(ent + 1) == d->map )
+        {
+            ent[3] = size;
+            ent[4] = size >> 8;
+            ent[5] = size >> 16;
+        }
+    }
+    dir_store(atr, &parent);
+    dir_free(&parent);
+    return atr_ok;
+}
+
+// Returns the position of a free entry in the directory, growing it if needed
+static int dir_new_entry(struct atr_image *atr, struct sdir *d, unsigned *pos)
+{
+    for( unsigned i = DIR_ENTRY; i < d->size; i += DIR_ENTRY )
+    {
+        if( !(d->data[i] & FL_USED) || (d->data[i] & FL_ERASED) )
+        {
+            *pos = i;
+            return atr_ok;
+        }
+    }
+    // Maximum size of directories is 65535 bytes
+    if( d->size + DIR_ENTRY > 0xFFFF )
+        return atr_err_no_space;
+    while( d->size + DIR_ENTRY > atr->sec_size * d->nsec )
+    {
+        int e = dir_grow(atr, d);
+        if( e )
+            return e;
+    }
+    *pos = d->size;
+    memset(d->data + d->size, 0, DIR_ENTRY);
+    return dir_set_size(atr, d, d->size + DIR_ENTRY);
+}
+
+//---------------------------------------------------------------------
+// Converts one path component to the 8+3 directory name, returns 0 if the
+// name is not valid.
+static int atari_name(uint8_t *aname, const char *name, size_t len)
+{
+    unsigned pos = 0, dot = 0;
+    memset(aname, ' ', 11);
+    for( size_t i = 0; i < len; i++ )
+    {
+        char c = name[i];
+        if( c == '.' && !dot )
+        {
+            if( !pos )
+                return 0;
+            dot = 1;
+            pos = 8;
+            continue;
+        }
+        if( c >= 'a' && c <= 'z' )
+            c = c - 'a' + 'A';
+        if( (pos > 7 && !dot) || pos > 10 ||
+            !((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_') )
+            return 0;
+        aname[pos++] = c;
+    }
+    return pos != 0;
+}
+
+// Position of the entry with the given name in the directory, 0 if not found
+static unsigned dir_find(const struct sdir *d, const uint8_t *aname)
+{
+    for( unsigned i = DIR_ENTRY; i < d->size && d->data[i]; i += DIR_ENTRY )
+    {
+        const uint8_t *ent = d->data + i;
+        if( (ent[0] & FL_USED) && !(ent[0] & FL_ERASED) && !memcmp(ent + 6, aname, 11) )
+            return i;
+    }
+    return 0;
+}
+
+// Loads the directory holding the last component of the path, returning the
+// position of the entry or 0 if it does not exist, and the name in "aname".
+static int find_path(struct atrfs *fs, const char *path, struct sdir *d, unsigned *pos,
+                     uint8_t *aname)
+{
+    struct atr_image *atr = fs->atr;
+    unsigned map          = fs->root.sector;
+    d->sec                = 0;
+    d->data               = 0;
+    for( ;; )
+    {
+        while( *path == '/' )
+            path++;
+        size_t len = strcspn(path, "/");
+        if( !len )
+            return atr_err_name;
+        if( !atari_name(aname, path, len) )
+            return atr_err_name;
+        path += len;
+        while( *path == '/' )
+            path++;
+
+        int e = dir_load(atr, map, d);
+        if( e )
+            return e;
+        *pos = dir_find(d, aname);
+        if( !*path )
+            return atr_ok;
+        if( !*pos || !(d->data[*pos] & FL_DIR) )
+        {
+            dir_free(d);
+            return atr_err_not_found;
+        }
+        map = read16(d->data + *pos + 1);
+        dir_free(d);
+    }
+}
+
+// Returns true if the directory at "map" is inside the directory "sub"
+static int dir_inside(struct atr_image *atr, unsigned map, unsigned sub)
+{
+    for( unsigned n = 0; map && n < 64; n++ )
+    {
+        if( map == sub )
+            return 1;
+        const uint8_t *m = atr_data(atr, map);
+        const uint8_t *h = m ? atr_data(atr, read16(m + 4)) : 0;
+        if( !h )
+            return 0;
+        map = read16(h + 1);
+    }
+    return 0;
+}
+
+//---------------------------------------------------------------------
+int sfs_remove(struct atrfs *fs, const char *path)
+{
+    struct atr_image *atr = fs->atr;
+    struct sdir d, sub;
+    unsigned pos;
+    uint8_t aname[11];
+    if( atr->fd < 0 )
+        return atr_err_read_only;
+    int e = find_path(fs, path, &d, &pos, aname);
+    if( !e && !pos )
+        e = atr_err_not_found;
+    if( e )
+    {
+        dir_free(&d);
+        return e;
+    }
+    uint8_t *ent = d.data + pos;
+    unsigned map = read16(ent + 1);
+    if( ent[0] & FL_DIR )
+    {
+        // Only empty directories can be removed
+        e = dir_load(atr, map, &sub);
+        for( unsigned i = DIR_ENTRY; !e && i < sub.size && sub.data[i]; i += DIR_ENTRY )
+            if( (sub.data[i] & FL_USED) && !(sub.data[i] & FL_ERASED) )
+                e = atr_err_not_empty;
+        dir_free(&sub);
+    }
+    if( !e )
+        e = free_file(atr, map);
+    if( !e )
+    {
+        ent[0] = FL_ERASED;
+        dir_store(atr, &d);
+        // Remove the boot file
+        const uint8_t *boot = atr_data(atr, 1);
+        if( read16(boot + 40) == map )
+            write16(atr_data_rw(atr, 1) + 40, 0);
+    }
+    dir_free(&d);
+    return e;
+}
+
+int sfs_rename(struct atrfs *fs, const char *from, const char *to)
+{
+    struct atr_image *atr = fs->atr;
+    struct sdir src = {0}, dst = {0};
+    unsigned spos, dpos = 0;
+    uint8_t sname[11], dname[11];
+    if( atr->fd < 0 )
+        return atr_err_read_only;
+    int e = find_path(fs, from, &src, &spos, sname);
+    if( !e && !spos )
+        e = atr_err_not_found;
+    // Destination "/" is the root directory
+    int to_root = !to[strspn(to, "/")];
+    if( !e && !to_root )
+        e = find_path(fs, to, &dst, &dpos, dname);
+    if( !e && (to_root || (dpos && (dst.data[dpos] & FL_DIR))) )
+    {
+        // Move inside the existing directory, keeping the name
+        unsigned map = to_root ? fs->root.sector : read16(dst.data + dpos + 1);
+        dir_free(&dst);
+        memcpy(dname, sname, 11);
+        e = dir_load(atr, map, &dst);
+        if( !e )
+            dpos = dir_find(&dst, dname);
+    }
+    if( !e && dpos )
+        e = atr_err_exists;
+    if( e )
+    {
+        dir_free(&src);
+        dir_free(&dst);
+        return e;
+    }
+
+    uint8_t entry[DIR_ENTRY];
+    memcpy(entry, src.data + spos, DIR_ENTRY);
+    memcpy(entry + 6, dname, 11);
+    unsigned map = read16(entry + 1);
+    if( dst.map == src.map )
+    {
+        // Rename in the same directory
+        memcpy(src.data + spos, entry, DIR_ENTRY);
+        dir_store(atr, &src);
+    }
+    else if( (entry[0] & FL_DIR) && dir_inside(atr, dst.map, map) )
+        e = atr_err_name;
+    else if( !(e = dir_new_entry(atr, &dst, &dpos)) )
+    {
+        memcpy(dst.data + dpos, entry, DIR_ENTRY);
+        dir_store(atr, &dst);
+        // Source directory is loaded again, as it could be modified by the
+        // update of the destination size.
+        dir_free(&src);
+        e = find_path(fs, from, &src, &spos, sname);
+        if( !e && spos )
+        {
+            src.data[spos] = FL_ERASED;
+            dir_store(atr, &src);
+        }
+    }
+    // Update the parent and the name in the header of directories
+    if( !e && (entry[0] & FL_DIR) )
+    {
+        struct sdir sub;
+        e = dir_load(atr, map, &sub);
+        if( !e )
+        {
+            write16(sub.data + 1, dst.map);
+            memcpy(sub.data + 6, dname, 11);
+            dir_store(atr, &sub);
+        }
+        dir_free(&sub);
+    }
+    dir_free(&src);
+    dir_free(&dst);
+    return e;
+}
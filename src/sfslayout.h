@@ -0,0 +1,364 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Layout engine of the SpartaDOS file-system builder.
+ *
+ * This file is included from spartafs.c once for each supported sector size,
+ * with SEC_SIZE defined to the size, so the compiler can use shifts and fixed
+ * size copies. All the functions get the sector size appended to the name.
+ */
+#ifndef SEC_SIZE
+#error "SEC_SIZE must be defined before including sfslayout.h"
+#endif
+
+#define FN_CAT(name, size) name##_##size
+#define FN_SIZE(name, size) FN_CAT(name, size)
+#define FN(name) FN_SIZE(name, SEC_SIZE)
+
+static uint8_t *FN(sfs_ptr)(struct sfs *sfs, int sec)
+{
+    return sfs->data + SEC_SIZE * (sec - 1);
+}
+
+static void FN(sfs_free_sec)(struct sfs *sfs, int sec)
+{
+    FN(sfs_ptr)(sfs, sfs->bmap)[sec >> 3] |= (128 >> (sec & 7));
+}
+
+static int FN(sfs_used)(struct sfs *sfs, int sec)
+{
+    return 0 == (FN(sfs_ptr)(sfs, sfs->bmap)[sec >> 3] & (128 >> (sec & 7)));
+}
+
+static int FN(sfs_alloc)(struct sfs *sfs)
+{
+    int sec = sfs->csec;
+    while( sec <= sfs->nsec && FN(sfs_used)(sfs, sec) )
+        sec++;
+    if( sec <= sfs->nsec )
+    {
+        FN(sfs_ptr)(sfs, sfs->bmap)[sec >> 3] &= ~(128 >> (sec & 7));
+        sfs->csec = sec + 1;
+        return sec;
+    }
+    else
+        return -1;
+}
+
+static int FN(sfs_patch_byte)(struct sfs *sfs, int smap, int pos, int byte)
+{
+    int mpos = 4;
+    while( pos >= SEC_SIZE )
+    {
+        pos -= SEC_SIZE;
+        mpos += 2;
+        if( mpos >= SEC_SIZE )
+        {
+            mpos = 4;
+            smap = get_word(FN(sfs_ptr)(sfs, smap));
+            if( smap < 1 || smap > sfs->nsec )
+                return -1;
+        }
+    }
+    int sect = get_word(FN(sfs_ptr)(sfs, smap) + mpos);
+    if( sect < 1 || sect > sfs->nsec )
+        return -1;
+    uint8_t *data = FN(sfs_ptr)(sfs, sect);
+    data[pos]     = byte;
+    return 0;
+}
+
+// Adds the data of a file or directory, allocating the sector maps and data
+// sectors. If "copy" is 0, only the sectors are allocated. Returns the first
+// sector map, -1 if there is no space or -2 on read errors.
+static int FN(sfs_add_data)(struct sfs *sfs, struct afile *af, int copy)
+{
+    int size         = af->size;
+    const char *data = af->data;
+    int last = 0, first = 0;
+    uint8_t *pmap = 0;
+    // Files without data in memory are read directly to the data sectors, joining
+    // contiguous sectors in one read.
+    uint8_t *run   = 0;
+    size_t run_len = 0, pos = 0;
+    do
+    {
+        // Alloc a sector map
+        int smap = FN(sfs_alloc)(sfs);
+        if( smap < 0 )
+            return smap;
+        sfs->stats.map_sectors++;
+
+        if( pmap )
+        {
+            pmap[0] = smap & 0xFF;
+            pmap[1] = smap >> 8;
+        }
+        else
+            first = smap;
+
+        pmap    = FN(sfs_ptr)(sfs, smap);
+        pmap[2] = last & 0xFF;
+        pmap[3] = last >> 8;
+        // Copy data
+        int i;
+        for( i = 4; i < SEC_SIZE && size > 0; i += 2 )
+        {
+            int num = size > SEC_SIZE ? SEC_SIZE : size;
+            int sec = FN(sfs_alloc)(sfs);
+            if( sec < 0 )
+                return sec;
+            pmap[i]     = sec & 0xFF;
+            pmap[i + 1] = sec >> 8;
+            if( copy && data )
+            {
+                memcpy(FN(sfs_ptr)(sfs, sec), data, num);
+                data += num;
+            }
+            else if( copy )
+            {
+                uint8_t *p = FN(sfs_ptr)(sfs, sec);
+                if( run + run_len != p && read_run(af, &run, &run_len, &pos) )
+                    return -2;
+                if( !run_len )
+                    run = p;
+                run_len += num;
+            }
+            if( af->is_dir )
+                sfs->stats.dir_sectors++;
+            else
+                sfs->stats.data_sectors++;
+            if( copy )
+                sfs->stats.bytes_copied += num;
+            size -= num;
+        }
+        last = smap;
+    } while( size );
+    if( copy && !data )
+    {
+        if( read_run(af, &run, &run_len, &pos) )
+            return -2;
+        af->read_data(af, 0, pos, 0);
+    }
+    return first;
+}
+
+// Write the boot sectors, relocated to the given address
+static void FN(write_boot)(struct sfs *sfs, int address)
+{
+    unsigned char data[384];
+    unsigned char *boot;
+    unsigned *reloc;
+    unsigned rsize, i;
+
+    if( sfs->nsec < 3 )
+        return;
+
+#if SEC_SIZE == 128
+    boot  = boot128_bin;
+    reloc = boot128_reloc;
+    rsize = sizeof(boot128_reloc) / sizeof(boot128_reloc[0]);
+#elif SEC_SIZE == 256
+    boot  = boot256_bin;
+    reloc = boot256_reloc;
+    rsize = sizeof(boot256_reloc) / sizeof(boot256_reloc[0]);
+#else
+    // The OS can't boot from 512 byte sectors, there is no loader
+    return;
+#endif
+
+    // Relocate code using reloc table:
+    memcpy(data, boot, 384);
+    for( i = 0; i < rsize; i++ )
+        data[reloc[i] - 1] = data[reloc[i] - 1] + address - 16;
+
+    // Copy boot sectors, always 128 byte size:
+    for( i = 0; i < 3; i++ )
+        memcpy(sfs->data + SEC_SIZE * i, data + 128 * i, 128);
+}
+
+// Builds the image, adding the work done to "acc". If "copy" is 0, only plans
+// the layout without copying the file data.
+static int FN(try_build)(struct sfs **out, int num_sectors, unsigned boot_addr,
+                         file_list *flist, struct sfs_stats *acc, int copy)
+{
+    acc->attempts++;
+    struct sfs *sfs = malloc(sizeof(struct sfs));
+    if( !sfs )
+        return mkimage_err_memory;
+    sfs->data = calloc(SEC_SIZE, num_sectors);
+    if( !sfs->data )
+    {
+        free(sfs);
+        return mkimage_err_memory;
+    }
+    sfs->nsec       = num_sectors;
+    sfs->bmap       = 4;
+    sfs->nbmp       = ((num_sectors + 8) / 8 + SEC_SIZE - 1) / SEC_SIZE;
+    sfs->csec       = 4 + sfs->nbmp;
+    sfs->sec_size   = SEC_SIZE;
+    sfs->boot_map   = 0;
+    memset(&sfs->stats, 0, sizeof(sfs->stats));
+
+    FN(write_boot)(sfs, boot_addr);
+
+    int i;
+    for( i = sfs->csec; i <= sfs->nsec; i++ )
+        FN(sfs_free_sec)(sfs, i);
+
+    // Sort the entries by the level - higher level first
+    call_phase_hook(sfs_phase_layout, 1);
+    qsort(&darray_i(flist, 0), darray_len(flist), sizeof(darray_i(flist, 0)),
+          compare_level);
+
+    // Cleanup all directories
+    struct afile **ptr;
+    darray_foreach(ptr, flist)
+    {
+        struct afile *af = *ptr;
+        if( af->is_dir )
+        {
+            af->size = 23;
+            memset(af->data, 0, 23);
+        }
+    }
+
+    // Add each file
+    int dsec = -1;
+    darray_foreach(ptr, flist)
+    {
+        struct afile *af = *ptr;
+        if( af->is_dir )
+        {
+            int dsize   = af->size;
+            af->data[0] = 0x28;
+            af->data[1] = 0; // Parent dir map,
+            af->data[2] = 0; // written later
+            af->data[3] = dsize & 0xFF;
+            af->data[4] = (dsize >> 8) & 0xFF;
+            af->data[5] = dsize >> 16;
+            memcpy(&af->data[6], af->aname, 11);
+            memcpy(&af->data[17], &af->date, 3);
+            memcpy(&af->data[20], &af->time, 3);
+        }
+        // Add data
+        int msec = FN(sfs_add_data)(sfs, af, copy);
+        if( msec < 0 )
+        {
+            call_phase_hook(sfs_phase_layout, 0);
+            acc->bytes_copied += sfs->stats.bytes_copied;
+            sfs_free(sfs);
+            return msec == -1 ? mkimage_err_no_space : mkimage_err_read;
+        }
+        // Set map sector
+        af->map_sect = msec;
+        // Add to directory
+        struct afile *dir = af->dir;
+        if( dir )
+        {
+            char *cdir = dir->data + dir->size;
+
+            cdir[0] = 0x08 | (af->is_dir ? 0x20 : 0x00) | af->attribs;
+            cdir[1] = msec & 0xFF;
+            cdir[2] = msec >> 8;
+            cdir[3] = af->size & 0xFF;
+            cdir[4] = (af->size >> 8) & 0xFF;
+            cdir[5] = af->size >> 16;
+            memcpy(&cdir[6], af->aname, 11);
+            memcpy(&cdir[17], &af->date, 3);
+            memcpy(&cdir[20], &af->time, 3);
+
+            // The number of entries is checked when adding files
+            dir->size += 23;
+        }
+        else
+            // This is the main directory, remember location
+            dsec = msec;
+
+        if( af->boot_file )
+            sfs->boot_map = msec;
+    }
+
+    // Set the "parent" directory to all sub-directories
+    darray_foreach(ptr, flist)
+    {
+        struct afile *af = *ptr;
+        if( af->is_dir && af->dir )
+        {
+            int parent = af->dir->map_sect;
+            FN(sfs_patch_byte)(sfs, af->map_sect, 1, parent & 0xFF);
+            FN(sfs_patch_byte)(sfs, af->map_sect, 2, parent >> 8);
+        }
+    }
+    call_phase_hook(sfs_phase_layout, 0);
+
+    // Check main directory
+    if( dsec < 0 )
+    {
+        sfs_free(sfs);
+        return mkimage_err_name;
+    }
+
+    // Get's CRC32 of current data, only needed for the final image
+    unsigned crc = 0;
+    if( copy )
+    {
+        call_phase_hook(sfs_phase_crc, 1);
+        crc = crc32(0, sfs->data, SEC_SIZE * sfs->nsec);
+        call_phase_hook(sfs_phase_crc, 0);
+    }
+
+    sfs->data[1]  = 0x03;
+    sfs->data[7]  = 0x80;
+    sfs->data[9]  = dsec & 0xFF;
+    sfs->data[10] = dsec >> 8;
+    sfs->data[11] = sfs->nsec & 0xFF;
+    sfs->data[12] = sfs->nsec >> 8;
+    sfs->data[13] = (sfs->nsec - sfs->csec + 1) & 0xFF;
+    sfs->data[14] = (sfs->nsec - sfs->csec + 1) >> 8;
+    sfs->data[15] = sfs->nbmp;
+    sfs->data[16] = sfs->bmap & 0xFF;
+    sfs->data[17] = sfs->bmap >> 8;
+    sfs->data[18] = sfs->csec & 0xFF;
+    sfs->data[19] = sfs->csec >> 8;
+    sfs->data[20] = sfs->csec & 0xFF;
+    sfs->data[21] = sfs->csec >> 8;
+    sfs->data[22] = 'D';
+    sfs->data[23] = 'S';
+    sfs->data[24] = 'K';
+    sfs->data[25] = '_';
+    sfs->data[26] = hex(crc >> 8);
+    sfs->data[27] = hex(crc >> 12);
+    sfs->data[28] = hex(crc >> 16);
+    sfs->data[29] = hex(crc >> 20);
+    sfs->data[30] = 0x28;
+    sfs->data[31] = SEC_SIZE == 128 ? 0x80 : SEC_SIZE >> 9;
+    sfs->data[32] = 0x20;
+    sfs->data[39] = crc & 0xFF;
+    sfs->data[40] = sfs->boot_map & 0xFF;
+    sfs->data[41] = sfs->boot_map >> 8;
+
+    acc->bytes_copied += sfs->stats.bytes_copied;
+    sfs->stats.attempts     = acc->attempts;
+    sfs->stats.bytes_copied = acc->bytes_copied;
+    *out                    = sfs;
+    return mkimage_ok;
+}
+
+#undef FN
+#undef FN_SIZE
+#undef FN_CAT
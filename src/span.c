@@ -0,0 +1,380 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Splits a list of files between many images of the same geometry.
+ *
+ * The unit of packing is one entry of the main directory, a file or a whole
+ * directory tree, so directories are kept in one image when possible; only
+ * directories bigger than one image are split in their entries. The entries
+ * are sorted by size and each one is placed in the first image with space,
+ * recreating the parent directories as needed.
+ *
+ * The space used is calculated exactly, as the SpartaDOS builder allocates
+ * sectors sequentially: each file or directory uses the data sectors plus the
+ * sector maps, and each directory grows 23 bytes for each entry.
+ */
+#include "span.h"
+#include "hostfile.h"
+#include "msg.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// One entry of the original list
+struct node
+{
+    struct afile *f;
+    struct node *parent;
+    int nchild;  // Number of entries, for directories
+    long cost;   // Sectors used by the entry and all the entries inside
+    int boot;    // The tree includes the boot file
+    int disk;    // Image that holds all the tree, -1 if split or not placed
+    int *counts; // Number of entries on each image, for split directories
+};
+
+// One unit of packing
+struct item
+{
+    struct node *n;
+    long cost;
+};
+
+// Space used in one image
+struct disk
+{
+    long used;
+};
+
+// State of the split
+struct span
+{
+    struct node *nodes;
+    int num_nodes;
+    struct item *items;
+    int num_items;
+    struct disk *disks;
+    int num_disks;
+    int ssec;
+    long capacity;
+};
+
+// Sectors used by a file or directory of the given size
+static long data_cost(long size, int ssec)
+{
+    long data = (size + ssec - 1) / ssec;
+    long per  = (ssec - 4) / 2;
+    long maps = data ? (data + per - 1) / per : 1;
+    return data + maps;
+}
+
+static long dir_cost(int entries, int ssec)
+{
+    return data_cost(23L * (entries + 1), ssec);
+}
+
+static int cmp_node(const void *a, const void *b)
+{
+    const struct afile *fa = ((const struct node *)a)->f;
+    const struct afile *fb = ((const struct node *)b)->f;
+    return fa < fb ? -1 : fa > fb;
+}
+
+static struct node *find_node(struct span *sp, const struct afile *f)
+{
+    struct node key = {(struct afile *)f, 0, 0, 0, 0, 0, 0};
+    return bsearch(&key, sp->nodes, sp->num_nodes, sizeof(struct node), cmp_node);
+}
+
+static int cmp_item(const void *a, const void *b)
+{
+    const struct item *ia = a, *ib = b;
+    if( ia->cost != ib->cost )
+        return ia->cost < ib->cost ? 1 : -1;
+    return strcmp(ia->n->f->pname, ib->n->f->pname);
+}
+
+// Adds the entries inside the directory as items, splitting the directories
+// bigger than one image.
+static void add_items(struct span *sp, struct node *dir)
+{
+    for( int i = 0; i < sp->num_nodes; i++ )
+    {
+        struct node *n = &sp->nodes[i];
+        if( n->parent != dir )
+            continue;
+        if( n->cost > sp->capacity && n->f->is_dir )
+        {
+            n->counts = check_calloc(sp->num_nodes, sizeof(int));
+            add_items(sp, n);
+        }
+        else if( n->cost > sp->capacity )
+            show_error("file '%s' does not fit in one image.", n->f->pname);
+        else
+        {
+            sp->items[sp->num_items].n    = n;
+            sp->items[sp->num_items].cost = n->cost;
+            sp->num_items++;
+        }
+    }
+}
+
+// Returns the sectors needed to add the tree of "n" to the image "d", with the
+// growth of the parent directories and the split directories that must be
+// created. If "add" is set, the new entries are recorded.
+static long place_cost(struct span *sp, struct node *n, int d, int add)
+{
+    long cost = n->cost;
+    for( struct node *p = n->parent; p; p = p->parent )
+    {
+        int old = p->counts[d];
+        if( add )
+            p->counts[d]++;
+        if( old || !p->parent )
+        {
+            // Directory already in the image, grows by one entry
+            cost += dir_cost(old + 1, sp->ssec) - dir_cost(old, sp->ssec);
+            break;
+        }
+        // New directory in this image, also adds one entry to its parent
+        cost += dir_cost(1, sp->ssec);
+    }
+    return cost;
+}
+
+// Checks if the entry must be copied to the image "d"
+static int in_image(const struct node *n, int d)
+{
+    if( n->counts )
+        return n->counts[d] > 0;
+    for( ; n; n = n->parent )
+        if( n->disk >= 0 )
+            return n->disk == d;
+    return 0;
+}
+
+int span_split(file_list *flist, int sector_size, int num_sectors, file_list **lists)
+{
+    struct span sp;
+    int nbmp       = ((num_sectors + 8) / 8 + sector_size - 1) / sector_size;
+    sp.ssec        = sector_size;
+    sp.num_nodes   = darray_len(flist);
+    sp.nodes       = check_calloc(sp.num_nodes, sizeof(struct node));
+    sp.items       = check_calloc(sp.num_nodes, sizeof(struct item));
+    sp.num_items   = 0;
+    sp.disks       = 0;
+    sp.num_disks   = 0;
+    sp.capacity    = num_sectors - 3 - nbmp - dir_cost(0, sector_size);
+
+    // Calculate the size of each tree, deepest entries first
+    for( int i = 0; i < sp.num_nodes; i++ )
+    {
+        sp.nodes[i].f    = darray_i(flist, i);
+        sp.nodes[i].disk = -1;
+    }
+    qsort(sp.nodes, sp.num_nodes, sizeof(struct node), cmp_node);
+    struct node *root = 0;
+    int max_level     = 0;
+    for( int i = 0; i < sp.num_nodes; i++ )
+    {
+        struct node *n = &sp.nodes[i];
+        n->parent      = n->f->dir ? find_node(&sp, n->f->dir) : 0;
+        if( n->parent )
+            n->parent->nchild++;
+        else
+            root = n;
+        if( n->f->level > max_level )
+            max_level = n->f->level;
+    }
+    for( int level = max_level; level >= 0; level-- )
+        for( int i = 0; i < sp.num_nodes; i++ )
+        {
+            struct node *n = &sp.nodes[i];
+            if( n->f->level != level )
+                continue;
+            if( n->f->is_dir )
+                n->cost += dir_cost(n->nchild, sector_size);
+            else
+                n->cost = data_cost(n->f->size, sector_size);
+            n->boot |= n->f->boot_file;
+            if( n->parent )
+            {
+                n->parent->cost += n->cost;
+                n->parent->boot |= n->boot;
+            }
+        }
+
+    // Get the items and place them, the boot file always in the first image
+    root->counts = check_calloc(sp.num_nodes, sizeof(int));
+    add_items(&sp, root);
+    qsort(sp.items, sp.num_items, sizeof(struct item), cmp_item);
+    for( int i = 0; i < sp.num_items; i++ )
+    {
+        if( sp.items[i].n->boot && i )
+        {
+            struct item boot = sp.items[i];
+            memmove(sp.items + 1, sp.items, i * sizeof(struct item));
+            sp.items[0] = boot;
+        }
+    }
+    for( int i = 0; i < sp.num_items; i++ )
+    {
+        struct item *it = &sp.items[i];
+        int d;
+        for( d = 0; d < sp.num_disks; d++ )
+            if( sp.disks[d].used + place_cost(&sp, it->n, d, 0) <= sp.capacity )
+                break;
+        if( d == sp.num_disks )
+        {
+            // New image, the number of images is never more than the items
+            sp.num_disks++;
+            sp.disks = check_realloc(sp.disks, sp.num_disks * sizeof(struct disk));
+            sp.disks[d].used = 0;
+            if( place_cost(&sp, it->n, d, 0) > sp.capacity )
+                show_error("'%s' does not fit in one image.", it->n->f->pname);
+        }
+        sp.disks[d].used += place_cost(&sp, it->n, d, 1);
+        it->n->disk = d;
+    }
+
+    // Create the new lists, copying the entries in the original order so that
+    // parents are added before the entries inside.
+    file_list *out = check_calloc(sp.num_disks, sizeof(file_list));
+    struct afile **copy = check_calloc(sp.num_nodes, sizeof(struct afile *));
+    for( int d = 0; d < sp.num_disks; d++ )
+    {
+        if( darray_init(out[d], 1) || flist_add_main_dir(&out[d]) )
+            memory_error();
+        memcpy(darray_i(&out[d], 0)->date, root->f->date, 3);
+        memcpy(darray_i(&out[d], 0)->time, root->f->time, 3);
+        memset(copy, 0, sp.num_nodes * sizeof(struct afile *));
+        struct afile **ptr;
+        darray_foreach(ptr, flist)
+        {
+            struct node *n = find_node(&sp, *ptr);
+            if( n == root )
+            {
+                copy[n - sp.nodes] = darray_i(&out[d], 0);
+                continue;
+            }
+            if( !in_image(n, d) )
+                continue;
+
+            struct afile *f = check_malloc(sizeof(struct afile));
+            *f              = *n->f;
+            f->aname = f->pname = 0;
+            f->dir              = copy[n->parent - sp.nodes];
+            if( !f->is_dir && f->data )
+            {
+                f->data = check_malloc(f->size ? f->size : 1);
+                memcpy(f->data, n->f->data, f->size);
+            }
+            else if( f->is_dir )
+                f->data = 0;
+            if( flist_add(&out[d], f) )
+                show_error("internal error - can't copy '%s'", n->f->pname);
+            copy[n - sp.nodes] = f;
+        }
+    }
+
+    for( int i = 0; i < sp.num_nodes; i++ )
+        free(sp.nodes[i].counts);
+    free(copy);
+    free(sp.nodes);
+    free(sp.items);
+    free(sp.disks);
+    *lists = out;
+    return sp.num_disks;
+}
+
+// Parameters of the parallel builds
+struct build_job
+{
+    file_list *lists;
+    struct sfs **images;
+    int num, next;
+    int ssec, nsec;
+    unsigned boot_addr;
+    pthread_mutex_t lock;
+    // First error, reported after all the threads end
+    int err;
+    int err_image;
+    char *err_msg;
+};
+
+static void *build_worker(void *arg)
+{
+    struct build_job *sb = arg;
+    for( ;; )
+    {
+        pthread_mutex_lock(&sb->lock);
+        int i = sb->next < sb->num ? sb->next++ : -1;
+        pthread_mutex_unlock(&sb->lock);
+        if( i < 0 )
+            return 0;
+        int e = build_spartafs(&sb->images[i], sb->ssec, sb->nsec, sb->boot_addr,
+                               &sb->lists[i]);
+        if( e )
+        {
+            const char *msg = e == mkimage_err_read ? flist_read_error()
+                                                    : mkimage_strerror(e);
+            pthread_mutex_lock(&sb->lock);
+            if( !sb->err )
+            {
+                sb->err       = e;
+                sb->err_image = i;
+                sb->err_msg   = strdup(msg);
+            }
+            // Don't start more images
+            sb->next = sb->num;
+            pthread_mutex_unlock(&sb->lock);
+        }
+    }
+}
+
+void span_build(file_list *lists, int num, int sector_size, int num_sectors,
+                unsigned boot_addr, struct sfs **images)
+{
+    struct build_job sb;
+    sb.lists     = lists;
+    sb.images    = images;
+    sb.num       = num;
+    sb.next      = 0;
+    sb.ssec      = sector_size;
+    sb.nsec      = num_sectors;
+    sb.boot_addr = boot_addr;
+    sb.err       = 0;
+    sb.err_msg   = 0;
+    pthread_mutex_init(&sb.lock, 0);
+
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if( nthreads > num )
+        nthreads = num;
+    pthread_t *th = check_calloc(nthreads, sizeof(pthread_t));
+    for( long i = 1; i < nthreads; i++ )
+        if( pthread_create(&th[i], 0, build_worker, &sb) )
+            show_error("can't create threads: %s", strerror(errno));
+    build_worker(&sb);
+    for( long i = 1; i < nthreads; i++ )
+        pthread_join(th[i], 0);
+    free(th);
+    pthread_mutex_destroy(&sb.lock);
+    if( sb.err )
+        show_error("image %d: %s", sb.err_image + 1,
+                   sb.err_msg ? sb.err_msg : mkimage_strerror(sb.err));
+}
@@ -0,0 +1,31 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Splits a list of files between many images of the same geometry.
+ */
+#pragma once
+#include "spartafs.h"
+
+// Splits the files between the minimum number of images with "num_sectors"
+// sectors of "sector_size" bytes, using first-fit-decreasing over the entries
+// of the main directory; directories that don't fit in one image are split in
+// their entries. Returns the number of images, and the new lists in "lists".
+int span_split(file_list *flist, int sector_size, int num_sectors, file_list **lists);
+
+// Builds all the images in parallel, returns the images in "images".
+void span_build(file_list *lists, int num, int sector_size, int num_sectors,
+                unsigned boot_addr, struct sfs **images);
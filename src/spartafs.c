@@ -21,8 +21,9 @@
 #include "asm/boot128.h"
 #include "asm/boot256.h"
 #include "crc32.h"
-#include "msg.h"
+#include "disksizes.h"
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 static char hex(int x)
@@ -39,294 +40,237 @@ struct sfs
     int csec;
     int boot_map;
     int sec_size;
+    struct sfs_stats stats;
 };
 
-static uint8_t *sfs_ptr(struct sfs *sfs, int sec)
+static int get_word(const uint8_t *data)
 {
-    return sfs->data + sfs->sec_size * (sec - 1);
+    return (data[0] & 0xFF) + ((data[1] & 0xFF) << 8);
 }
 
-static void sfs_free_sec(struct sfs *sfs, int sec)
+// Reads a run of contiguous sectors from the file source
+static int read_run(struct afile *af, uint8_t **run, size_t *run_len, size_t *pos)
 {
-    sfs_ptr(sfs, sfs->bmap)[sec >> 3] |= (128 >> (sec & 7));
+    if( !*run_len )
+        return 0;
+    if( af->read_data(af, *run, *pos, *run_len) )
+        return -2;
+    *pos += *run_len;
+    *run_len = 0;
+    return 0;
+}
+
+// Sorting function: sort by level, then directories first and last by file name
+static int compare_level(const void *a, const void *b)
+{
+    const struct afile *fa = *(const struct afile *const *)a;
+    const struct afile *fb = *(const struct afile *const *)b;
+    if( fb->level != fa->level )
+        return fb->level - fa->level;
+    if( fb->is_dir != fa->is_dir )
+        return fb->is_dir - fa->is_dir;
+    return strncmp(fa->aname, fb->aname, 11);
 }
 
-static int sfs_used(struct sfs *sfs, int sec)
+// Function called around each build attempt
+static void (*attempt_hook)(int begin, int sector_size, int num_sectors, int err);
+
+void sfs_set_attempt_hook(void (*hook)(int begin, int sector_size, int num_sectors,
+                                       int err))
 {
-    return 0 == (sfs_ptr(sfs, sfs->bmap)[sec >> 3] & (128 >> (sec & 7)));
+    attempt_hook = hook;
 }
 
-static int sfs_alloc(struct sfs *sfs)
+// Function called around each part of the attempts
+static void (*phase_hook)(enum sfs_phase phase, int begin);
+
+void sfs_set_phase_hook(void (*hook)(enum sfs_phase phase, int begin))
 {
-    int sec = sfs->csec;
-    while( sec <= sfs->nsec && sfs_used(sfs, sec) )
-        sec++;
-    if( sec <= sfs->nsec )
-    {
-        sfs_ptr(sfs, sfs->bmap)[sec >> 3] &= ~(128 >> (sec & 7));
-        sfs->csec = sec + 1;
-        return sec;
-    }
-    else
-        return -1;
+    phase_hook = hook;
 }
 
-static int get_word(const uint8_t *data)
+static void call_phase_hook(enum sfs_phase phase, int begin)
 {
-    return (data[0] & 0xFF) + ((data[1] & 0xFF) << 8);
+    if( phase_hook )
+        phase_hook(phase, begin);
 }
 
-static int sfs_patch_byte(struct sfs *sfs, int smap, int pos, int byte)
+// Layout engine, instantiated for each sector size so that the sector
+// arithmetic is done with constants.
+#define SEC_SIZE 128
+#include "sfslayout.h"
+#undef SEC_SIZE
+#define SEC_SIZE 256
+#include "sfslayout.h"
+#undef SEC_SIZE
+#define SEC_SIZE 512
+#include "sfslayout.h"
+#undef SEC_SIZE
+
+static int has_boot_file(const file_list *flist)
 {
-    int mpos = 4;
-    while( pos >= sfs->sec_size )
+    struct afile **ptr;
+    darray_foreach(ptr, flist)
     {
-        pos -= sfs->sec_size;
-        mpos += 2;
-        if( mpos >= sfs->sec_size )
-        {
-            mpos = 4;
-            smap = get_word(sfs_ptr(sfs, smap));
-            if( smap < 1 || smap > sfs->nsec )
-                return -1;
-        }
+        if( (*ptr)->boot_file )
+            return 1;
     }
-    int sect = get_word(sfs_ptr(sfs, smap) + mpos);
-    if( sect < 1 || sect > sfs->nsec )
-        return -1;
-    uint8_t *data = sfs_ptr(sfs, sect);
-    data[pos]     = byte;
     return 0;
 }
 
-static int sfs_add_data(struct sfs *sfs, char *data, int size)
+static int build_image(struct sfs **out, int sector_size, int num_sectors,
+                       unsigned boot_addr, file_list *flist, struct sfs_stats *acc,
+                       int copy)
 {
-    int sec_size = sfs->sec_size;
-    int last = 0, first = 0;
-    uint8_t *pmap = 0;
-    do
-    {
-        // Alloc a sector map
-        int smap = sfs_alloc(sfs);
-        if( smap < 0 )
-            return smap;
-
-        if( pmap )
-        {
-            pmap[0] = smap & 0xFF;
-            pmap[1] = smap >> 8;
-        }
-        else
-            first = smap;
-
-        pmap    = sfs_ptr(sfs, smap);
-        pmap[2] = last & 0xFF;
-        pmap[3] = last >> 8;
-        // Copy data
-        int i;
-        for( i = 4; i < sec_size && size > 0; i += 2 )
-        {
-            int num = size > sec_size ? sec_size : size;
-            int sec = sfs_alloc(sfs);
-            if( sec < 0 )
-                return sec;
-            pmap[i]     = sec & 0xFF;
-            pmap[i + 1] = sec >> 8;
-            memcpy(sfs_ptr(sfs, sec), data, num);
-            size -= num;
-            data += num;
-        }
-        last = smap;
-    } while( size );
-    return first;
+    if( attempt_hook )
+        attempt_hook(1, sector_size, num_sectors, 0);
+    int e = mkimage_err_option;
+    if( sector_size == 128 )
+        e = try_build_128(out, num_sectors, boot_addr, flist, acc, copy);
+    else if( sector_size == 256 )
+        e = try_build_256(out, num_sectors, boot_addr, flist, acc, copy);
+    else if( sector_size == 512 && has_boot_file(flist) )
+        e = mkimage_err_boot_size;
+    else if( sector_size == 512 )
+        e = try_build_512(out, num_sectors, boot_addr, flist, acc, copy);
+    if( attempt_hook )
+        attempt_hook(0, sector_size, num_sectors, e);
+    return e;
 }
 
-// Write the boot sectors, relocated to the given address
-static void write_boot(struct sfs *sfs, int address)
+int build_spartafs(struct sfs **out, int sector_size, int num_sectors, unsigned boot_addr,
+                   file_list *flist)
 {
-    unsigned char data[384];
-    unsigned char *boot;
-    unsigned *reloc;
-    unsigned rsize, i;
-
-    if( sfs->nsec < 3 )
-        return;
+    struct sfs_stats acc;
+    memset(&acc, 0, sizeof(acc));
+    return build_image(out, sector_size, num_sectors, boot_addr, flist, &acc, 1);
+}
 
-    if( sfs->sec_size == 128 )
-    {
-        boot  = boot128_bin;
-        reloc = boot128_reloc;
-        rsize = sizeof(boot128_reloc) / sizeof(boot128_reloc[0]);
-    }
-    else if( sfs->sec_size == 256 )
+int sfs_image_size(int nsec, int ssec)
+{
+    if( ssec == 256 )
     {
-        boot  = boot256_bin;
-        reloc = boot256_reloc;
-        rsize = sizeof(boot256_reloc) / sizeof(boot256_reloc[0]);
+        if( nsec < 3 )
+            return nsec * 128;
+        else
+            return nsec * ssec - 3 * 128;
     }
     else
-        return;
-
-    // Relocate code using reloc table:
-    memcpy(data, boot, 384);
-    for( i = 0; i < rsize; i++ )
-        data[reloc[i] - 1] = data[reloc[i] - 1] + address - 16;
-
-    // Copy boot sectors, always 128 byte size:
-    for( i = 0; i < 3; i++ )
-        memcpy(sfs->data + sfs->sec_size * i, data + 128 * i, 128);
+        return nsec * ssec;
 }
 
-// Sorting function: sort by level, then directories first and last by file name
-static int compare_level(const void *a, const void *b)
+// Get number of sectors needed to hold the given size.
+static int image_sect(int size, int ssec)
 {
-    const struct afile *fa = *(const struct afile *const *)a;
-    const struct afile *fb = *(const struct afile *const *)b;
-    if( fb->level != fa->level )
-        return fb->level - fa->level;
-    if( fb->is_dir != fa->is_dir )
-        return fb->is_dir - fa->is_dir;
-    return strncmp(fa->aname, fb->aname, 11);
+    if( ssec == 256 )
+    {
+        if( size < 3 * 128 )
+            return (size + 127) / 128;
+        else
+            return (size + 3 * 128 + 255) / 256;
+    }
+    else
+        return (size + ssec - 1) / ssec;
 }
 
-struct sfs *build_spartafs(int sector_size, int num_sectors, unsigned boot_addr,
-                           file_list *flist)
+int build_spartafs_fit(struct sfs **out, file_list *flist, int exact_size, int min_size,
+                       unsigned boot_addr)
 {
-    struct sfs *sfs = check_malloc(sizeof(struct sfs));
-    sfs->data       = check_calloc(sector_size, num_sectors);
-    sfs->nsec       = num_sectors;
-    sfs->bmap       = 4;
-    sfs->nbmp       = ((num_sectors + 8) / 8 + sector_size - 1) / sector_size;
-    sfs->csec       = 4 + sfs->nbmp;
-    sfs->sec_size   = sector_size;
-
-    write_boot(sfs, boot_addr);
-
-    int i;
-    for( i = sfs->csec; i <= sfs->nsec; i++ )
-        sfs_free_sec(sfs, i);
-
-    // Sort the entries by the level - higher level first
-    qsort(&darray_i(flist, 0), darray_len(flist), sizeof(darray_i(flist, 0)),
-          compare_level);
-
-    // Cleanup all directories
-    struct afile **ptr;
-    darray_foreach(ptr, flist)
+    struct sfs *sfs = 0;
+    int e           = mkimage_err_no_space;
+    struct sfs_stats acc;
+    memset(&acc, 0, sizeof(acc));
+    if( exact_size )
     {
-        struct afile *af = *ptr;
-        if( af->is_dir )
+        // Try biggest size and the try reducing:
+        if( min_size <= sfs_image_size(65535, 128) )
+            e = build_image(&sfs, 128, 65535, boot_addr, flist, &acc, 0);
+        if( e == mkimage_err_no_space && min_size <= sfs_image_size(65535, 256) )
+            e = build_image(&sfs, 256, 65535, boot_addr, flist, &acc, 0);
+        if( e == mkimage_err_no_space )
+            e = build_image(&sfs, 512, 65535, boot_addr, flist, &acc, 0);
+        if( !e )
         {
-            af->size = 23;
-            memset(af->data, 0, 23);
+            int nsec = 65535 - sfs_get_free_sectors(sfs);
+            int ssec = sfs_get_sector_size(sfs);
+
+            if( sfs_image_size(nsec, ssec) < min_size )
+                nsec = image_sect(min_size, ssec);
+
+            for( ; nsec > 5 && sfs_image_size(nsec, ssec) >= min_size; nsec-- )
+            {
+                struct sfs *n;
+                e = build_image(&n, ssec, nsec, boot_addr, flist, &acc, 0);
+                if( e == mkimage_err_no_space )
+                {
+                    e = mkimage_ok;
+                    break;
+                }
+                sfs_free(sfs);
+                if( e )
+                    return e;
+                sfs = n;
+                if( sfs_get_free_sectors(sfs) > 0 &&
+                    sfs_image_size(nsec - 1, ssec) > min_size )
+                {
+                    nsec = nsec - sfs_get_free_sectors(sfs) + 1;
+                    if( sfs_image_size(nsec, ssec) < min_size )
+                        nsec = 1 + image_sect(min_size, ssec);
+                }
+            }
         }
     }
-
-    // Add each file
-    int dsec = -1;
-    darray_foreach(ptr, flist)
+    else
     {
-        struct afile *af = *ptr;
-        if( af->is_dir )
-        {
-            int dsize   = af->size;
-            af->data[0] = 0x28;
-            af->data[1] = 0; // Parent dir map,
-            af->data[2] = 0; // written later
-            af->data[3] = dsize & 0xFF;
-            af->data[4] = (dsize >> 8) & 0xFF;
-            af->data[5] = dsize >> 16;
-            memcpy(&af->data[6], af->aname, 11);
-            memcpy(&af->data[17], &af->date, 3);
-            memcpy(&af->data[20], &af->time, 3);
-        }
-        // Add data
-        int msec = sfs_add_data(sfs, af->data, af->size);
-        if( msec < 0 )
+        for( int i = 0; e == mkimage_err_no_space && sectors[i].size; i++ )
         {
-            sfs_free(sfs);
-            return 0;
+            if( sfs_image_size(sectors[i].num, sectors[i].size) < min_size )
+                continue;
+            e = build_image(&sfs, sectors[i].size, sectors[i].num, boot_addr, flist,
+                            &acc, 0);
         }
-        // Set map sector
-        af->map_sect = msec;
-        // Add to directory
-        struct afile *dir = af->dir;
-        if( dir )
-        {
-            char *cdir = dir->data + dir->size;
-
-            cdir[0] = 0x08 | (af->is_dir ? 0x20 : 0x00) | af->attribs;
-            cdir[1] = msec & 0xFF;
-            cdir[2] = msec >> 8;
-            cdir[3] = af->size & 0xFF;
-            cdir[4] = (af->size >> 8) & 0xFF;
-            cdir[5] = af->size >> 16;
-            memcpy(&cdir[6], af->aname, 11);
-            memcpy(&cdir[17], &af->date, 3);
-            memcpy(&cdir[20], &af->time, 3);
+    }
+    if( e )
+        return e;
+
+    // Build the final image with the size found, copying the data
+    int ssec = sfs->sec_size, nsec = sfs->nsec;
+    sfs_free(sfs);
+    e = build_image(&sfs, ssec, nsec, boot_addr, flist, &acc, 1);
+    if( !e )
+        *out = sfs;
+    return e;
+}
 
-            dir->size += 23;
-            if( dir->size > SFS_MAX_DIR_SIZE )
-                show_error("too many files in directory %s.", dir->pname);
-        }
-        else
-            // This is the main directory, remember location
-            dsec = msec;
+int sfs_get_atr_size(const struct sfs *sfs)
+{
+    return sfs_image_size(sfs->nsec, sfs->sec_size);
+}
 
-        if( af->boot_file )
-            sfs->boot_map = msec;
-    }
+void sfs_get_atr_header(const struct sfs *sfs, uint8_t *hdr)
+{
+    int size = sfs_get_atr_size(sfs);
+    memset(hdr, 0, 16);
+    hdr[0] = 0x96;
+    hdr[1] = 0x02;
+    hdr[2] = size >> 4;
+    hdr[3] = size >> 12;
+    hdr[4] = sfs->sec_size;
+    hdr[5] = sfs->sec_size >> 8;
+    hdr[6] = size >> 20;
+}
 
-    // Set the "parent" directory to all sub-directories
-    darray_foreach(ptr, flist)
+void sfs_write_atr(const struct sfs *sfs, uint8_t *buf)
+{
+    sfs_get_atr_header(sfs, buf);
+    buf += 16;
+    for( int i = 0; i < sfs->nsec; i++ )
     {
-        struct afile *af = *ptr;
-        if( af->is_dir && af->dir )
-        {
-            int parent = af->dir->map_sect;
-            sfs_patch_byte(sfs, af->map_sect, 1, parent & 0xFF);
-            sfs_patch_byte(sfs, af->map_sect, 2, parent >> 8);
-        }
+        // First three sectors are 128 bytes, except for 512 byte sectors
+        int len = i < 3 && sfs->sec_size < 512 ? 128 : sfs->sec_size;
+        memcpy(buf, sfs->data + sfs->sec_size * i, len);
+        buf += len;
     }
-
-    // Check main directory
-    if( dsec < 0 )
-        show_error("internal error - no main directory.");
-
-    // Get's CRC32 of current data
-    unsigned crc = crc32(0, sfs->data, sfs->sec_size * sfs->nsec);
-
-    sfs->data[1]  = 0x03;
-    sfs->data[7]  = 0x80;
-    sfs->data[9]  = dsec & 0xFF;
-    sfs->data[10] = dsec >> 8;
-    sfs->data[11] = sfs->nsec & 0xFF;
-    sfs->data[12] = sfs->nsec >> 8;
-    sfs->data[13] = (sfs->nsec - sfs->csec + 1) & 0xFF;
-    sfs->data[14] = (sfs->nsec - sfs->csec + 1) >> 8;
-    sfs->data[15] = sfs->nbmp;
-    sfs->data[16] = sfs->bmap & 0xFF;
-    sfs->data[17] = sfs->bmap >> 8;
-    sfs->data[18] = sfs->csec & 0xFF;
-    sfs->data[19] = sfs->csec >> 8;
-    sfs->data[20] = sfs->csec & 0xFF;
-    sfs->data[21] = sfs->csec >> 8;
-    sfs->data[22] = 'D';
-    sfs->data[23] = 'S';
-    sfs->data[24] = 'K';
-    sfs->data[25] = '_';
-    sfs->data[26] = hex(crc >> 8);
-    sfs->data[27] = hex(crc >> 12);
-    sfs->data[28] = hex(crc >> 16);
-    sfs->data[29] = hex(crc >> 20);
-    sfs->data[30] = 0x28;
-    sfs->data[31] = sfs->sec_size > 128 ? 0 : 128;
-    sfs->data[32] = 0x20;
-    sfs->data[39] = crc & 0xFF;
-    sfs->data[40] = sfs->boot_map & 0xFF;
-    sfs->data[41] = sfs->boot_map >> 8;
-
-    return sfs;
 }
 
 uint8_t *sfs_get_data(const struct sfs *sfs)
@@ -349,6 +293,11 @@ int sfs_get_free_sectors(const struct sfs *sfs)
     return sfs->nsec - sfs->csec + 1;
 }
 
+void sfs_get_stats(const struct sfs *sfs, struct sfs_stats *stats)
+{
+    *stats = sfs->stats;
+}
+
 void sfs_free(struct sfs *sfs)
 {
     if( sfs )
@@ -23,11 +23,50 @@
 
 struct sfs;
 
-struct sfs *build_spartafs(int sector_size, int num_sectors, unsigned boot_addr,
-                           file_list *flist);
+// Statistics of the image build
+struct sfs_stats
+{
+    int attempts;        // Number of images built to find the size
+    int map_sectors;     // Sectors used by sector maps
+    int data_sectors;    // Sectors used by file data
+    int dir_sectors;     // Sectors used by directories
+    size_t bytes_copied; // Bytes copied to the image in all attempts
+};
+
+// Builds an image of the given geometry, returns mkimage_err_no_space if the
+// files don't fit.
+int build_spartafs(struct sfs **out, int sector_size, int num_sectors, unsigned boot_addr,
+                   file_list *flist);
+// Builds the smallest image that holds all the files, from the standard sizes or
+// with the exact size needed.
+int build_spartafs_fit(struct sfs **out, file_list *flist, int exact_size, int min_size,
+                       unsigned boot_addr);
+// Sets a function called before (with "begin" = 1) and after each attempt to
+// build an image, "err" is the result of the attempt.
+void sfs_set_attempt_hook(void (*hook)(int begin, int sector_size, int num_sectors,
+                                       int err));
+// Parts of each build attempt
+enum sfs_phase
+{
+    sfs_phase_layout, // Sorting the files and placing their data in the sectors
+    sfs_phase_crc     // CRC of the final image
+};
+// Sets a function called before (with "begin" = 1) and after each part of the
+// build attempts.
+void sfs_set_phase_hook(void (*hook)(enum sfs_phase phase, int begin));
+// Get image size given number of sectors and sector size, taking account for
+// first 3 sectors of 128 bytes.
+int sfs_image_size(int nsec, int ssec);
 
 uint8_t *sfs_get_data(const struct sfs *);
 int sfs_get_num_sectors(const struct sfs *);
 int sfs_get_sector_size(const struct sfs *);
 int sfs_get_free_sectors(const struct sfs *);
+// Size of the ATR file, without the 16 bytes header
+int sfs_get_atr_size(const struct sfs *);
+// Writes the 16 bytes ATR header
+void sfs_get_atr_header(const struct sfs *, uint8_t *hdr);
+// Writes the full ATR file, header included
+void sfs_write_atr(const struct sfs *, uint8_t *buf);
+void sfs_get_stats(const struct sfs *, struct sfs_stats *stats);
 void sfs_free(struct sfs *);
@@ -0,0 +1,199 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Collects performance statistics.
+ */
+#include "stats.h"
+#include "msg.h"
+#include "trace.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if !( defined(_WIN32) || defined(__WIN32__) )
+#include <sys/resource.h>
+#endif
+
+int stats_enabled;
+
+static const char *phase_names[stats_num_phases] = {
+    "read", "build", "attempt", "layout", "crc", "write", "load", "list", "extract"};
+
+static const char *counter_names[stats_num_counters] = {
+    "build_attempts", "map_sectors", "data_sectors", "dir_sectors",  "files",
+    "dirs",           "bytes_read",  "bytes_copied", "bytes_written"};
+
+static struct
+{
+    double wall, cpu; // Accumulated times
+    int calls;
+} phases[stats_num_phases];
+static pthread_mutex_t phases_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Phases entered in the current thread, the innermost is measured
+#define MAX_NEST 8
+static _Thread_local struct
+{
+    enum stats_phase p;
+    double wall0, cpu0; // Times at start or resume of the phase
+} nest[MAX_NEST];
+static _Thread_local int nest_depth;
+
+static struct
+{
+    long long value;
+    int used;
+} counters[stats_num_counters];
+
+static double wall_time(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double cpu_time(void)
+{
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static long max_rss(void)
+{
+#if( defined(_WIN32) || defined(__WIN32__) )
+    return 0;
+#else
+    struct rusage ru;
+    if( getrusage(RUSAGE_SELF, &ru) )
+        return 0;
+    return ru.ru_maxrss;
+#endif
+}
+
+int stats_option(const char *arg)
+{
+    if( !strcmp(arg, "--stats=") )
+        show_opt_error("option '--stats=' needs a file name");
+    return !strcmp(arg, "--stats") || !strncmp(arg, "--stats=", 8);
+}
+
+const char *stats_parse_args(int argc, char **argv)
+{
+    const char *json_file = 0;
+    for( int i = 1; i < argc; i++ )
+    {
+        // The option is checked later, with stats_option()
+        if( !strncmp(argv[i], "--stats", 7) && (!argv[i][7] || argv[i][7] == '=') )
+        {
+            stats_enabled = 1;
+            json_file     = argv[i][7] ? argv[i] + 8 : 0;
+        }
+    }
+    return json_file;
+}
+
+// Adds the time from the start of the innermost phase up to now
+static void add_time(double wall, double cpu, int calls)
+{
+    enum stats_phase p = nest[nest_depth - 1].p;
+    pthread_mutex_lock(&phases_lock);
+    phases[p].wall += wall - nest[nest_depth - 1].wall0;
+    phases[p].cpu += cpu - nest[nest_depth - 1].cpu0;
+    phases[p].calls += calls;
+    pthread_mutex_unlock(&phases_lock);
+}
+
+void stats_begin(enum stats_phase p)
+{
+    if( !stats_enabled || nest_depth >= MAX_NEST )
+        return;
+    double wall = wall_time(), cpu = cpu_time();
+    // Pause the enclosing phase
+    if( nest_depth )
+        add_time(wall, cpu, 0);
+    nest[nest_depth].p     = p;
+    nest[nest_depth].wall0 = wall;
+    nest[nest_depth].cpu0  = cpu;
+    nest_depth++;
+}
+
+void stats_end(enum stats_phase p)
+{
+    if( !stats_enabled || !nest_depth || nest[nest_depth - 1].p != p )
+        return;
+    double wall = wall_time(), cpu = cpu_time();
+    add_time(wall, cpu, 1);
+    nest_depth--;
+    // Resume the enclosing phase
+    if( nest_depth )
+    {
+        nest[nest_depth - 1].wall0 = wall;
+        nest[nest_depth - 1].cpu0  = cpu;
+    }
+}
+
+void stats_add(enum stats_counter c, long long n)
+{
+    __atomic_fetch_add(&counters[c].value, n, __ATOMIC_RELAXED);
+    counters[c].used = 1;
+}
+
+void stats_report(const char *json_file)
+{
+    if( !stats_enabled )
+        return;
+    if( !json_file )
+    {
+        for( int i = 0; i < stats_num_phases; i++ )
+            if( phases[i].calls )
+                show_msg("stats: %-8s %10.3f ms wall, %10.3f ms cpu, count %d.",
+                         phase_names[i], phases[i].wall * 1e3, phases[i].cpu * 1e3,
+                         phases[i].calls);
+        for( int i = 0; i < stats_num_counters; i++ )
+            if( counters[i].used )
+                show_msg("stats: %-14s %lld", counter_names[i], counters[i].value);
+        show_msg("stats: %-14s %ld KB", "peak_rss", max_rss());
+        return;
+    }
+    FILE *f = fopen(json_file, "w");
+    if( !f )
+        show_error("can't create stats file '%s': %s", json_file, strerror(errno));
+    fprintf(f, "{\n  \"program\": ");
+    trace_write_string(f, prog_name);
+    fprintf(f, ",\n  \"phases\": {");
+    const char *sep = "";
+    for( int i = 0; i < stats_num_phases; i++ )
+    {
+        if( !phases[i].calls )
+            continue;
+        fprintf(f, "%s\n    \"%s\": {\"wall_s\": %.6f, \"cpu_s\": %.6f, \"calls\": %d}",
+                sep, phase_names[i], phases[i].wall, phases[i].cpu, phases[i].calls);
+        sep = ",";
+    }
+    fprintf(f, "\n  },\n  \"counters\": {");
+    sep = "";
+    for( int i = 0; i < stats_num_counters; i++ )
+    {
+        if( !counters[i].used )
+            continue;
+        fprintf(f, "%s\n    \"%s\": %lld", sep, counter_names[i], counters[i].value);
+        sep = ",";
+    }
+    fprintf(f, "\n  },\n  \"peak_rss_kb\": %ld\n}\n", max_rss());
+    if( fclose(f) )
+        show_error("can't write stats file '%s': %s", json_file, strerror(errno));
+}
@@ -0,0 +1,67 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Collects performance statistics, shown with the "--stats" option.
+ */
+#pragma once
+
+// Phases measured, each can be entered more than once. Phases can be nested,
+// the time of a phase does not include the phases entered inside it.
+enum stats_phase
+{
+    stats_read,    // Reading input files
+    stats_build,   // Building the image, outside of the attempts
+    stats_attempt, // Each attempt to build the image, outside of the parts below
+    stats_layout,  // Sorting the files and placing their data in the sectors
+    stats_crc,     // CRC of the final image
+    stats_write,   // Writing the image
+    stats_load,    // Loading the image
+    stats_list,    // Reading directories and listing
+    stats_extract, // Extracting files
+    stats_num_phases
+};
+
+// Counters, only the used ones are shown
+enum stats_counter
+{
+    stats_attempts,      // Image build attempts
+    stats_map_sectors,   // Sectors used by sector maps
+    stats_data_sectors,  // Sectors used by file data
+    stats_dir_sectors,   // Sectors used by directories
+    stats_files,         // Files processed
+    stats_dirs,          // Directories processed
+    stats_bytes_read,    // Bytes read from input files
+    stats_bytes_copied,  // Bytes copied to/from the image
+    stats_bytes_written, // Bytes written to output files
+    stats_num_counters
+};
+
+// Set to enable the statistics
+extern int stats_enabled;
+
+// Returns 1 if the argument is the "--stats" option
+int stats_option(const char *arg);
+// Enables the statistics if the "--stats" option is in the command line,
+// returns the JSON file name given as "--stats=file.json" or NULL.
+const char *stats_parse_args(int argc, char **argv);
+
+// Enters and leaves a phase, can be called from any thread
+void stats_begin(enum stats_phase p);
+void stats_end(enum stats_phase p);
+void stats_add(enum stats_counter c, long long n);
+// Writes the statistics, as text to stderr if "json_file" is NULL or as JSON
+void stats_report(const char *json_file);
@@ -0,0 +1,177 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Writes POSIX ustar archives.
+ */
+#include "tar.h"
+#include "compat.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK 512
+#define RECORD (20 * BLOCK) // Archives are padded to a multiple of this
+#define BUF_SIZE (1 << 20)  // Data is written in blocks of this size
+
+struct tar
+{
+    FILE *f;
+    char *buf;  // Output buffer
+    size_t len; // Bytes in the buffer
+    size_t pos; // Bytes written
+};
+
+struct tar *tar_open(const char *name)
+{
+    struct tar *t = calloc(1, sizeof(struct tar));
+    if( !t )
+        return 0;
+    if( strcmp(name, "-") )
+        t->f = fopen(name, "wb");
+    else
+    {
+        compat_set_binary(stdout);
+        t->f = stdout;
+    }
+    t->buf = malloc(BUF_SIZE);
+    if( !t->f || !t->buf )
+    {
+        int err = t->f ? ENOMEM : errno;
+        if( t->f && t->f != stdout )
+            fclose(t->f);
+        free(t->buf);
+        free(t);
+        errno = err;
+        return 0;
+    }
+    return t;
+}
+
+static int flush(struct tar *t)
+{
+    if( t->len && 1 != fwrite(t->buf, t->len, 1, t->f) )
+        return -1;
+    t->len = 0;
+    return 0;
+}
+
+static int write_bytes(struct tar *t, const void *data, size_t len)
+{
+    if( t->len + len > BUF_SIZE && flush(t) )
+        return -1;
+    // Big files are written directly
+    if( len >= BUF_SIZE )
+        return 1 != fwrite(data, len, 1, t->f) ? -1 : 0;
+    memcpy(t->buf + t->len, data, len);
+    t->len += len;
+    return 0;
+}
+
+// Writes the data padded to a full block
+static int write_data(struct tar *t, const void *data, size_t len)
+{
+    static const char zero[BLOCK];
+    size_t pad = (BLOCK - len % BLOCK) % BLOCK;
+    if( write_bytes(t, data, len) || write_bytes(t, zero, pad) )
+        return -1;
+    t->pos += len + pad;
+    return 0;
+}
+
+// Writes a number in octal, filling the field, ending with a NUL
+static void put_octal(char *field, size_t len, unsigned long long x)
+{
+    field[--len] = 0;
+    while( len-- )
+    {
+        field[len] = '0' + (x & 7);
+        x >>= 3;
+    }
+}
+
+// Writes the header of one entry, splitting long paths between the name and
+// prefix fields at a "/".
+static int write_header(struct tar *t, const char *path, char type, unsigned mode,
+                        size_t size, time_t mtime)
+{
+    char hdr[BLOCK];
+    size_t len = strlen(path), split = 0;
+    if( len > 100 )
+    {
+        size_t i = len - 101;
+        while( i < len - 1 && (path[i] != '/' || i > 155) )
+            i++;
+        if( i >= len - 1 )
+        {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        split = i + 1;
+    }
+    memset(hdr, 0, BLOCK);
+    memcpy(hdr, path + split, len - split);
+    memcpy(hdr + 345, path, split ? split - 1 : 0);
+    put_octal(hdr + 100, 8, mode);
+    put_octal(hdr + 108, 8, 0);
+    put_octal(hdr + 116, 8, 0);
+    put_octal(hdr + 124, 12, size);
+    put_octal(hdr + 136, 12, mtime < 0 ? 0 : mtime);
+    hdr[156] = type;
+    memcpy(hdr + 257, "ustar", 6);
+    memcpy(hdr + 263, "00", 2);
+    // The checksum is calculated with the field filled with spaces
+    unsigned sum = 0;
+    memset(hdr + 148, ' ', 8);
+    for( int i = 0; i < BLOCK; i++ )
+        sum += (uint8_t)hdr[i];
+    put_octal(hdr + 148, 7, sum);
+    return write_data(t, hdr, BLOCK);
+}
+
+int tar_add_dir(struct tar *t, const char *path, time_t mtime)
+{
+    char *name = malloc(strlen(path) + 2);
+    if( !name )
+        return -1;
+    strcpy(name, path);
+    strcat(name, "/");
+    int e = write_header(t, name, '5', 0755, 0, mtime);
+    free(name);
+    return e;
+}
+
+int tar_add_file(struct tar *t, const char *path, const uint8_t *data, size_t len,
+                 time_t mtime)
+{
+    if( write_header(t, path, '0', 0644, len, mtime) )
+        return -1;
+    return write_data(t, data, len);
+}
+
+int tar_close(struct tar *t)
+{
+    // Two zero blocks mark the end, and the archive is padded to a full record,
+    // so the padding is at most a record plus one block.
+    static const char zero[RECORD + 2 * BLOCK];
+    size_t pad = 2 * BLOCK + (RECORD - (t->pos + 2 * BLOCK) % RECORD) % RECORD;
+    int e      = write_bytes(t, zero, pad) || flush(t);
+    e |= t->f == stdout ? fflush(t->f) : fclose(t->f);
+    free(t->buf);
+    free(t);
+    return e ? -1 : 0;
+}
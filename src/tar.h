@@ -0,0 +1,38 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Writes POSIX ustar archives.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+struct tar;
+
+// Creates the archive, "-" writes to the standard output. Returns NULL on
+// error, with errno set.
+struct tar *tar_open(const char *name);
+// Adds a directory, the path must not include a trailing "/". Returns 0 or -1
+// on error, with errno set; ENAMETOOLONG if the path does not fit in the
+// header.
+int tar_add_dir(struct tar *t, const char *path, time_t mtime);
+// Adds a file with the given data, returns 0 or -1 on error, as above.
+int tar_add_file(struct tar *t, const char *path, const uint8_t *data, size_t len,
+                 time_t mtime);
+// Writes the end of the archive and closes the file, returns 0 or -1 on error.
+int tar_close(struct tar *t);
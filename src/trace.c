@@ -0,0 +1,133 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Writes a timeline in the Chrome trace-event format.
+ */
+#include "trace.h"
+#include "msg.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+int trace_enabled;
+
+static FILE *trace_file;
+static double trace_t0;
+static const char *trace_sep = "";
+// Events can be written from many threads, each one is shown in its own track
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static int trace_threads;
+static _Thread_local int trace_tid;
+
+double trace_now(void)
+{
+    if( !trace_file )
+        return 0;
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void trace_write_string(FILE *f, const char *str)
+{
+    putc('"', f);
+    for( ; *str; str++ )
+    {
+        unsigned char c = *str;
+        if( c == '"' || c == '\\' )
+            fprintf(f, "\\%c", c);
+        else if( c < 0x20 || c > 0x7E )
+            fprintf(f, "\\u%04x", c);
+        else
+            putc(c, f);
+    }
+    putc('"', f);
+}
+
+// Closes the trace at exit, so the file is valid also after errors
+static void trace_close(void)
+{
+    if( !trace_file )
+        return;
+    pthread_mutex_lock(&trace_lock);
+    fprintf(trace_file, "\n]}\n");
+    fclose(trace_file);
+    trace_file    = 0;
+    trace_enabled = 0;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+int trace_option(int argc, char **argv, int i)
+{
+    if( strcmp(argv[i], "--trace") )
+        return 0;
+    if( i + 1 >= argc )
+        show_opt_error("option '--trace' needs an argument");
+    return 2;
+}
+
+void trace_parse_args(int argc, char **argv)
+{
+    const char *name = 0;
+    for( int i = 1; i < argc; i++ )
+    {
+        if( trace_option(argc, argv, i) )
+            name = argv[++i];
+    }
+    if( !name )
+        return;
+    trace_file = fopen(name, "w");
+    if( !trace_file )
+        show_error("can't create trace file '%s': %s", name, strerror(errno));
+    fprintf(trace_file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    trace_enabled = 1;
+    trace_t0      = trace_now();
+    atexit(trace_close);
+}
+
+void trace_span(const char *cat, const char *name, double start, const char *args, ...)
+{
+    if( !trace_file )
+        return;
+    double end = trace_now();
+    pthread_mutex_lock(&trace_lock);
+    if( !trace_tid )
+        trace_tid = ++trace_threads;
+    fprintf(trace_file, "%s\n{\"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"cat\": ",
+            trace_sep, trace_tid);
+    trace_write_string(trace_file, cat);
+    fprintf(trace_file, ", \"name\": ");
+    trace_write_string(trace_file, name);
+    fprintf(trace_file, ", \"ts\": %.3f, \"dur\": %.3f", (start - trace_t0) * 1e6,
+            (end - start) * 1e6);
+    if( args )
+    {
+        va_list ap;
+        fprintf(trace_file, ", \"args\": {");
+        va_start(ap, args);
+        vfprintf(trace_file, args, ap);
+        va_end(ap);
+        fprintf(trace_file, "}");
+    }
+    fprintf(trace_file, "}");
+    trace_sep = ",";
+    pthread_mutex_unlock(&trace_lock);
+}
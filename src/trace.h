@@ -0,0 +1,39 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Writes a timeline in the Chrome trace-event format, with the "--trace"
+ * option.
+ */
+#pragma once
+#include <stdio.h>
+
+// Set when a trace file is open
+extern int trace_enabled;
+
+// Returns the number of arguments used by the "--trace" option, 0 if the
+// argument is not the option.
+int trace_option(int argc, char **argv, int i);
+// Opens the trace file if the "--trace file.json" option is in the command line.
+void trace_parse_args(int argc, char **argv);
+// Writes a JSON string to "f", escaping special characters
+void trace_write_string(FILE *f, const char *str);
+// Current time, used as start of a span
+double trace_now(void);
+// Writes a span started at "start" up to the current time, "args" is a list of
+// JSON members or NULL.
+void trace_span(const char *cat, const char *name, double start, const char *args, ...)
+    __attribute__((format(printf, 4, 5)));
@@ -0,0 +1,372 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Watch mode of mkatr: rebuilds the image when the input files change.
+ *
+ * The data of all the regular files is kept in memory, on a change only the
+ * modified files are read again. The parent directories of the files are
+ * watched, so files replaced by editors (written to a new file and renamed)
+ * are also detected. The directories added from the host are also watched, and
+ * the new entries created inside are added to the image.
+ */
+#include "watch.h"
+#include "compat.h"
+#include "hostfile.h"
+#include "msg.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Time to wait for more events after a change, in milliseconds
+#define WATCH_DELAY 100
+
+// Events watched, the same for all the directories as each directory has only
+// one watch
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ATTRIB)
+
+// One watched input file
+struct winput
+{
+    struct afile *f;  // Entry in the file list
+    const char *base; // File name inside the parent directory
+    int wd;           // Watch descriptor of the parent directory
+    int changed;      // File changed since last build
+};
+
+// One watched directory, new entries inside are added to the image
+struct wdir
+{
+    struct afile *f; // Entry in the file list
+    int wd;          // Watch descriptor
+};
+
+struct watch
+{
+    int fd;                   // Inotify instance
+    darray(struct winput) in; // Input files
+    darray(struct wdir) dirs; // Input directories
+    darray(char *) created;   // Paths of the entries created in the directories
+};
+
+// Adds a watch to the parent directory of the file
+static int add_watch(int fd, struct winput *w)
+{
+    const char *name = w->f->fname;
+    const char *base = name + strlen(name);
+    while( base > name && !is_separator(base[-1]) )
+        base--;
+    w->base = base;
+
+    char *dir = check_malloc(base - name + 2);
+    if( base == name )
+        strcpy(dir, ".");
+    else
+    {
+        memcpy(dir, name, base - name);
+        dir[base - name] = 0;
+    }
+    w->wd = inotify_add_watch(fd, dir, WATCH_EVENTS);
+    if( w->wd < 0 )
+        show_error("can't watch directory '%s': %s", dir, strerror(errno));
+    free(dir);
+    return w->wd;
+}
+
+static void add_input(struct watch *w, struct afile *f)
+{
+    struct winput in = {f, 0, 0, 0};
+    add_watch(w->fd, &in);
+    if( darray_add(&w->in, in) )
+        memory_error();
+}
+
+static void add_dir(struct watch *w, struct afile *f)
+{
+    struct wdir d = {f, inotify_add_watch(w->fd, f->fname, WATCH_EVENTS)};
+    if( d.wd < 0 )
+        show_error("can't watch directory '%s': %s", f->fname, strerror(errno));
+    if( darray_add(&w->dirs, d) )
+        memory_error();
+}
+
+// Returns true if the entry is a directory of the host file-system
+static int is_host_dir(const struct afile *f)
+{
+    struct stat st;
+    return f->is_dir && f->dir && !flist_image_path(f->fname) && !stat(f->fname, &st) &&
+           S_ISDIR(st.st_mode);
+}
+
+// Returns true if the name is not in the directory of the image
+static int is_new_entry(const file_list *flist, const struct afile *dir, const char *name)
+{
+    char *aname = flist_atari_name(name);
+    int is_new  = aname && !flist_find(flist, dir, aname);
+    free(aname);
+    return is_new;
+}
+
+// Remembers an entry created in a watched directory, returns 1 if it is new
+static int add_created(struct watch *w, const struct afile *dir, const char *name)
+{
+    char *path = check_malloc(strlen(dir->fname) + strlen(name) + 2);
+    sprintf(path, "%s/%s", dir->fname, name);
+    char **p;
+    darray_foreach(p, &w->created)
+    {
+        if( !strcmp(*p, path) )
+        {
+            free(path);
+            return 0;
+        }
+    }
+    if( darray_add(&w->created, path) )
+        memory_error();
+    return 1;
+}
+
+// Reads all pending events, marking the changed inputs and the entries created
+// in the directories; returns the number of inputs marked and entries created.
+static int read_events(struct watch *w, const file_list *flist)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len = read(w->fd, buf, sizeof(buf));
+    if( len < 0 )
+    {
+        if( errno == EINTR || errno == EAGAIN )
+            return 0;
+        show_error("can't read file events: %s", strerror(errno));
+    }
+    int marked = 0;
+    for( char *p = buf; p < buf + len; )
+    {
+        const struct inotify_event *ev = (const struct inotify_event *)p;
+        p += sizeof(struct inotify_event) + ev->len;
+        if( !ev->len )
+            continue;
+        struct winput *in;
+        darray_foreach(in, &w->in)
+        {
+            if( in->wd == ev->wd && !strcmp(in->base, ev->name) )
+            {
+                marked += !in->changed;
+                in->changed = 1;
+            }
+        }
+        if( !(ev->mask & (IN_CREATE | IN_MOVED_TO)) )
+            continue;
+        struct wdir *d;
+        darray_foreach(d, &w->dirs)
+        {
+            if( d->wd == ev->wd && is_new_entry(flist, d->f, ev->name) )
+                marked += add_created(w, d->f, ev->name);
+        }
+    }
+    return marked;
+}
+
+// Adds the entries created in the directories that still exist, returns the
+// number of entries added.
+static int add_new_entries(struct watch *w, file_list *flist)
+{
+    int added = 0;
+    char **p;
+    darray_foreach(p, &w->created)
+    {
+        struct stat st;
+        const struct afile *dir = 0;
+        const struct wdir *d;
+        darray_foreach(d, &w->dirs)
+        {
+            if( !strncmp(*p, d->f->fname, strlen(d->f->fname)) &&
+                !strchr(*p + strlen(d->f->fname) + 1, '/') )
+                dir = d->f;
+        }
+        // Temporary files can be already removed
+        if( dir && !stat(*p, &st) && (S_ISREG(st.st_mode) || S_ISDIR(st.st_mode)) &&
+            is_new_entry(flist, dir, *p) )
+        {
+            flist_add_file(flist, *p, 0, 0);
+            struct afile *f = darray_i(flist, darray_len(flist) - 1);
+            if( f->is_dir )
+                add_dir(w, f);
+            else
+            {
+                if( flist_reload_file(f) )
+                    show_msg("file '%s' will be read when building.", f->fname);
+                add_input(w, f);
+            }
+            added++;
+        }
+        free(*p);
+    }
+    darray_len(&w->created) = 0;
+    return added;
+}
+
+struct watch *watch_init(file_list *flist)
+{
+    struct watch *w = check_calloc(1, sizeof(struct watch));
+    w->fd           = inotify_init1(IN_CLOEXEC);
+    if( w->fd < 0 )
+        show_error("can't watch files: %s", strerror(errno));
+    if( darray_init(w->in, 1) || darray_init(w->dirs, 1) || darray_init(w->created, 1) )
+        memory_error();
+
+    // Watch the host files and directories
+    struct afile **ptr;
+    darray_foreach(ptr, flist)
+    {
+        struct afile *f = *ptr;
+        if( is_host_dir(f) )
+            add_dir(w, f);
+        else if( !f->is_dir && f->read_data )
+            add_input(w, f);
+    }
+    if( !darray_len(&w->in) && !darray_len(&w->dirs) )
+        show_error("no input files to watch.");
+    // Keep the data of the files in memory, read only once
+    flist_preload(flist);
+    show_msg("watching %d files and %d directories for changes.", (int)darray_len(&w->in),
+             (int)darray_len(&w->dirs));
+    return w;
+}
+
+// Writes the whole ATR file
+static int write_full(int fd, const struct sfs *sfs)
+{
+    size_t size   = sfs_get_atr_size(sfs) + 16;
+    uint8_t *data = check_malloc(size);
+    sfs_write_atr(sfs, data);
+    int e = ftruncate(fd, 0) || pwrite(fd, data, size, 0) != (ssize_t)size;
+    free(data);
+    return e ? -1 : sfs_get_num_sectors(sfs);
+}
+
+// Writes the sectors that differ between the two images, returns the number of
+// sectors written or -1 on error.
+static int write_changes(const char *out, const struct sfs *old, const struct sfs *sfs)
+{
+    int fd = open(out, O_WRONLY | O_CREAT, 0666);
+    if( fd < 0 )
+        return -1;
+
+    int ssec = sfs_get_sector_size(sfs);
+    int nsec = sfs_get_num_sectors(sfs);
+    int num  = 0;
+    if( ssec != sfs_get_sector_size(old) || nsec != sfs_get_num_sectors(old) )
+        num = write_full(fd, sfs);
+    else
+    {
+        const uint8_t *a = sfs_get_data(old);
+        const uint8_t *b = sfs_get_data(sfs);
+        for( int i = 0; i < nsec && num >= 0; i++ )
+        {
+            // The first three sectors are 128 bytes in the ATR file, except
+            // for 512 byte sectors
+            size_t first = ssec == 512 ? 512 : 128;
+            size_t len   = i < 3 ? first : ssec;
+            off_t pos    = 16 + (i < 3 ? first * i : 3 * first + (i - 3) * ssec);
+            if( memcmp(a + i * ssec, b + i * ssec, len) )
+            {
+                if( pwrite(fd, b + i * ssec, len, pos) != (ssize_t)len )
+                    num = -1;
+                else
+                    num++;
+            }
+        }
+    }
+    if( close(fd) )
+        num = -1;
+    return num;
+}
+
+void watch_inputs(struct watch *w, file_list *flist, const char *out, struct sfs *sfs,
+                  const struct watch_build *opts)
+{
+    for( ;; )
+    {
+        if( !read_events(w, flist) )
+            continue;
+        // Wait until the events stop, editors can write a file in many steps
+        struct pollfd pfd = {w->fd, POLLIN, 0};
+        while( poll(&pfd, 1, WATCH_DELAY) > 0 )
+            read_events(w, flist);
+
+        // Add the new entries and read again the changed files
+        int changed = add_new_entries(w, flist);
+        struct winput *in;
+        darray_foreach(in, &w->in)
+        {
+            if( !in->changed )
+                continue;
+            in->changed = 0;
+            if( !flist_reload_file(in->f) )
+            {
+                show_msg("file '%s' changed, %ld bytes.", in->f->fname,
+                         (long)in->f->size);
+                changed++;
+            }
+        }
+        if( !changed )
+            continue;
+
+        struct sfs *nsfs = 0;
+        int e = build_spartafs_fit(&nsfs, flist, opts->exact_size, opts->min_size,
+                                   opts->boot_addr);
+        if( e == mkimage_err_no_space )
+        {
+            show_msg("can't create an image big enough, image not updated.");
+            continue;
+        }
+        else if( e )
+        {
+            show_msg("%s, image not updated.",
+                     e == mkimage_err_read ? flist_read_error() : mkimage_strerror(e));
+            continue;
+        }
+        int n = write_changes(out, sfs, nsfs);
+        if( n < 0 )
+            show_error("can't write output file '%s': %s", out, strerror(errno));
+        show_msg("updated %d sectors of image with %d sectors of %d bytes.", n,
+                 sfs_get_num_sectors(nsfs), sfs_get_sector_size(nsfs));
+        sfs_free(sfs);
+        sfs = nsfs;
+    }
+}
+
+#else
+
+struct watch *watch_init(file_list *flist)
+{
+    show_error("watch mode is only supported in Linux.");
+}
+
+void watch_inputs(struct watch *w, file_list *flist, const char *out, struct sfs *sfs,
+                  const struct watch_build *opts)
+{
+    show_error("watch mode is only supported in Linux.");
+}
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Watch mode of mkatr: rebuilds the image when the input files change.
+ */
+#pragma once
+#include "spartafs.h"
+
+// Parameters of the image build, to rebuild with the same options
+struct watch_build
+{
+    int exact_size;     // Use image of exact size
+    int min_size;       // Minimum image size
+    unsigned boot_addr; // Boot loader page
+};
+
+struct watch;
+
+// Starts watching the regular files and the directories of the host in the list,
+// loading the data of the files in memory. Called before the first build, so
+// the files are read only once.
+struct watch *watch_init(file_list *flist);
+// Waits for changes of the files and for new entries in the directories,
+// rebuilding the image and updating the sectors of the output file that
+// changed. "sfs" is the image already written to "out". Only returns on errors.
+void watch_inputs(struct watch *w, file_list *flist, const char *out, struct sfs *sfs,
+                  const struct watch_build *opts);
@@ -0,0 +1,138 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Optimizes Atari binary (XEX) files loaded at boot.
+ *
+ * The boot loader reads each segment as "start, end, data", after setting
+ * INITAD to an RTS; after the data is read it calls INITAD. RUNAD is set to
+ * the start of the first segment before loading, and a segment starting at
+ * $0000 stops the load.
+ */
+#include "xex.h"
+#include "msg.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INITAD 0x02E2
+
+// Returns true if the segment writes any byte of the range
+static int touches(unsigned start, unsigned end, unsigned lo, unsigned hi)
+{
+    return start <= hi && end >= lo;
+}
+
+// Segments that can't be joined to others: writes to the hardware registers
+// depend on the order
+static int is_io(unsigned start, unsigned end)
+{
+    return touches(start, end, 0xD000, 0xD7FF);
+}
+
+static unsigned get_word(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint8_t *put_word(uint8_t *p, unsigned w)
+{
+    p[0] = w & 0xFF;
+    p[1] = w >> 8;
+    return p + 2;
+}
+
+int xex_merge(const uint8_t *data, size_t size, uint8_t **out, size_t *out_size,
+              int *segs_in, int *segs_out)
+{
+    if( size < 2 || get_word(data) != 0xFFFF )
+        return -1;
+
+    // The output is never bigger than the input
+    uint8_t *mem = check_malloc(0x10000);
+    uint8_t *buf = check_malloc(size);
+    uint8_t *op  = put_word(buf, 0xFFFF);
+    size_t pos   = 2;
+    int pending  = 0; // There is a segment not written yet,
+    int sealed   = 0; // that can't be extended
+    unsigned cs = 0, ce = 0;
+    *segs_in = *segs_out = 0;
+
+    for( ;; )
+    {
+        // Read next segment header, start is 0 at the end of the file
+        unsigned start = 0, end = 0;
+        if( pos < size )
+        {
+            if( size - pos < 2 )
+                break;
+            start = get_word(data + pos);
+            if( start == 0xFFFF )
+            {
+                pos += 2;
+                continue;
+            }
+            if( start )
+            {
+                if( size - pos < 4 )
+                    break;
+                end = get_word(data + pos + 2);
+                if( end < start || size - pos - 4 < end - start + 1 )
+                    break;
+            }
+        }
+        int join = pending && !sealed && start && start >= cs && start <= ce + 1 &&
+                   !is_io(start, end);
+        if( pending && !join )
+        {
+            op = put_word(op, cs);
+            op = put_word(op, ce);
+            memcpy(op, mem + cs, ce - cs + 1);
+            op += ce - cs + 1;
+            pending = 0;
+            (*segs_out)++;
+        }
+        if( !start )
+        {
+            // Copy the rest of the file after the end of the load
+            memcpy(op, data + pos, size - pos);
+            op += size - pos;
+            pos = size;
+            break;
+        }
+        memcpy(mem + start, data + pos + 4, end - start + 1);
+        pos += 4 + end - start + 1;
+        (*segs_in)++;
+        if( join )
+            ce = end > ce ? end : ce;
+        else
+        {
+            cs      = start;
+            ce      = end;
+            pending = 1;
+        }
+        // The loader calls INITAD after this segment
+        sealed = touches(cs, ce, INITAD, INITAD + 1) || is_io(cs, ce);
+    }
+    free(mem);
+    if( pos != size )
+    {
+        free(buf);
+        return -1;
+    }
+    *out      = buf;
+    *out_size = op - buf;
+    return 0;
+}
@@ -0,0 +1,31 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Optimizes Atari binary (XEX) files loaded at boot.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Merges the adjacent and overlapping segments of the binary file, so the
+// loader reads fewer and bigger segments. Segments are only joined when no
+// INITAD call happens between them, the start address of each segment is
+// kept and segments loading to the hardware registers are not changed.
+// Returns the new file in "out", to be released with free(), and the number
+// of segments before and after; or -1 if the data is not a valid binary file.
+int xex_merge(const uint8_t *data, size_t size, uint8_t **out, size_t *out_size,
+              int *segs_in, int *segs_out);
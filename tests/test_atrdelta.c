@@ -0,0 +1,139 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Tests a round trip of atrdelta: the delta between two images applied to a
+ * copy of the old one must give a file equal to the new one, keeping the
+ * layout of the file.
+ *
+ * Arguments are the folder with the programs and a folder for the test files.
+ */
+#define _XOPEN_SOURCE 700
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failed;
+
+static void check(int ok, const char *msg)
+{
+    if( !ok )
+    {
+        fprintf(stderr, "test_atrdelta: FAILED: %s\n", msg);
+        failed = 1;
+    }
+}
+
+// Deterministic pseudo-random numbers
+static uint32_t rnd_state = 12345;
+static uint32_t rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+// Writes an image of "nsec" sectors of "ssz" bytes, with the given sector data.
+// Without header, "hdr" = 0, writes a raw image.
+static int write_image(const char *name, const uint8_t *data, unsigned hdr,
+                       unsigned first, unsigned ssz, unsigned nsec)
+{
+    FILE *f = fopen(name, "wb");
+    if( !f )
+        return 1;
+    size_t size = 3 * first + (size_t)(nsec - 3) * ssz;
+    uint8_t h[16] = { 0x96, 0x02, size >> 4, size >> 12, ssz, ssz >> 8, size >> 20 };
+    int e = hdr && 1 != fwrite(h, 16, 1, f);
+    for( unsigned i = 0; i < nsec; i++ )
+        e |= 1 != fwrite(data + i * ssz, i < 3 ? first : ssz, 1, f);
+    return fclose(f) | e;
+}
+
+// Reads a full file to memory
+static uint8_t *read_file(const char *name, size_t *len)
+{
+    FILE *f = fopen(name, "rb");
+    if( !f )
+        return 0;
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(*len + 1);
+    if( data && *len != fread(data, 1, *len, f) )
+    {
+        free(data);
+        data = 0;
+    }
+    fclose(f);
+    return data;
+}
+
+static void test_layout(const char *prog, const char *dir, const char *name,
+                        unsigned hdr, unsigned first, unsigned ssz, unsigned nsec)
+{
+    char msg[256], cmd[4096], fold[512], fnew[512], fout[512], fdelta[512];
+    snprintf(fold, sizeof(fold), "%s/%s-old", dir, name);
+    snprintf(fnew, sizeof(fnew), "%s/%s-new", dir, name);
+    snprintf(fout, sizeof(fout), "%s/%s-out", dir, name);
+    snprintf(fdelta, sizeof(fdelta), "%s/%s.delta", dir, name);
+
+    // The first three sectors only hold data in the first 128 bytes
+    uint8_t *data = calloc(nsec, ssz);
+    for( unsigned i = 0; i < nsec; i++ )
+        for( unsigned j = 0; j < (i < 3 ? 128 : ssz); j++ )
+            data[i * ssz + j] = rnd();
+    int e = write_image(fold, data, hdr, first, ssz, nsec);
+    // Change some sectors, including one of the first three
+    unsigned changed[] = { 1, 4, 5, 100, nsec };
+    for( unsigned i = 0; i < sizeof(changed) / sizeof(changed[0]); i++ )
+        data[(changed[i] - 1) * ssz + 7] ^= 0x55;
+    e |= write_image(fnew, data, hdr, first, ssz, nsec);
+    free(data);
+    snprintf(msg, sizeof(msg), "%s: can't write test images", name);
+    check(!e, msg);
+
+    snprintf(cmd, sizeof(cmd), "cp '%s' '%s' && '%s/atrdelta' '%s' '%s' '%s' 2>/dev/null && "
+             "'%s/atrdelta' -a '%s' '%s' 2>/dev/null", fold, fout, prog, fold, fnew,
+             fdelta, prog, fout, fdelta);
+    snprintf(msg, sizeof(msg), "%s: atrdelta failed", name);
+    check(!system(cmd), msg);
+
+    size_t len_new = 0, len_out = 0;
+    uint8_t *dnew = read_file(fnew, &len_new);
+    uint8_t *dout = read_file(fout, &len_out);
+    snprintf(msg, sizeof(msg), "%s: result differs from the new image", name);
+    check(dnew && dout && len_new == len_out && !memcmp(dnew, dout, len_new), msg);
+    free(dnew);
+    free(dout);
+}
+
+int main(int argc, char **argv)
+{
+    if( argc != 3 )
+    {
+        fprintf(stderr, "usage: %s <prog_dir> <test_dir>\n", argv[0]);
+        return 2;
+    }
+    test_layout(argv[1], argv[2], "sd.atr", 16, 128, 128, 720);
+    test_layout(argv[1], argv[2], "dd-short.atr", 16, 128, 256, 720);
+    test_layout(argv[1], argv[2], "dd-full.atr", 16, 256, 256, 720);
+    test_layout(argv[1], argv[2], "raw.xfd", 0, 128, 128, 720);
+    if( !failed )
+        printf("test_atrdelta: OK\n");
+    return failed;
+}
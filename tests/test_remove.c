@@ -0,0 +1,120 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Tests removing files from SpartaDOS images: sector numbers outside of the
+ * file-system or of the sector bitmap must give an error instead of writing
+ * outside the bitmap.
+ *
+ * Arguments are the folder with the programs and a folder for the test files.
+ */
+#define _XOPEN_SOURCE 700
+#include "../src/atrfs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failed;
+
+static void check(int ok, const char *msg)
+{
+    if( !ok )
+    {
+        fprintf(stderr, "test_remove: FAILED: %s\n", msg);
+        failed = 1;
+    }
+}
+
+static unsigned read16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static void write16(uint8_t *p, unsigned x)
+{
+    p[0] = x;
+    p[1] = x >> 8;
+}
+
+static int find_cb(void *ctx, const char *path, const struct atrfs_entry *entry)
+{
+    if( strcmp(path, "/FILE.TXT") )
+        return 0;
+    *(unsigned *)ctx = entry->sector;
+    return 1;
+}
+
+enum corrupt
+{
+    corrupt_none,
+    corrupt_map,   // First data sector after the last sector
+    corrupt_bitmap // No sectors in the bitmap
+};
+
+// Removes the file after corrupting the image in memory, returns the error
+static int remove_file(const char *image, enum corrupt how)
+{
+    struct atr_image *atr;
+    struct atrfs *fs;
+    unsigned map = 0;
+    int e        = atr_open_rw(&atr, image);
+    if( e )
+        return e;
+    if( !(e = atrfs_open(&fs, atr, 0)) )
+    {
+        atrfs_walk(fs, find_cb, &map);
+        uint8_t *boot = atr_data_rw(atr, 1);
+        uint8_t *m    = map ? atr_data_rw(atr, map) : 0;
+        check(m != 0, "file not found in the image");
+        if( m && how == corrupt_map )
+            write16(m + 4, read16(boot + 11) + 1);
+        else if( how == corrupt_bitmap )
+            boot[15] = 0;
+        e = atrfs_remove(fs, "/FILE.TXT");
+        atrfs_close(fs);
+    }
+    atr_free(atr);
+    return e;
+}
+
+int main(int argc, char **argv)
+{
+    char cmd[4096], image[512], dir[512];
+    if( argc != 3 )
+    {
+        fprintf(stderr, "usage: %s <prog_dir> <test_dir>\n", argv[0]);
+        return 2;
+    }
+    snprintf(dir, sizeof(dir), "%s/remove", argv[2]);
+    snprintf(image, sizeof(image), "%s/remove.atr", argv[2]);
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s' && mkdir -p '%s' && "
+             "head -c 1000 /dev/zero > '%s/file.txt' && '%s/mkatr' '%s' '%s/file.txt' "
+             "> /dev/null 2>&1", dir, dir, dir, argv[1], image, dir);
+    if( system(cmd) )
+    {
+        fprintf(stderr, "test_remove: can't create test image\n");
+        return 1;
+    }
+    check(remove_file(image, corrupt_map) == atr_err_invalid,
+          "sector after the end of the file-system should be invalid");
+    check(remove_file(image, corrupt_bitmap) == atr_err_invalid,
+          "sector outside of the bitmap should be invalid");
+    check(remove_file(image, corrupt_none) == atr_ok, "can't remove a valid file");
+
+    if( !failed )
+        printf("test_remove: OK\n");
+    return failed;
+}
@@ -0,0 +1,157 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Tests renaming and moving directories in SpartaDOS images: the entry in the
+ * parent and the header of the directory itself must hold the new name.
+ *
+ * Arguments are the folder with the programs and a folder for the test files.
+ */
+#define _XOPEN_SOURCE 700
+#include "../src/atrfs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static int failed;
+
+static void check(int ok, const char *msg)
+{
+    if( !ok )
+    {
+        fprintf(stderr, "test_rename: FAILED: %s\n", msg);
+        failed = 1;
+    }
+}
+
+static unsigned read16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+struct find
+{
+    const char *path;
+    unsigned sector;
+};
+
+static int find_cb(void *ctx, const char *path, const struct atrfs_entry *entry)
+{
+    struct find *f = ctx;
+    if( strcmp(path, f->path) )
+        return 0;
+    f->sector = entry->sector;
+    return 1;
+}
+
+// Returns the map sector of the directory, 0 if not found
+static unsigned find_dir(const char *image, const char *path)
+{
+    struct atr_image *atr;
+    struct atrfs *fs;
+    struct find f = { path, 0 };
+    if( atr_load_file(&atr, image) )
+        return 0;
+    if( !atrfs_open(&fs, atr, 0) )
+    {
+        atrfs_walk(fs, find_cb, &f);
+        atrfs_close(fs);
+    }
+    atr_free(atr);
+    return f.sector;
+}
+
+// Checks the name and parent stored in the header of the directory
+static void check_header(const char *image, const char *path, const char *name,
+                         const char *parent)
+{
+    char msg[256];
+    struct atr_image *atr;
+    unsigned map  = find_dir(image, path);
+    unsigned pmap = parent ? find_dir(image, parent) : 0;
+    snprintf(msg, sizeof(msg), "directory '%s' not found", path);
+    check(map != 0, msg);
+    if( !map || atr_load_file(&atr, image) )
+        return;
+    const uint8_t *m = atr_data(atr, map);
+    const uint8_t *h = m ? atr_data(atr, read16(m + 4)) : 0;
+    snprintf(msg, sizeof(msg), "header of '%s' should have name '%s'", path, name);
+    check(h && !memcmp(h + 6, name, 11), msg);
+    if( parent )
+    {
+        snprintf(msg, sizeof(msg), "header of '%s' should have parent '%s'", path, parent);
+        check(h && read16(h + 1) == pmap, msg);
+    }
+    atr_free(atr);
+}
+
+static void rename_path(const char *image, const char *from, const char *to)
+{
+    char msg[256];
+    struct atr_image *atr;
+    struct atrfs *fs;
+    int e = atr_open_rw(&atr, image);
+    if( !e && !(e = atrfs_open(&fs, atr, 0)) )
+    {
+        e = atrfs_rename(fs, from, to);
+        atrfs_close(fs);
+    }
+    if( !e )
+        e = atr_sync(atr);
+    snprintf(msg, sizeof(msg), "rename '%s' to '%s': %s", from, to, atr_strerror(e));
+    check(!e, msg);
+    atr_free(atr);
+}
+
+int main(int argc, char **argv)
+{
+    char cmd[4096], image[512], dir[512];
+    if( argc != 3 )
+    {
+        fprintf(stderr, "usage: %s <prog_dir> <test_dir>\n", argv[0]);
+        return 2;
+    }
+    // Build an image with two directories, one holding a file
+    snprintf(dir, sizeof(dir), "%s/rename", argv[2]);
+    snprintf(image, sizeof(image), "%s/rename.atr", argv[2]);
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s' && mkdir -p '%s/sub' '%s/other' && "
+             "echo test > '%s/sub/file.txt' && '%s/mkatr' '%s' '%s/sub' '%s/other' "
+             "> /dev/null 2>&1", dir, dir, dir, dir, argv[1], image, dir, dir);
+    if( system(cmd) )
+    {
+        fprintf(stderr, "test_rename: can't create test image\n");
+        return 1;
+    }
+    check_header(image, "/SUB", "SUB        ", 0);
+
+    // Rename in the same directory
+    rename_path(image, "/SUB", "/NEWNAME");
+    check(!find_dir(image, "/SUB"), "old name still present after rename");
+    check_header(image, "/NEWNAME", "NEWNAME    ", 0);
+
+    // Move to other directory with a new name
+    rename_path(image, "/NEWNAME", "/OTHER/MOVED");
+    check_header(image, "/OTHER/MOVED", "MOVED      ", "/OTHER");
+
+    // Move keeping the name
+    rename_path(image, "/OTHER/MOVED", "/");
+    check_header(image, "/MOVED", "MOVED      ", 0);
+
+    if( !failed )
+        printf("test_rename: OK\n");
+    return failed;
+}
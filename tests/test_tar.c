@@ -0,0 +1,133 @@
+/*
+ *  Copyright (C) 2026 Daniel Serpell
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+/*
+ * Tests the tar archives written by "lsatr --tar" with files of sizes near the
+ * end of a record: the archive must be padded with zeros to a full record,
+ * after the two zero blocks that mark the end.
+ *
+ * Arguments are the folder with the programs and a folder for the test files.
+ */
+#define _XOPEN_SOURCE 700
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK 512
+#define RECORD (20 * BLOCK)
+
+static int failed;
+
+static void check(int ok, const char *msg)
+{
+    if( !ok )
+    {
+        fprintf(stderr, "test_tar: FAILED: %s\n", msg);
+        failed = 1;
+    }
+}
+
+// Reads the full file, returns NULL on error
+static uint8_t *read_file(const char *name, size_t *len)
+{
+    FILE *f = fopen(name, "rb");
+    if( !f )
+        return 0;
+    uint8_t *buf = 0;
+    size_t size  = 0;
+    *len         = 0;
+    for( ;; )
+    {
+        size += 65536;
+        uint8_t *p = realloc(buf, size);
+        if( !p )
+            break;
+        buf = p;
+        *len += fread(buf + *len, 1, size - *len, f);
+        if( *len < size )
+        {
+            fclose(f);
+            return buf;
+        }
+    }
+    free(buf);
+    fclose(f);
+    return 0;
+}
+
+// Archives an image with one file of the given size and checks the result
+static void test_size(const char *prog_dir, const char *test_dir, size_t size)
+{
+    char cmd[4096], dir[512], file[600], tar[512], msg[256];
+    snprintf(dir, sizeof(dir), "%s/tar", test_dir);
+    snprintf(file, sizeof(file), "%s/data.bin", dir);
+    snprintf(tar, sizeof(tar), "%s/tar.tar", test_dir);
+    snprintf(cmd, sizeof(cmd), "(rm -rf '%s' && mkdir -p '%s' && "
+             "head -c %zu /dev/urandom > '%s' && '%s/mkatr' '%s/tar.atr' '%s' && "
+             "'%s/lsatr' --tar '%s' '%s/tar.atr') > /dev/null 2>&1", dir, dir, size, file,
+             prog_dir, dir, file, prog_dir, tar, dir);
+    snprintf(msg, sizeof(msg), "can't create archive with a file of %zu bytes", size);
+    if( system(cmd) )
+    {
+        check(0, msg);
+        return;
+    }
+    size_t dlen, tlen;
+    uint8_t *data = read_file(file, &dlen);
+    uint8_t *arch = read_file(tar, &tlen);
+    check(data && arch && dlen == size, msg);
+    if( data && arch && dlen == size )
+    {
+        size_t end = BLOCK + size;
+        snprintf(msg, sizeof(msg), "archive with a file of %zu bytes is %zu bytes", size,
+                 tlen);
+        check(!(tlen % RECORD) && tlen >= end + 2 * BLOCK, msg);
+        snprintf(msg, sizeof(msg), "wrong entry in archive with a file of %zu bytes",
+                 size);
+        check(tlen >= end && !memcmp(arch, "DATA.BIN", 9) &&
+                  strtoul((char *)arch + 124, 0, 8) == size &&
+                  !memcmp(arch + BLOCK, data, size),
+              msg);
+        snprintf(msg, sizeof(msg), "padding not zero in archive with a file of %zu bytes",
+                 size);
+        for( size_t i = end; i < tlen; i++ )
+            if( arch[i] )
+            {
+                check(0, msg);
+                break;
+            }
+    }
+    free(data);
+    free(arch);
+}
+
+int main(int argc, char **argv)
+{
+    // Sizes that leave from one block to a full record of padding
+    static const size_t sizes[] = {0, 1, 8191, 8192, 8703, 8704, 9215, 9216, 9217, 9728};
+    if( argc != 3 )
+    {
+        fprintf(stderr, "usage: %s <prog_dir> <test_dir>\n", argv[0]);
+        return 2;
+    }
+    for( size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ )
+        test_size(argv[1], argv[2], sizes[i]);
+
+    if( !failed )
+        printf("test_tar: OK\n");
+    return failed;
+}